@@ -0,0 +1,516 @@
+/* Component micro benchmarks
+
+   each benchmark times one component on its own and reports one line
+   of csv per configuration:
+
+     benchmark,param,iterations,ns_per_op,mops_per_sec
+
+   results go to stderr and to the file named on the command line
+   ( bench_output.txt by default ).  Every measurement is the median of
+   several repetitions after a warmup.  Book output is sent to a null
+   stream so the cost of formatting TOB and trade lines is included
+   but the terminal isn't.
+*/
+
+//system headers
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//my headers
+#include "ordermanager.h"
+#include "orderparser.h"
+#include "cwfq.h"
+#include "pool.h"
+#include "placement.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+const int REPS = 5;
+
+std::ofstream results;
+
+/** discard everything, used to silence the books */
+class NullBuf : public std::streambuf {
+protected:
+  int overflow( int c ) override { return c; }
+  std::streamsize xsputn( const char*, std::streamsize n ) override { return n; }
+};
+
+void report( const string& name, const string& param, size_t iters, double ns ) {
+  std::ostringstream line;
+  line << name << "," << param << "," << iters << "," << ns << "," << ( ns > 0 ? 1000.0 / ns : 0 );
+  std::cerr << line.str() << std::endl;
+  results << line.str() << std::endl;
+}
+
+/** time body(iters) REPS times after a warmup, return the median ns per op */
+template <class F>
+double measure( size_t iters, F body ) {
+  body(iters / 10 + 1);
+  vector<double> runs;
+  for ( int r = 0; r < REPS; ++r ) {
+    auto start = std::chrono::steady_clock::now();
+    body(iters);
+    auto end = std::chrono::steady_clock::now();
+    runs.push_back( std::chrono::duration<double, std::nano>(end - start).count() / iters );
+  }
+  std::sort(runs.begin(), runs.end());
+  return runs[REPS / 2];
+}
+
+void benchParser() {
+  const char *lines[] = {
+    "N,1,IBM,10,100,B,1",
+    "C,1,1",
+    "R,1,1,11,50",
+    "F",
+  };
+  for ( const char *line : lines ) {
+    string input(line);
+    size_t iters = 200000;
+    double ns = measure( iters, [&](size_t n) {
+      for ( size_t i = 0; i < n; ++i ) {
+        delete OrderParser::parse(input);
+      }
+    });
+    report( "parser.parse", string(1, line[0]), iters, ns );
+  }
+}
+
+void benchRingFifo() {
+  using queue_t = CWFQ::RingFifo<Order, 1024>;
+  size_t iters = 1000000;
+  queue_t *q = new queue_t;
+  // the producer runs on this thread, later benchmarks mustn't stay pinned
+  Placement::AffinityGuard unpin;
+  double ns = measure( iters, [&](size_t n) {
+    std::thread consumer([&]() {
+      Placement::pinThread(2);
+      Order o;
+      for ( size_t i = 0; i < n; ) {
+        if ( q->pop(o) ) {
+          ++i;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    Placement::pinThread(1);
+    Order o('N', 1, 1, 10, 100, true, "IBM");
+    for ( size_t i = 0; i < n; ) {
+      if ( q->push(o) ) {
+        ++i;
+      } else {
+        std::this_thread::yield(); // don't starve the consumer on a single cpu
+      }
+    }
+    consumer.join();
+  });
+  delete q;
+  report( "ringfifo.push_pop", "order_2threads", iters, ns );
+}
+
+void benchPool() {
+  size_t iters = 1000000;
+  pool<Level, level_id_t> p(64);
+  double ns = measure( iters, [&](size_t n) {
+    for ( size_t i = 0; i < n; ++i ) {
+      p.free( p.alloc() );
+    }
+  });
+  report( "pool.alloc_free", "single", iters, ns );
+
+  for ( size_t burst : { 64, 4096 } ) {
+    pool<Level, level_id_t> b(64);
+    vector<level_id_t> ids(burst);
+    size_t rounds = 2000000 / burst;
+    ns = measure( rounds, [&](size_t n) {
+      for ( size_t r = 0; r < n; ++r ) {
+        for ( size_t i = 0; i < burst; ++i ) {
+          ids[i] = b.alloc();
+        }
+        for ( size_t i = 0; i < burst; ++i ) {
+          b.free(ids[i]);
+        }
+      }
+    });
+    report( "pool.alloc_free", "burst_" + std::to_string(burst), rounds * burst, ns / burst );
+  }
+}
+
+template <class Queue>
+void benchLevel( const string& qname ) {
+  for ( int depth : { 1, 16, 256, 4096 } ) {
+    BasicLevel<int, int, Queue> lvl(10, 0);
+    vector<Order> resting(depth, Order('N', 0, 1, 10, 100, true, "IBM"));
+    for ( int i = 0; i < depth; ++i ) {
+      resting[i].setUserOrderId(i);
+      lvl.addOrder(&resting[i]);
+    }
+    Order o('N', depth, 1, 10, 100, true, "IBM");
+
+    // join the back and cancel from the back, the std queues have to
+    // scan for the order so keep the deep runs short
+    size_t iters = depth >= 256 ? 20000 : 200000;
+    double ns = measure( iters, [&](size_t n) {
+      for ( size_t i = 0; i < n; ++i ) {
+        lvl.addOrder(&o);
+        lvl.cancelOrder(&o);
+      }
+    });
+    report( "level.add_cancel_back." + qname, std::to_string(depth), iters, ns );
+
+    // cancel from the middle and rejoin at the back
+    size_t mid_iters = iters;
+    int next = 0;
+    ns = measure( mid_iters, [&](size_t n) {
+      for ( size_t i = 0; i < n; ++i ) {
+        Order *m = &resting[ (depth / 2 + next++) % depth ];
+        lvl.cancelOrder(m);
+        lvl.addOrder(m);
+      }
+    });
+    report( "level.cancel_mid_readd." + qname, std::to_string(depth), mid_iters, ns );
+    lvl.flushOrders();
+  }
+}
+
+/** what a sweep reads and writes on each resting order it fills, over
+    Order as laid out and over the split alternative: a 32 byte hot
+    record per order in one array and the rest in a parallel cold array
+    indexed by the same handle, see order.h.  sequential queues the
+    orders in the order their slots were handed out, scattered in a
+    random order of slots as a pool hands them back once orders have
+    come and gone.  the queue is big enough to miss the cache.  engine
+    is the whole fill of each order of a level that size, retiring it
+    and publishing the trade, for scale */
+void benchOrderLayout() {
+  struct Hot {
+    uint32_t next, prev;   // handles, time priority at the level
+    uint32_t unext, uprev; // the owning user's live orders
+    uint32_t ulist;
+    int32_t qty;
+    int32_t user;
+    int32_t uoid;
+  };
+  struct Cold {
+    int price;
+    int minQty;
+    int stopPrice;
+    Order::OrderType otype;
+    OrderBook *obook;
+    string symbol;
+  };
+  static_assert( sizeof(Hot) == 32, "two hot records to a cache line" );
+
+  const size_t N = 1 << 16;
+  vector<Order> orders( N, Order('N', 0, 1, 10, 100, true, "IBM") );
+  vector<Hot> hot(N);
+  vector<Cold> cold( N, Cold{ 10, 0, 0, Order::eNEW, NULL, "IBM" } );
+  for ( const char *queue : { "sequential", "scattered" } ) {
+    vector<uint32_t> slots(N);
+    for ( size_t i = 0; i < N; ++i ) {
+      slots[i] = uint32_t(i);
+    }
+    if ( queue[0] == 's' && queue[1] == 'c' ) {
+      std::shuffle( slots.begin(), slots.end(), std::mt19937(7) );
+    }
+    IntrusiveQueue q;
+    for ( size_t i = 0; i < N; ++i ) {
+      Order& o = orders[ slots[i] ];
+      o.setUserOrderId( int(i) );
+      o.setHandle( order_id_t(slots[i]) );
+      q.push_back(&o);
+      Hot& h = hot[ slots[i] ];
+      h.prev = i ? slots[i - 1] : UINT32_MAX;
+      h.next = i + 1 < N ? slots[i + 1] : UINT32_MAX;
+      h.unext = h.next;
+      h.uprev = h.prev;
+      h.ulist = 0;
+      h.qty = 100;
+      h.user = 1;
+      h.uoid = int32_t(i);
+    }
+
+    uint64_t sink = 0;
+    double ns = measure( 20 * N, [&](size_t n) {
+      for ( size_t done = 0; done < n; ) {
+        for ( Order *o = q.front(); o && done < n; o = o->queueLinks().next, ++done ) {
+          sink += uint64_t( o->getUser() ) ^ uint64_t( o->getUserOrderId() ) ^ uint64_t( o->getHandle() )
+                  ^ reinterpret_cast<uintptr_t>( o->userLinks().next ) ^ reinterpret_cast<uintptr_t>( o->getUserList() );
+          o->setQty( 100 - o->getQty() );
+        }
+      }
+    });
+    report( "order_layout.sweep.object", queue, 20 * N, ns );
+
+    ns = measure( 20 * N, [&](size_t n) {
+      for ( size_t done = 0; done < n; ) {
+        for ( uint32_t h = slots[0]; h != UINT32_MAX && done < n; h = hot[h].next, ++done ) {
+          Hot& r = hot[h];
+          sink += uint64_t( r.user ) ^ uint64_t( r.uoid ) ^ h ^ r.unext ^ r.ulist;
+          r.qty = 100 - r.qty;
+        }
+      }
+    });
+    report( "order_layout.sweep.split", queue, 20 * N, ns );
+    volatile uint64_t keep = sink; // or the reads are dropped
+    (void)keep;
+    q.clear();
+  }
+
+  // the same queue filled by the engine, retiring every order it fills.
+  // the refill between sweeps is untimed
+  const int DEPTH = 4096;
+  OrderManager mgr;
+  int uoid = 1;
+  auto refill = [&]() {
+    for ( int i = 0; i < DEPTH; ++i ) {
+      Order o('N', uoid++, 1 + i % 64, 1000, 10, false, "IBM");
+      mgr.addOrder(&o);
+    }
+  };
+  size_t sweeps = 200;
+  vector<double> runs;
+  for ( int r = 0; r < REPS; ++r ) {
+    double total = 0;
+    for ( size_t i = 0; i < sweeps; ++i ) {
+      refill();
+      Order o('N', uoid++, 99, 1000, 10 * DEPTH, true, "IBM");
+      auto start = std::chrono::steady_clock::now();
+      mgr.addOrder(&o);
+      auto end = std::chrono::steady_clock::now();
+      total += std::chrono::duration<double, std::nano>(end - start).count();
+    }
+    runs.push_back( total / ( sweeps * DEPTH ) );
+  }
+  std::sort(runs.begin(), runs.end());
+  report( "order_layout.sweep.engine", std::to_string(DEPTH), sweeps * DEPTH, runs[REPS / 2] );
+}
+
+/** time only body(iters), setup() runs untimed before each repetition */
+template <class S, class F>
+double measureWithSetup( size_t iters, S setup, F body ) {
+  setup();
+  body(iters / 10 + 1);
+  vector<double> runs;
+  for ( int r = 0; r < REPS; ++r ) {
+    setup();
+    auto start = std::chrono::steady_clock::now();
+    body(iters);
+    auto end = std::chrono::steady_clock::now();
+    runs.push_back( std::chrono::duration<double, std::nano>(end - start).count() / iters );
+  }
+  std::sort(runs.begin(), runs.end());
+  return runs[REPS / 2];
+}
+
+/** a book pre-filled with depth bid levels below 1000 and depth ask
+    levels above 1002, leaving 1001 free for a new inside level */
+struct BookFixture {
+  OrderManager mgr;
+  int uoid;
+
+  explicit BookFixture( int depth ) : uoid(1) {
+    mgr.setDefaultBookConfig( BookConfig(depth + 1) );
+    for ( int i = 0; i < depth; ++i ) {
+      add( 1000 - i, 100, true );
+      add( 1002 + i, 100, false );
+    }
+  }
+
+  void add( int price, int qty, bool buy, int user=1 ) {
+    Order o('N', uoid++, user, price, qty, buy, "IBM");
+    mgr.addOrder(&o);
+  }
+
+  void cancel( int id, int user=1 ) {
+    Order c('C', id, user);
+    mgr.cancelOrder(&c);
+  }
+};
+
+void benchBook() {
+  struct Case {
+    const char *name;
+    int offset; // price relative to the best bid
+  };
+  for ( int depth : { 1, 16, 64, 256 } ) {
+    Case cases[] = {
+      { "book.insert_delete_level.inside", 1 },
+      { "book.insert_delete_level.outside", -depth },
+      { "book.join_cancel.best", 0 },
+    };
+    for ( const Case& c : cases ) {
+      BookFixture f(depth);
+      size_t iters = 200000;
+      double ns = measure( iters, [&](size_t n) {
+        for ( size_t i = 0; i < n; ++i ) {
+          int id = f.uoid;
+          f.add( 1000 + c.offset, 10, true, 2 );
+          f.cancel( id, 2 );
+        }
+      });
+      report( c.name, std::to_string(depth), iters, ns );
+    }
+
+    // one buy sweeping every ask level, the refill between sweeps is untimed.
+    // each sweep is timed on its own so this includes the clock overhead
+    BookFixture f(depth);
+    size_t iters = depth > 64 ? 2000 : 20000;
+    vector<double> runs;
+    for ( int r = 0; r < REPS; ++r ) {
+      double total = 0;
+      for ( size_t i = 0; i < iters; ++i ) {
+        auto start = std::chrono::steady_clock::now();
+        f.add( 1002 + depth, 100 * depth, true, 2 );
+        auto end = std::chrono::steady_clock::now();
+        total += std::chrono::duration<double, std::nano>(end - start).count();
+        for ( int l = 0; l < depth; ++l ) {
+          f.add( 1002 + l, 100, false );
+        }
+      }
+      runs.push_back( total / iters );
+    }
+    std::sort(runs.begin(), runs.end());
+    report( "book.sweep_levels", std::to_string(depth), iters, runs[REPS / 2] );
+  }
+}
+
+void benchManager() {
+  // steady state new / cancel flow over a 32 level book
+  const int LIVE = 1024;
+  vector<string> lines;
+  for ( int i = 0; i < 100000; ++i ) {
+    int id = i + 1;
+    bool buy = i % 2;
+    int price = buy ? 1000 - (i * 7) % 32 : 1001 + (i * 11) % 32;
+    lines.push_back( "N,1,IBM," + std::to_string(price) + ",100," + (buy ? "B," : "S,") + std::to_string(id) );
+    if ( id > LIVE ) {
+      lines.push_back( "C,1," + std::to_string(id - LIVE) );
+    }
+  }
+  vector<Order*> msgs;
+  msgs.reserve(lines.size());
+  OrderManager *mgr = NULL;
+  size_t pos = 0;
+  double ns = measureWithSetup( lines.size(),
+    [&]() {
+      delete mgr;
+      mgr = new OrderManager;
+      // whatever the last run didn't consume
+      for ( ; pos < msgs.size(); ++pos ) {
+        delete msgs[pos];
+      }
+      msgs.clear();
+      for ( const string& line : lines ) {
+        msgs.push_back( OrderParser::parse(line) );
+      }
+      pos = 0;
+    },
+    [&](size_t n) {
+      for ( size_t i = 0; i < n; ++i ) {
+        mgr->handle(msgs[pos++]);
+      }
+    });
+  // whatever the warmup didn't consume
+  for ( ; pos < msgs.size(); ++pos ) {
+    delete msgs[pos];
+  }
+  delete mgr;
+  report( "manager.handle", "new_cancel_32lvl", lines.size(), ns );
+}
+
+/** random cancels against a book too big for the cache, one message
+    at a time and in batches so the prefetching can overlap the misses */
+void benchCancelStorm() {
+  const int LIVE = 1 << 18;
+  vector<int> order_ids(LIVE);
+  for ( int i = 0; i < LIVE; ++i ) {
+    order_ids[i] = i + 1;
+  }
+  std::mt19937 rng(7);
+  std::shuffle( order_ids.begin(), order_ids.end(), rng );
+
+  for ( size_t batch : { size_t(1), size_t(16), size_t(64) } ) {
+    OrderManager *mgr = NULL;
+    vector<Order*> msgs;
+    size_t pos = 0;
+    double ns = measureWithSetup( LIVE / 2,
+      [&]() {
+        delete mgr;
+        for ( ; pos < msgs.size(); ++pos ) {
+          delete msgs[pos];
+        }
+        mgr = new OrderManager;
+        for ( int i = 1; i <= LIVE; ++i ) {
+          bool buy = i % 2;
+          Order o('N', i, i % 64, buy ? 5000 - i % 1000 : 5001 + i % 1000, 100, buy, "IBM");
+          mgr->addOrder(&o);
+        }
+        msgs.clear();
+        for ( int id : order_ids ) {
+          msgs.push_back( Order::buildOrder('C', id, id % 64) );
+        }
+        pos = 0;
+      },
+      [&](size_t n) {
+        size_t end = pos + n;
+        while ( pos < end ) {
+          size_t k = std::min( batch, end - pos );
+          if ( k == 1 ) {
+            mgr->handle( msgs[pos] );
+          } else {
+            mgr->handleBatch( &msgs[pos], k );
+          }
+          pos += k;
+        }
+      });
+    for ( ; pos < msgs.size(); ++pos ) {
+      delete msgs[pos];
+    }
+    delete mgr;
+    report( "manager.cancel_storm", "batch_" + std::to_string(batch), LIVE / 2, ns );
+  }
+}
+
+}
+
+int main( int argc, char **argv ) {
+  const char *out = argc > 1 ? argv[1] : "bench_output.txt";
+  results.open(out);
+  if ( !results.is_open() ) {
+    std::cerr << "ERROR COULDNT OPEN " << out << std::endl;
+    return 1;
+  }
+  results << "benchmark,param,iterations,ns_per_op,mops_per_sec" << std::endl;
+
+  NullBuf null;
+  std::streambuf *old = std::cout.rdbuf(&null);
+
+  benchParser();
+  benchRingFifo();
+  benchPool();
+  benchLevel<IntrusiveQueue>("intrusive");
+  benchLevel<ListQueue>("list");
+  benchLevel<DequeQueue>("deque");
+  benchOrderLayout();
+  benchBook();
+  benchManager();
+  benchCancelStorm();
+
+  std::cout.rdbuf(old);
+  return 0;
+}
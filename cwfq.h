@@ -3,30 +3,54 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
+
+#include "stats.h"
+#include "util.h"
 
 namespace CWFQ {
 
+  /** Single producer single consumer queue
+
+      no virtuals and no pointers, so with a trivially copyable Element
+      the ring can sit in shared memory between two processes, see
+      gateway.h.  pick Size so Capacity is a power of two and the index
+      wrap is a mask. */
   template <typename Element, size_t Size>
     class RingFifo{
   public:
     enum { Capacity = Size + 1 };
 
-  RingFifo() : _tail(0), _head(0){}
-    virtual ~RingFifo() {}
+  RingFifo() : _tail(0), _head(0), _pop_waiting(false){}
+    ~RingFifo() {}
 
     bool push( const Element& item );
     bool pop( Element& item );
+    /** pop for a consumer that can't trust the memory the ring is in,
+        the producer being another process that can write anything
+        there.  the consumer's index is head, kept in its own memory and
+        only copied to the ring for the producer to see.  a tail that
+        isn't an index sets corrupt and nothing is read */
+    bool popUntrusted( size_t& head, Element& item, bool& corrupt );
 
     bool wasEmpty() const;
     bool wasFull() const;
+    /** elements waiting, a snapshot like wasEmpty */
+    size_t wasSize() const;
     bool isLockFree() const;
 
+    /** push_full is only written by the producer and pop_empty by the
+        consumer, each on its own cache line */
+    const RingStats& getStats() const { return _stats; }
+
   private:
     size_t increment( size_t idx ) const;
 
-    std::atomic <size_t> _tail;  // tail(input) index
+    alignas(CACHE_LINE) std::atomic <size_t> _tail;  // tail(input) index
     Element _array[Capacity];
-    std::atomic<size_t>  _head; // head(output) index
+    alignas(CACHE_LINE) std::atomic<size_t>  _head; // head(output) index
+    bool _pop_waiting; // consumer's, the last pop found the ring empty
+    RingStats _stats;
   };
 
   template <typename Element, size_t Size>
@@ -41,6 +65,7 @@ namespace CWFQ {
       return true;
     }
 
+    _stats.push_full.add();
     return false; // full queue
 
   }
@@ -53,14 +78,34 @@ namespace CWFQ {
   {
     const auto current_head = _head.load( std::memory_order_relaxed );
     if ( current_head == _tail.load( std::memory_order_acquire ) ) {
+      // once per wait however long the consumer polls
+      if ( !_pop_waiting ) {
+        _stats.pop_empty.add();
+        _pop_waiting = true;
+      }
       return false; // empty queue
     }
+    _pop_waiting = false;
 
     item = _array[current_head];
     _head.store(increment(current_head), std::memory_order_release);
     return true;
   }
 
+  template <typename Element, size_t Size>
+    bool RingFifo<Element, Size>::popUntrusted( size_t& head, Element& item, bool& corrupt )
+  {
+    const size_t tail = _tail.load( std::memory_order_acquire );
+    corrupt = ( tail >= Capacity );
+    if ( corrupt || head == tail ) {
+      return false;
+    }
+    item = _array[head];
+    head = increment(head);
+    _head.store( head, std::memory_order_release );
+    return true;
+  }
+
   template <typename Element, size_t Size>
     bool RingFifo<Element, Size>::wasEmpty() const
   {
@@ -78,6 +123,12 @@ namespace CWFQ {
   }
 
 
+  template <typename Element, size_t Size>
+    size_t RingFifo<Element, Size>::wasSize() const
+  {
+    return ( _tail.load() + Capacity - _head.load() ) % Capacity;
+  }
+
   template <typename Element, size_t Size>
     bool RingFifo<Element, Size>::isLockFree() const
   {
@@ -90,6 +141,138 @@ namespace CWFQ {
     return (idx + 1) % Capacity;
   }
 
+  /** Single writer, any number of readers, each with its own Cursor
+
+      the same single writer discipline as RingFifo ( the writer owns
+      its index, loads it relaxed and publishes with a release store )
+      except that nobody ever pushes back on the writer: it overwrites
+      the oldest slot whatever the readers are doing, so a slow reader
+      can never stall the engine.  readers hold no shared state at all,
+      the ring can be mapped read only into their processes.
+
+      every slot carries the sequence of the element in it, 2n+1 while
+      element n is being written and 2n+2 once it's done.  a reader
+      checks the slot's sequence before and after looking at the
+      element, if it isn't the one it wanted the writer has lapped it
+      and the elements it missed are counted in Cursor::lost before it
+      skips to the oldest one still there.
+
+      peek() hands out the element where it sits, the caller must
+      finish with it and call release() which tells it whether the
+      element was overwritten while it was looking.  Size is a power
+      of two. */
+  template <typename Element, size_t Size>
+    class BroadcastRing {
+  public:
+    static_assert( Size >= 2 && ( Size & (Size - 1) ) == 0, "Size must be a power of two" );
+
+    struct Cursor {
+      uint64_t next;   // sequence of the next element to read
+      uint64_t lost;   // elements overwritten before this reader got to them
+    };
+
+  BroadcastRing() : _tail(0) {
+      for ( size_t i = 0; i < Size; ++i ) {
+        _slots[i].seq.store( 0, std::memory_order_relaxed );
+      }
+    }
+
+    void push( const Element& item );
+
+    /** a cursor that sees only what is pushed from now on */
+    Cursor latest() const { return Cursor{ _tail.load( std::memory_order_acquire ), 0 }; }
+    /** a cursor starting at the oldest element still in the ring */
+    Cursor oldest() const;
+
+    /** the element at c, NULL if there is nothing new yet */
+    const Element* peek( Cursor& c ) const;
+    /** done with what peek() returned, false if it was overwritten
+        meanwhile and must be discarded */
+    bool release( Cursor& c ) const;
+    /** copying read, false if there is nothing new yet */
+    bool pop( Cursor& c, Element& item ) const;
+
+    /** elements pushed that c hasn't read */
+    uint64_t lag( const Cursor& c ) const { return _tail.load( std::memory_order_acquire ) - c.next; }
+    uint64_t pushed() const { return _tail.load( std::memory_order_acquire ); }
+
+  private:
+    struct alignas(64) Slot {
+      std::atomic<uint64_t> seq;
+      Element item;
+    };
+
+    std::atomic<uint64_t> _tail;  // elements pushed, only the writer stores it
+    Slot _slots[Size];
+  };
+
+  template <typename Element, size_t Size>
+    void BroadcastRing<Element, Size>::push( const Element& item )
+  {
+    const uint64_t n = _tail.load( std::memory_order_relaxed );
+    Slot& s = _slots[ n & (Size - 1) ];
+    s.seq.store( 2 * n + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_release );
+    s.item = item;
+    s.seq.store( 2 * n + 2, std::memory_order_release );
+    _tail.store( n + 1, std::memory_order_release );
+  }
+
+  // the slot the writer will fill next is still holding tail - Size, so
+  // the oldest one safe to start from is one after it
+  template <typename Element, size_t Size>
+    typename BroadcastRing<Element, Size>::Cursor BroadcastRing<Element, Size>::oldest() const
+  {
+    const uint64_t tail = _tail.load( std::memory_order_acquire );
+    return Cursor{ tail >= Size ? tail - Size + 1 : 0, 0 };
+  }
+
+  template <typename Element, size_t Size>
+    const Element* BroadcastRing<Element, Size>::peek( Cursor& c ) const
+  {
+    for ( ; ; ) {
+      const uint64_t tail = _tail.load( std::memory_order_acquire );
+      if ( c.next >= tail ) {
+        return NULL;
+      }
+      if ( tail - c.next >= Size ) {
+        c.lost += tail - Size + 1 - c.next;
+        c.next = tail - Size + 1;
+      }
+      const Slot& s = _slots[ c.next & (Size - 1) ];
+      if ( s.seq.load( std::memory_order_acquire ) == 2 * c.next + 2 ) {
+        return &s.item;
+      }
+      // lapped between reading the tail and the slot
+      c.lost += 1;
+      c.next += 1;
+    }
+  }
+
+  template <typename Element, size_t Size>
+    bool BroadcastRing<Element, Size>::release( Cursor& c ) const
+  {
+    std::atomic_thread_fence( std::memory_order_acquire );
+    const bool ok = _slots[ c.next & (Size - 1) ].seq.load( std::memory_order_relaxed ) == 2 * c.next + 2;
+    if ( !ok ) {
+      c.lost += 1;
+    }
+    c.next += 1;
+    return ok;
+  }
+
+  template <typename Element, size_t Size>
+    bool BroadcastRing<Element, Size>::pop( Cursor& c, Element& item ) const
+  {
+    while ( const Element *e = peek(c) ) {
+      item = *e;
+      if ( release(c) ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
 }
 
 #endif
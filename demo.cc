@@ -1,25 +1,142 @@
 /* Main file for My Order Book Programming Exercise */
 
 //system headers
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <memory>
 #include <thread>
 
 //my headers
 #include "ordermanager.h"
 #include "orderparser.h"
 #include "cwfq.h"
+#include "placement.h"
+#include "output.h"
+#include "eventlog.h"
+#include "publisher.h"
+#include "replica.h"
+#include "shm.h"
+#include "gateway.h"
 
 using std::cin;
 using std::cout;
 using std::endl;
 using std::string;
 
-CWFQ::RingFifo<Order, 128> queue;
+using queue_t = CWFQ::RingFifo<Order, 128>;
+queue_t *queue = NULL;
 
-void read_file( const std::string &filename ) {
+// set by SIGINT / SIGTERM, the gateway pipeline runs until then
+volatile std::sig_atomic_t stop_requested = 0;
+void request_stop( int ) { stop_requested = 1; }
+
+/** where the pipeline threads run and how their memory is placed,
+    a cpu of -1 leaves that thread to the scheduler */
+struct PipelineConfig {
+  int ingress_cpu = -1;
+  int matcher_cpu = -1;
+  int publisher_cpu = -1; // with async_out
+  bool huge_pages = false;
+  bool prefault = false;
+  string shm_out;   // shared memory output ring name, see output.h
+  string gateway;   // shared memory order entry channel prefix, see gateway.h
+  string event_log; // binary audit log file, see eventlog.h
+  bool async_out = false; // text written by a publisher thread, see publisher.h
+  string replicate; // replica channel to forward the input to, see replica.h
+  string standby;   // replica channel to follow, taking over input_file when the primary is lost
+  int takeover_ms = 20;
+  int clients = 1;
+  RiskLimits risk;  // every user's limits, see risk.h
+  string input;
+};
+
+/** qty,notional,open orders,position,band bps with 0 for no limit */
+bool parse_risk( const string& arg, RiskLimits& risk ) {
+  long long qty, notional, position;
+  int open, band;
+  if ( sscanf( arg.c_str(), "%lld,%lld,%d,%lld,%d", &qty, &notional, &open, &position, &band ) != 5 ) {
+    return false;
+  }
+  risk = RiskLimits( qty, notional, open, position, band );
+  return true;
+}
+
+/** -1 for unpinned or one of this machine's cpus */
+bool check_cpu( const char *option, int cpu ) {
+  if ( cpu < -1 || ( cpu >= 0 && !Placement::cpuExists(cpu) ) ) {
+    std::cerr << option << " " << cpu << ": there's no such cpu, this machine has "
+              << std::thread::hardware_concurrency() << endl;
+    return false;
+  }
+  return true;
+}
+
+bool parse_args( int c, char **argv, PipelineConfig& cfg ) {
+  for ( int i = 1; i < c; ++i ) {
+    string arg = argv[i];
+    if ( arg == "--ingress-cpu" && i + 1 < c ) {
+      cfg.ingress_cpu = std::stoi(argv[++i]);
+    } else if ( arg == "--matcher-cpu" && i + 1 < c ) {
+      cfg.matcher_cpu = std::stoi(argv[++i]);
+    } else if ( arg == "--publisher-cpu" && i + 1 < c ) {
+      cfg.publisher_cpu = std::stoi(argv[++i]);
+    } else if ( arg == "--huge-pages" ) {
+      cfg.huge_pages = true;
+    } else if ( arg == "--prefault" ) {
+      cfg.prefault = true;
+    } else if ( arg == "--shm-out" && i + 1 < c ) {
+      cfg.shm_out = argv[++i];
+    } else if ( arg == "--replicate" && i + 1 < c ) {
+      cfg.replicate = argv[++i];
+    } else if ( arg == "--standby" && i + 1 < c ) {
+      cfg.standby = argv[++i];
+    } else if ( arg == "--takeover-ms" && i + 1 < c ) {
+      cfg.takeover_ms = std::stoi(argv[++i]);
+    } else if ( arg == "--async-out" ) {
+      cfg.async_out = true;
+    } else if ( arg == "--event-log" && i + 1 < c ) {
+      cfg.event_log = argv[++i];
+    } else if ( arg == "--gateway" && i + 1 < c ) {
+      cfg.gateway = argv[++i];
+    } else if ( arg == "--clients" && i + 1 < c ) {
+      cfg.clients = std::stoi(argv[++i]);
+    } else if ( arg == "--risk" && i + 1 < c ) {
+      if ( !parse_risk(argv[++i], cfg.risk) ) {
+        return false;
+      }
+    } else if ( arg[0] != '-' && cfg.input.empty() ) {
+      cfg.input = arg;
+    } else {
+      return false;
+    }
+  }
+  if ( !check_cpu("--ingress-cpu", cfg.ingress_cpu) || !check_cpu("--matcher-cpu", cfg.matcher_cpu)
+       || !check_cpu("--publisher-cpu", cfg.publisher_cpu) ) {
+    return false;
+  }
+  // the gateway replaces the input file, a standby takes over reading
+  // one so only a file fed primary can be replicated
+  return cfg.input.empty() != cfg.gateway.empty() && cfg.clients > 0
+    && ( cfg.standby.empty() || !cfg.input.empty() ) && cfg.takeover_ms > 0
+    && ( cfg.publisher_cpu < 0 || cfg.async_out )
+    && ( cfg.replicate.empty() || ( cfg.gateway.empty() && cfg.replicate != cfg.standby ) );
+}
+
+/** every line is one message, numbered from 1 the way a primary
+    sequences what it handles ( see replica.h ).  a standby that took
+    over passes the primary's sequence number of the last message it
+    applied and the messages up to it are read past without being
+    queued */
+void read_file( const std::string &filename, int cpu, uint64_t resume_after ) {
+  if ( cpu >= 0 && !Placement::pinThread(cpu) ) {
+    std::cerr << "Couldn't pin the ingress thread to cpu " << cpu << endl;
+  }
   std::fstream infile;
   infile.open( filename, std::ios::in);
   if ( !infile.is_open() ) {
@@ -27,41 +144,285 @@ void read_file( const std::string &filename ) {
     return;
   }
   string line;
+  uint64_t seq = 0;
   while( getline( infile, line ) ) {
+    LAT_MARK(t_read);
     Order *x = OrderParser::parse(line);
-    while ( false == queue.push(*x) ) {
+    if ( ++seq <= resume_after ) {
+      delete x;
+      continue;
+    }
+    LAT_SET(x, eREAD, t_read);
+    LAT_STAMP(x, ePARSED);
+    LAT_STAMP(x, eENQUEUED);
+    while ( false == queue->push(*x) ) {
       sleep(1);
+      LAT_STAMP(x, eENQUEUED);
     }
   }
   infile.close();
 }
 
+class NullBuf : public std::streambuf {
+protected:
+  int overflow( int c ) override { return c; }
+  std::streamsize xsputn( const char*, std::streamsize n ) override { return n; }
+};
+
+/** follow the primary on name with output silenced until it's lost for
+    takeover_ms, then return the primary's sequence number of the last
+    message applied so the input resumes after it.  mgr has no output
+    ring, event log or publisher while it follows.  false if the primary
+    finished normally or we couldn't follow it */
+bool run_standby( const string& name, int takeover_ms, OrderManager& mgr, uint64_t& last_seq ) {
+  std::unique_ptr<Replica::Standby> standby( new Replica::Standby(name) );
+  while ( !standby->isOpen() ) {
+    if ( stop_requested ) {
+      return false;
+    }
+    std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    standby.reset( new Replica::Standby(name) );
+  }
+  NullBuf null_buf;
+  std::streambuf *old_cout = cout.rdbuf(&null_buf);
+  bool lost = false;
+  while ( standby->isFollowing() && !stop_requested ) {
+    if ( standby->poll(mgr) > 0 ) {
+      continue;
+    }
+    if ( standby->primaryDone() ) {
+      break;
+    }
+    if ( standby->primaryLost( uint64_t(takeover_ms) * 1000000 ) ) {
+      // whatever it sent before dying is still ours to apply
+      standby->poll(mgr);
+      lost = true;
+      break;
+    }
+    std::this_thread::yield();
+  }
+  cout.rdbuf(old_cout);
+  last_seq = standby->getLastSeq();
+  if ( lost && standby->isFollowing() ) {
+    std::cerr << "Primary lost, taking over after message " << last_seq << endl;
+    return true;
+  }
+  std::cerr << "Stopped following the primary after message " << last_seq << endl;
+  return false;
+}
+
+/** the publisher thread, writes the text the matcher queued until
+    done is set and everything queued is out */
+void publish_output( Publisher *publisher, const std::atomic<bool> *done, int cpu ) {
+  if ( cpu >= 0 && !Placement::pinThread(cpu) ) {
+    std::cerr << "Couldn't pin the publisher thread to cpu " << cpu << endl;
+  }
+  while ( true ) {
+    if ( publisher->drain(cout, 256) == 0 ) {
+      if ( done->load() && publisher->drain(cout) == 0 ) {
+        break;
+      }
+      cout.flush();
+      std::this_thread::yield();
+    }
+  }
+  cout.flush();
+}
+
+/** the ingress thread in gateway mode, busy polls the client channels */
+void poll_gateway( Gateway *gw, int cpu ) {
+  if ( cpu >= 0 && !Placement::pinThread(cpu) ) {
+    std::cerr << "Couldn't pin the ingress thread to cpu " << cpu << endl;
+  }
+  auto enqueue = [&]( Order& o ) {
+    LAT_STAMP(&o, eREAD);
+    LAT_STAMP(&o, eENQUEUED);
+    while ( false == queue->push(o) ) {
+      std::this_thread::yield();
+      LAT_STAMP(&o, eENQUEUED);
+    }
+  };
+  while ( !stop_requested ) {
+    if ( gw->poll(enqueue) == 0 ) {
+      std::this_thread::yield();
+    }
+  }
+}
+
 int main(int c, char **argv) {
 
+  PipelineConfig cfg;
+  if ( !parse_args(c, argv, cfg) ) {
+    std::cerr << "usage: demo [--ingress-cpu n] [--matcher-cpu n] [--publisher-cpu n] [--huge-pages] [--prefault] [--shm-out name]"
+                 " [--risk qty,notional,open,position,band_bps] [--event-log file] [--async-out] [--replicate name | --standby name [--takeover-ms n]] input_file | --gateway prefix [--clients n]" << endl;
+    return 1;
+  }
+
   cout << "Welcome to Order Mgmt Demo program!" << endl;
 
-  OrderManager order_mgr;
-  //read input
-  std::thread read_thread(read_file, argv[1]);
+  // matching runs on this thread, pin it before anything it owns is
+  // allocated so first touch lands on its own node
+  if ( cfg.matcher_cpu >= 0 && !Placement::pinThread(cfg.matcher_cpu) ) {
+    std::cerr << "Couldn't pin the matcher thread to cpu " << cfg.matcher_cpu << endl;
+  }
+  MemConfig mem( cfg.huge_pages, cfg.prefault,
+                 cfg.matcher_cpu >= 0 ? Placement::cpuNode(cfg.matcher_cpu) : -1 );
+  // the ring is read by the matcher so it lives on the matcher's node
+  queue = Placement::create<queue_t>(mem);
+  OrderManager order_mgr(mem);
+  order_mgr.setDefaultRiskLimits(cfg.risk);
+  // a standby shadows the primary first with no outputs attached and
+  // only opens them and reads the input once it takes over.  the
+  // primary's output ring is carried on, its event log is its own
+  uint64_t resume_after = 0;
+  if ( !cfg.standby.empty() ) {
+    if ( !cfg.event_log.empty() && std::ifstream(cfg.event_log) ) {
+      std::cerr << "Won't replace the event log " << cfg.event_log << ", a standby needs a file of its own" << endl;
+      return 1;
+    }
+    std::signal( SIGINT, request_stop );
+    std::signal( SIGTERM, request_stop );
+    if ( !run_standby(cfg.standby, cfg.takeover_ms, order_mgr, resume_after) ) {
+      return 0;
+    }
+  }
+  // left in place at exit so readers can drain it, the next run replaces
+  // it.  a standby that took over pushes on after the primary's last
+  // record so readers keep following
+  OutputRing *out_ring = NULL;
+  if ( !cfg.shm_out.empty() ) {
+    if ( !cfg.standby.empty() ) {
+      out_ring = Shm::open<OutputRing>(cfg.shm_out, true);
+    }
+    if ( out_ring == NULL ) {
+      out_ring = Shm::create<OutputRing>(cfg.shm_out);
+    }
+    if ( out_ring == NULL ) {
+      std::cerr << "Couldn't create the output ring " << cfg.shm_out << endl;
+      return 1;
+    }
+    order_mgr.setOutputRing(out_ring);
+  }
+  EventLog::Writer event_log;
+  if ( !cfg.event_log.empty() ) {
+    if ( !event_log.open(cfg.event_log) ) {
+      return 1;
+    }
+    order_mgr.setEventLog(&event_log);
+  }
+  // kill -USR1 dumps the stage latencies when built with LATENCY=1
+  LAT_INSTALL_SIGNAL();
+  // text written by its own thread, a slow stdout then conflates TOB
+  // instead of holding up matching
+  std::unique_ptr<Publisher> publisher;
+  std::atomic<bool> publish_done(false);
+  std::thread publish_thread;
+  if ( cfg.async_out ) {
+    // the ring is read by the publisher so it lives on the publisher's node
+    MemConfig publisher_mem( cfg.huge_pages, cfg.prefault,
+                             cfg.publisher_cpu >= 0 ? Placement::cpuNode(cfg.publisher_cpu) : -1 );
+    publisher.reset( new Publisher( Publisher::BACKLOG, publisher_mem ) );
+    order_mgr.setPublisher( publisher.get() );
+    publish_thread = std::thread( publish_output, publisher.get(), &publish_done, cfg.publisher_cpu );
+  }
+  std::unique_ptr<Replica::Primary> primary;
+  if ( !cfg.replicate.empty() ) {
+    primary.reset( new Replica::Primary(cfg.replicate) );
+    if ( !primary->isOpen() ) {
+      return 1;
+    }
+  }
+  //read input, from the file or from the gateway's clients until a SIGINT or SIGTERM
+  std::unique_ptr<Gateway> gateway;
+  std::thread read_thread;
+  if ( cfg.gateway.empty() ) {
+    read_thread = std::thread(read_file, cfg.input, cfg.ingress_cpu, resume_after);
+  } else {
+    gateway.reset( new Gateway(cfg.gateway, cfg.clients) );
+    if ( !gateway->isOpen() ) {
+      return 1;
+    }
+    std::signal( SIGINT, request_stop );
+    std::signal( SIGTERM, request_stop );
+    read_thread = std::thread(poll_gateway, gateway.get(), cfg.ingress_cpu);
+  }
 
+  // whatever backlog the ring holds is handled as one batch so the
+  // manager can overlap the lookups, see OrderManager::handleBatch
+  const size_t BATCH = 64;
+  Order *batch[BATCH];
   int counter = 0;
   while ( true ) {
     counter = 0;
     bool result;
     Order *o = new Order; //todo get these from a pool of Orders
-    while ( (result = queue.pop(*o)) == false && counter < 5 ) {
-      sleep(1); //sleep until ready
+    while ( (result = queue->pop(*o)) == false ) {
+      order_mgr.flushOutput();
+      if ( primary ) {
+        primary->poll();
+      }
+      if ( gateway ) {
+        // clients are waiting on every order, never sleep on them
+        if ( stop_requested ) {
+          break;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+      if ( counter == 5 ) {
+        break;
+      }
+      if ( primary ) {
+        // the matcher beats for the standby, keep beating while we wait
+        for ( uint64_t ns = 0; ns < 1000000000; ns += Replica::BEAT_NS ) {
+          std::this_thread::sleep_for( std::chrono::nanoseconds(Replica::BEAT_NS) );
+          primary->poll();
+        }
+      } else {
+        sleep(1); //sleep until ready
+      }
       ++counter;
     }
     if ( result == false )
     {
+      delete o;
       break;
     }
 
-    order_mgr.handle(o);
+    LAT_STAMP(o, eDEQUEUED);
+    batch[0] = o;
+    size_t n = 1;
+    while ( n < BATCH ) {
+      Order *next = new Order;
+      if ( !queue->pop(*next) ) {
+        delete next;
+        break;
+      }
+      LAT_STAMP(next, eDEQUEUED);
+      batch[n++] = next;
+    }
+    if ( primary ) {
+      primary->handleBatch(order_mgr, batch, n);
+    } else {
+      order_mgr.handleBatch(batch, n);
+    }
   }
 
   read_thread.join();
+  if ( publisher ) {
+    while ( !order_mgr.flushOutput() ) {
+      std::this_thread::yield();
+    }
+    publish_done.store(true);
+    publish_thread.join();
+    if ( publisher->getStalls() ) {
+      std::cerr << "Matching waited on the publisher " << publisher->getStalls() << " times with its backlog full" << std::endl;
+    }
+  }
+  event_log.close();
+  LAT_DUMP();
+  Placement::destroy(queue, mem);
+  Shm::unmap(out_ring);
 
   return 0;
 }
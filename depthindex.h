@@ -0,0 +1,231 @@
+#ifndef DEPTHINDEX_H
+#define DEPTHINDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+#include "level.h"
+
+using std::vector;
+
+/** Cumulative depth for one side of a book
+
+    Keeps a mirror of each ladder slot's price and quantity plus two
+    Fenwick trees over the slots, one of quantity and one of notional
+    ( price * qty ), so that the questions a router asks are answered
+    in O(log levels) instead of walking the ladder:
+
+      depthTo(p)        how much rests at p or better
+      costToFill(q, n)  notional to take q from the top of book
+      vwapToQty(q)      the average price of doing so
+
+    slots are in the ladder's storage order ( worst first, best last )
+    so the inner levels which churn the most are at the high end and a
+    level appearing or disappearing there only rebuilds the few tree
+    nodes above it.  A qty change at an existing level is a plain
+    O(log n) Fenwick update.
+*/
+template <typename Price, typename Qty, class Better>
+class DepthIndex {
+public:
+  DepthIndex() { clear(); }
+
+  void clear() {
+    prices.clear();
+    qtys.clear();
+    fq.assign(1, 0);
+    fn.assign(1, 0);
+    total_qty = 0;
+    total_notional = 0;
+  }
+
+  void reserve( size_t n ) {
+    prices.reserve(n);
+    qtys.reserve(n);
+    fq.reserve(n + 1);
+    fn.reserve(n + 1);
+  }
+
+  size_t size() const { return prices.size(); }
+  Qty total() const { return total_qty; }
+
+  /** a new empty level appeared at slot i */
+  void insertSlot( size_t i, Price p ) {
+    prices.insert( prices.begin() + i, p );
+    qtys.insert( qtys.begin() + i, Qty(0) );
+    fq.push_back(0);
+    fn.push_back(0);
+    rebuildFrom(i);
+  }
+
+  /** the level at slot i went away, taking whatever qty it still had */
+  void eraseSlot( size_t i ) {
+    total_qty -= qtys[i];
+    total_notional -= int64_t(qtys[i]) * prices[i];
+    prices.erase( prices.begin() + i );
+    qtys.erase( qtys.begin() + i );
+    fq.pop_back();
+    fn.pop_back();
+    rebuildFrom(i);
+  }
+
+  /** qty resting at slot i changed by dq */
+  void add( size_t i, Qty dq ) {
+    qtys[i] += dq;
+    total_qty += dq;
+    int64_t dn = int64_t(dq) * prices[i];
+    total_notional += dn;
+    for ( size_t j = i + 1; j < fq.size(); j += lowbit(j) ) {
+      fq[j] += dq;
+      fn[j] += dn;
+    }
+  }
+
+  /** quantity resting at p or better */
+  Qty depthTo( Price p ) const {
+    return total_qty - prefixQty( firstSlotNotWorse(p) );
+  }
+
+  /** notional to take q from the top of book, false if there isn't q */
+  bool costToFill( Qty q, int64_t& notional ) const {
+    if ( q <= 0 || q > total_qty ) {
+      return false;
+    }
+    // largest s with prefix(s) <= total - q, slots above s are taken
+    // whole and slot s supplies the rest
+    size_t s = 0;
+    Qty rem = total_qty - q;
+    size_t step = 1;
+    while ( (step << 1) < fq.size() ) {
+      step <<= 1;
+    }
+    for ( ; step; step >>= 1 ) {
+      if ( s + step < fq.size() && fq[s + step] <= rem ) {
+        s += step;
+        rem -= fq[s];
+      }
+    }
+    Qty above = total_qty - prefixQty(s + 1);
+    notional = ( total_notional - prefixNotional(s + 1) )
+             + int64_t(q - above) * prices[s];
+    return true;
+  }
+
+  /** average price to take q from the top of book, 0 if there isn't q */
+  double vwapToQty( Qty q ) const {
+    int64_t notional;
+    if ( !costToFill(q, notional) ) {
+      return 0;
+    }
+    return double(notional) / double(q);
+  }
+
+  /** sum of qty over slots [0, k) */
+  Qty prefixQty( size_t k ) const {
+    Qty sum = 0;
+    for ( ; k; k -= lowbit(k) ) {
+      sum += fq[k];
+    }
+    return sum;
+  }
+
+  /** sum of notional over slots [0, k) */
+  int64_t prefixNotional( size_t k ) const {
+    int64_t sum = 0;
+    for ( ; k; k -= lowbit(k) ) {
+      sum += fn[k];
+    }
+    return sum;
+  }
+
+private:
+  static size_t lowbit( size_t j ) { return j & (~j + 1); }
+
+  /** slots are sorted worst to best so binary search for the first one at p or better */
+  size_t firstSlotNotWorse( Price p ) const {
+    auto it = std::partition_point( prices.begin(), prices.end(),
+                                    [this, p](Price x) { return better(p, x); } );
+    return it - prices.begin();
+  }
+
+  /** recompute every tree node covering slot i or above, nodes below
+      only cover unchanged slots so they can be used for the prefixes */
+  void rebuildFrom( size_t i ) {
+    size_t n = prices.size();
+    run_q.resize( n - i + 1 );
+    run_n.resize( n - i + 1 );
+    run_q[0] = prefixQty(i);
+    run_n[0] = prefixNotional(i);
+    for ( size_t k = i; k < n; ++k ) {
+      run_q[k - i + 1] = run_q[k - i] + qtys[k];
+      run_n[k - i + 1] = run_n[k - i] + int64_t(qtys[k]) * prices[k];
+    }
+    for ( size_t j = i + 1; j <= n; ++j ) {
+      size_t lo = j - lowbit(j);
+      Qty lo_q = lo >= i ? run_q[lo - i] : prefixQty(lo);
+      int64_t lo_n = lo >= i ? run_n[lo - i] : prefixNotional(lo);
+      fq[j] = run_q[j - i] - lo_q;
+      fn[j] = run_n[j - i] - lo_n;
+    }
+  }
+
+  Better better;
+  vector<Price> prices;
+  vector<Qty> qtys;
+  vector<Qty> fq; // 1 indexed fenwick of qty
+  vector<int64_t> fn; // 1 indexed fenwick of notional
+  vector<Qty> run_q; // scratch for rebuilds
+  vector<int64_t> run_n;
+  Qty total_qty;
+  int64_t total_notional;
+};
+
+/** A ladder policy wrapped so that its DepthIndex follows every level
+    inserted or erased, the book only has to report qty changes at
+    existing slots through addQty */
+template <class Ladder, typename Price, typename Qty, class Better>
+class IndexedLadder : public Ladder {
+public:
+  using level_t = typename Ladder::level_t;
+  using price_t = Price;
+  using index_t = DepthIndex<Price, Qty, Better>;
+
+  void clear() {
+    Ladder::clear();
+    idx.clear();
+  }
+
+  void reserve( size_t n ) {
+    Ladder::reserve(n);
+    idx.reserve(n);
+  }
+
+  void insertAt( size_t i, const level_t& lvl ) {
+    Ladder::insertAt(i, lvl);
+    idx.insertSlot(i, lvl.l_price);
+  }
+
+  void eraseAt( size_t i ) {
+    Ladder::eraseAt(i);
+    idx.eraseSlot(i);
+  }
+
+  bool erase( price_t p ) {
+    size_t i = this->search(p);
+    if ( i > 0 && this->slot(i-1).l_price == p ) {
+      eraseAt(i-1);
+      return true;
+    }
+    return false;
+  }
+
+  void addQty( size_t i, Qty dq ) { idx.add(i, dq); }
+  const index_t& index() const { return idx; }
+
+private:
+  index_t idx;
+};
+
+#endif
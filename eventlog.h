@@ -0,0 +1,475 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "output.h"
+
+using std::string;
+using std::vector;
+
+/** Compact binary log of the engine's output for audit
+
+    the acks, rejects, trades and TOB changes that go to cout, each
+    stamped with the wall clock in ns, at a fraction of the text's size.
+    a file is
+
+      header   MAGIC, 8 bytes
+      blocks   BlockHeader then bytes of events
+      index    one IndexEntry per block
+      footer   index offset, block count, MAGIC
+
+    every block decodes on its own: the symbol table and all the delta
+    state below start over at each one, so the index's time ranges let
+    a reader pull out any span of the day without touching the rest of
+    the file.  a file whose writer died has no index or footer, the
+    reader then walks the block headers instead and drops a torn last
+    block.  integers are in host byte order.
+
+    inside a block an event is a tag byte, its type in the low bits,
+    followed by varints.  signed values are zigzagged so small negative
+    deltas stay one byte.  timestamps, order ids and prices are deltas
+    against the previous event of the same type in the block:
+
+      ack      ts user oid
+      reject   ts user oid reason
+      trade    ts symbol buy_user buy_oid sell_user sell_oid price qty
+      tob      ts symbol [ price qty ]   nothing for an empty side
+      symbol   len bytes                 defines the block's next symbol id
+
+    Writer buffers a block in memory and writes it whole once it passes
+    BLOCK_BYTES.  that write is made on the thread recording the events,
+    the matcher in the engine, so matching blocks for one file write at
+    each block boundary and never otherwise.  Reader hands back OutputRecords, the same as the output
+    ring's, with their timestamps.
+*/
+namespace EventLog {
+
+const uint64_t MAGIC = 0x31676f6c76656f62ULL; // "boevlog1"
+const size_t BLOCK_BYTES = 64 * 1024;
+
+enum Tag {
+  eACK = 0,
+  eREJECT = 1,
+  eTRADE = 2,
+  eTOB = 3,
+  eSYMBOL = 4,
+  eTYPE_MASK = 7,
+  eSELL = 8,        // tob: the offer side
+  eEMPTY = 16       // tob: the side is empty, no price or qty follow
+};
+
+struct BlockHeader {
+  uint64_t magic;
+  uint32_t bytes;   // of events after this header
+  uint32_t events;
+  uint64_t first_ts; // earliest and latest stamp in the block
+  uint64_t last_ts;
+};
+
+struct IndexEntry {
+  uint64_t offset;  // of the BlockHeader
+  uint64_t first_ts;
+  uint64_t last_ts;
+  uint32_t events;
+  uint32_t bytes;
+};
+
+struct Footer {
+  uint64_t index_offset;
+  uint64_t blocks;
+  uint64_t magic;
+};
+
+/** wall clock ns, what the engine stamps events with */
+inline uint64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+inline uint64_t zigzag( int64_t v ) {
+  return ( uint64_t(v) << 1 ) ^ uint64_t( v >> 63 );
+}
+
+inline int64_t unzigzag( uint64_t v ) {
+  return int64_t( v >> 1 ) ^ -int64_t( v & 1 );
+}
+
+inline void putVarint( vector<char>& buf, uint64_t v ) {
+  while ( v >= 0x80 ) {
+    buf.push_back( char( v | 0x80 ) );
+    v >>= 7;
+  }
+  buf.push_back( char(v) );
+}
+
+/** false if p runs into end first */
+inline bool getVarint( const char *&p, const char *end, uint64_t& v ) {
+  v = 0;
+  for ( int shift = 0; p < end && shift < 64; shift += 7 ) {
+    uint8_t b = uint8_t(*p++);
+    v |= uint64_t( b & 0x7f ) << shift;
+    if ( b < 0x80 ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** what deltas are taken against, the same on both sides */
+struct DeltaState {
+  uint64_t ts[4];
+  int64_t ack_oid;
+  int64_t reject_oid;
+  int64_t buy_oid;
+  int64_t sell_oid;
+  int64_t trade_price;
+  int64_t tob_price;
+
+  DeltaState() { reset(); }
+  void reset() { memset( this, 0, sizeof(*this) ); }
+
+  /** the delta from last to v, last becomes v */
+  static int64_t step( int64_t& last, int64_t v ) {
+    int64_t d = v - last;
+    last = v;
+    return d;
+  }
+};
+
+class Writer {
+public:
+  Writer() : events(0), first_ts(0), last_ts(0), total_events(0) { block.reserve( BLOCK_BYTES + 256 ); }
+  ~Writer() { close(); }
+
+  /** false if path couldn't be created, an old file is replaced */
+  bool open( const string& path );
+  bool isOpen() const { return out.is_open(); }
+  /** the last block, the index and the footer, after which the file is complete */
+  void close();
+
+  void ack( uint64_t ts, int user, int oid );
+  void reject( uint64_t ts, int user, int oid, int reason );
+  void trade( uint64_t ts, const string& symbol, int buy_user, int buy_oid,
+              int sell_user, int sell_oid, int price, int64_t qty );
+  /** price or qty 0 is an empty side, as the text prints it */
+  void tob( uint64_t ts, const string& symbol, char side, int price, int64_t qty );
+
+  uint64_t getEvents() const { return total_events; }
+
+private:
+  void begin( uint8_t tag, int type, uint64_t ts );
+  void end();
+  uint32_t defineSymbol( const string& symbol );
+  void flushBlock();
+
+  std::ofstream out;
+  vector<char> block;
+  vector<IndexEntry> index;
+  std::unordered_map<string, uint32_t> symbols;
+  DeltaState last;
+  uint32_t events;
+  uint64_t first_ts;
+  uint64_t last_ts;
+  uint64_t total_events;
+};
+
+class Reader {
+public:
+  /** false if path isn't an event log */
+  bool open( const string& path );
+
+  const vector<IndexEntry>& getIndex() const { return index; }
+  /** true if the writer never finished the file */
+  bool isTruncated() const { return truncated; }
+
+  /** every event stamped from..to inclusive, in the order written, as
+      sink(uint64_t ts, const OutputRecord&).  only the blocks whose
+      range overlaps are read.  false if a block is corrupt */
+  template <class Sink>
+  bool decode( uint64_t from, uint64_t to, Sink& sink );
+
+private:
+  bool scanBlocks( uint64_t from );
+  template <class Sink>
+  bool decodeBlock( const char *p, const char *end, uint64_t from, uint64_t to, Sink& sink );
+
+  std::ifstream in;
+  vector<IndexEntry> index;
+  vector<char> block;
+  bool truncated = false;
+};
+
+inline bool Writer::open( const string& path ) {
+  close();
+  out.open( path, std::ios::binary | std::ios::trunc );
+  if ( !out ) {
+    std::cerr << "Couldn't create the event log " << path << std::endl;
+    return false;
+  }
+  out.write( reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC) );
+  return true;
+}
+
+inline void Writer::close() {
+  if ( !out.is_open() ) {
+    return;
+  }
+  flushBlock();
+  Footer f;
+  f.index_offset = uint64_t( out.tellp() );
+  f.blocks = index.size();
+  f.magic = MAGIC;
+  out.write( reinterpret_cast<const char*>(index.data()), std::streamsize( index.size() * sizeof(IndexEntry) ) );
+  out.write( reinterpret_cast<const char*>(&f), sizeof(f) );
+  out.close();
+  index.clear();
+}
+
+inline void Writer::begin( uint8_t tag, int type, uint64_t ts ) {
+  block.push_back( char(tag) );
+  putVarint( block, zigzag( int64_t( ts - last.ts[type] ) ) );
+  last.ts[type] = ts;
+  if ( events == 0 || ts < first_ts ) {
+    first_ts = ts;
+  }
+  if ( events == 0 || ts > last_ts ) {
+    last_ts = ts;
+  }
+}
+
+inline void Writer::end() {
+  ++events;
+  ++total_events;
+  if ( block.size() >= BLOCK_BYTES ) {
+    flushBlock();
+  }
+}
+
+/** the symbol's id in this block, a new one is defined ahead of the
+    event that first uses it */
+inline uint32_t Writer::defineSymbol( const string& symbol ) {
+  auto it = symbols.find(symbol);
+  if ( it != symbols.end() ) {
+    return it->second;
+  }
+  uint32_t id = uint32_t( symbols.size() );
+  symbols.emplace( symbol, id );
+  block.push_back( char(eSYMBOL) );
+  putVarint( block, symbol.size() );
+  block.insert( block.end(), symbol.begin(), symbol.end() );
+  return id;
+}
+
+inline void Writer::flushBlock() {
+  if ( events == 0 ) {
+    return;
+  }
+  BlockHeader h;
+  h.magic = MAGIC;
+  h.bytes = uint32_t( block.size() );
+  h.events = events;
+  h.first_ts = first_ts;
+  h.last_ts = last_ts;
+  index.push_back( IndexEntry{ uint64_t( out.tellp() ), first_ts, last_ts, events, h.bytes } );
+  out.write( reinterpret_cast<const char*>(&h), sizeof(h) );
+  out.write( block.data(), std::streamsize( block.size() ) );
+  block.clear();
+  symbols.clear();
+  last.reset();
+  events = 0;
+}
+
+inline void Writer::ack( uint64_t ts, int user, int oid ) {
+  if ( !out.is_open() ) {
+    return;
+  }
+  begin( eACK, eACK, ts );
+  putVarint( block, zigzag(user) );
+  putVarint( block, zigzag( DeltaState::step(last.ack_oid, oid) ) );
+  end();
+}
+
+inline void Writer::reject( uint64_t ts, int user, int oid, int reason ) {
+  if ( !out.is_open() ) {
+    return;
+  }
+  begin( eREJECT, eREJECT, ts );
+  putVarint( block, zigzag(user) );
+  putVarint( block, zigzag( DeltaState::step(last.reject_oid, oid) ) );
+  putVarint( block, uint64_t(reason) );
+  end();
+}
+
+inline void Writer::trade( uint64_t ts, const string& symbol, int buy_user, int buy_oid,
+                           int sell_user, int sell_oid, int price, int64_t qty ) {
+  if ( !out.is_open() ) {
+    return;
+  }
+  uint32_t sym = defineSymbol(symbol);
+  begin( eTRADE, eTRADE, ts );
+  putVarint( block, sym );
+  putVarint( block, zigzag(buy_user) );
+  putVarint( block, zigzag( DeltaState::step(last.buy_oid, buy_oid) ) );
+  putVarint( block, zigzag(sell_user) );
+  putVarint( block, zigzag( DeltaState::step(last.sell_oid, sell_oid) ) );
+  putVarint( block, zigzag( DeltaState::step(last.trade_price, price) ) );
+  putVarint( block, zigzag(qty) );
+  end();
+}
+
+inline void Writer::tob( uint64_t ts, const string& symbol, char side, int price, int64_t qty ) {
+  if ( !out.is_open() ) {
+    return;
+  }
+  uint32_t sym = defineSymbol(symbol);
+  bool empty = price == 0 || qty == 0;
+  begin( uint8_t( eTOB | ( side == 'S' ? eSELL : 0 ) | ( empty ? eEMPTY : 0 ) ), eTOB, ts );
+  putVarint( block, sym );
+  if ( !empty ) {
+    putVarint( block, zigzag( DeltaState::step(last.tob_price, price) ) );
+    putVarint( block, zigzag(qty) );
+  }
+  end();
+}
+
+inline bool Reader::open( const string& path ) {
+  in.close();
+  in.clear();
+  index.clear();
+  truncated = false;
+  in.open( path, std::ios::binary );
+  uint64_t magic = 0;
+  if ( !in || !in.read( reinterpret_cast<char*>(&magic), sizeof(magic) ) || magic != MAGIC ) {
+    std::cerr << path << " isn't an event log" << std::endl;
+    return false;
+  }
+  in.seekg( 0, std::ios::end );
+  uint64_t size = uint64_t( in.tellg() );
+  Footer f;
+  if ( size >= sizeof(MAGIC) + sizeof(f) ) {
+    in.seekg( std::streamoff( size - sizeof(f) ) );
+    in.read( reinterpret_cast<char*>(&f), sizeof(f) );
+    if ( in && f.magic == MAGIC && f.index_offset + f.blocks * sizeof(IndexEntry) + sizeof(f) == size ) {
+      index.resize( f.blocks );
+      in.seekg( std::streamoff(f.index_offset) );
+      in.read( reinterpret_cast<char*>(index.data()), std::streamsize( f.blocks * sizeof(IndexEntry) ) );
+      if ( in ) {
+        return true;
+      }
+      index.clear();
+    }
+  }
+  in.clear();
+  truncated = true;
+  return scanBlocks( sizeof(MAGIC) );
+}
+
+/** rebuild the index from the block headers, up to the first one that
+    isn't whole */
+inline bool Reader::scanBlocks( uint64_t from ) {
+  in.seekg( 0, std::ios::end );
+  uint64_t size = uint64_t( in.tellg() );
+  BlockHeader h;
+  for ( uint64_t at = from; at + sizeof(h) <= size; at += sizeof(h) + h.bytes ) {
+    in.seekg( std::streamoff(at) );
+    if ( !in.read( reinterpret_cast<char*>(&h), sizeof(h) ) || h.magic != MAGIC
+         || at + sizeof(h) + h.bytes > size ) {
+      break;
+    }
+    index.push_back( IndexEntry{ at, h.first_ts, h.last_ts, h.events, h.bytes } );
+  }
+  in.clear();
+  return true;
+}
+
+template <class Sink>
+inline bool Reader::decode( uint64_t from, uint64_t to, Sink& sink ) {
+  for ( const IndexEntry& e : index ) {
+    if ( e.last_ts < from || e.first_ts > to ) {
+      continue;
+    }
+    block.resize( e.bytes );
+    in.seekg( std::streamoff( e.offset + sizeof(BlockHeader) ) );
+    if ( !in.read( block.data(), e.bytes ) || !decodeBlock( block.data(), block.data() + e.bytes, from, to, sink ) ) {
+      in.clear();
+      std::cerr << "Corrupt event log block at " << e.offset << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+template <class Sink>
+inline bool Reader::decodeBlock( const char *p, const char *end, uint64_t from, uint64_t to, Sink& sink ) {
+  DeltaState last;
+  vector<string> symbols;
+  uint64_t v[8];
+  auto get = [&]( int n ) {
+    for ( int i = 0; i < n; ++i ) {
+      if ( !getVarint( p, end, v[i] ) ) {
+        return false;
+      }
+    }
+    return true;
+  };
+  auto symbol = [&]( uint64_t id ) -> const string* {
+    return id < symbols.size() ? &symbols[id] : NULL;
+  };
+  while ( p < end ) {
+    uint8_t tag = uint8_t(*p++);
+    int type = tag & eTYPE_MASK;
+    if ( type == eSYMBOL ) {
+      if ( !get(1) || v[0] > uint64_t( end - p ) ) {
+        return false;
+      }
+      symbols.emplace_back( p, size_t(v[0]) );
+      p += v[0];
+      continue;
+    }
+    if ( type > eTOB || !get(1) ) {
+      return false;
+    }
+    uint64_t ts = last.ts[type] += uint64_t( unzigzag(v[0]) );
+    OutputRecord r;
+    const string *sym;
+    switch ( type ) {
+      case eACK:
+        if ( !get(2) ) return false;
+        r = OutputRecord::ack( int( unzigzag(v[0]) ), int( last.ack_oid += unzigzag(v[1]) ) );
+        break;
+      case eREJECT:
+        if ( !get(3) ) return false;
+        r = OutputRecord::reject( int( unzigzag(v[0]) ), int( last.reject_oid += unzigzag(v[1]) ), int(v[2]) );
+        break;
+      case eTRADE:
+        if ( !get(7) || ( sym = symbol(v[0]) ) == NULL ) return false;
+        r = OutputRecord::trade( *sym, int( unzigzag(v[1]) ), int( last.buy_oid += unzigzag(v[2]) ),
+                                 int( unzigzag(v[3]) ), int( last.sell_oid += unzigzag(v[4]) ),
+                                 int( last.trade_price += unzigzag(v[5]) ), int( unzigzag(v[6]) ) );
+        break;
+      default:
+        if ( !get( tag & eEMPTY ? 1 : 3 ) || ( sym = symbol(v[0]) ) == NULL ) return false;
+        r = OutputRecord::tob( *sym, tag & eSELL ? 'S' : 'B',
+                               tag & eEMPTY ? 0 : int( last.tob_price += unzigzag(v[1]) ),
+                               tag & eEMPTY ? 0 : unzigzag(v[2]) );
+        break;
+    }
+    if ( ts >= from && ts <= to ) {
+      sink( ts, r );
+    }
+  }
+  return true;
+}
+
+}
+
+#endif
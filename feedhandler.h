@@ -0,0 +1,243 @@
+#ifndef FEEDHANDLER_H
+#define FEEDHANDLER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+#include "itch.h"
+#include "ordermanager.h"
+#include "orderbook.h"
+#include "orderindex.h"
+#include "pool.h"
+#include "stats.h"
+
+/** Rebuilds books from an exchange's market by order feed
+
+    the other front end to the same books OrderManager drives.  the
+    exchange has already done the matching, so every event is applied
+    to the book as is: adds rest even if they cross, executions and
+    cancels take qty off the named order in place, deletes pull it and
+    a replace pulls it and rests the new order at the back of its new
+    price.  nothing is acked, traded or published, the books are built
+    with publishing off and are read through their getters.
+
+    orders are keyed by the feed's order reference number in the same
+    open addressing index and pool the manager uses, and the book for
+    an add is found through the feed's stock locate code in a flat
+    table before ever touching the symbol map, so the per event cost
+    is an index probe plus the level update.
+
+    events for a reference we don't have ( joining a feed mid session,
+    a gap ) are counted in bad_refs and otherwise ignored, a feed
+    handler can't reject anything back to the exchange.
+
+    Decoder in itch.h feeds it through the on*() callbacks.
+*/
+class FeedHandler {
+public:
+  /** mem places the order pool and every book's levels, see placement.h */
+  explicit FeedHandler(const MemConfig& mem=MemConfig());
+  ~FeedHandler();
+
+  void addOrder(uint64_t ref, OrderBook *book, bool buy, int price, int qty);
+  void addOrder(uint64_t ref, const string& symbol, bool buy, int price, int qty);
+  /** qty of the order traded */
+  void executeOrder(uint64_t ref, int qty);
+  /** qty of the order cancelled, what's left keeps its priority */
+  void cancelOrder(uint64_t ref, int qty);
+  void deleteOrder(uint64_t ref);
+  /** ref is pulled and new_ref rests on the same side at price for qty */
+  void replaceOrder(uint64_t ref, uint64_t new_ref, int price, int qty);
+  /** O(books): drop every order in bulk, eg before a snapshot recovery */
+  void flushOrders();
+
+  // Itch::Decoder sink
+  void onAdd(const Itch::Add& m);
+  void onExecuted(const Itch::Executed& m) { executeOrder( m.ref, int(m.shares) ); }
+  void onCancel(const Itch::Cancel& m) { cancelOrder( m.ref, int(m.shares) ); }
+  void onDelete(const Itch::Delete& m) { deleteOrder( m.ref ); }
+  void onReplace(const Itch::Replace& m) { replaceOrder( m.ref, m.new_ref, int(m.price), int(m.shares) ); }
+
+  /** per symbol book sizing as for OrderManager, set before the symbol's first add */
+  void configureBook(const string& symbol, const BookConfig& config);
+  void setDefaultBookConfig(const BookConfig& config);
+  OrderBook* getBook(const string& symbol);
+  const unordered_map<string, OrderBook*>& getBooks() const { return book_map; }
+
+  size_t getNumOrders() const { return orders_by_ref.size(); }
+  const FeedStats& getStats() const { return stats; }
+
+private:
+  OrderBook* bookFor(const string& symbol);
+  void releaseOrder(uint64_t ref, Order *o);
+
+  unordered_map<string, OrderBook*> book_map;
+  // stock locate -> book, NULL until the locate's first add
+  vector<OrderBook*> books_by_locate;
+  OrderIndex orders_by_ref;
+  pool<Order, order_id_t> order_pool;
+
+  unordered_map<string, BookConfig> book_configs;
+  BookConfig default_config;
+  MemConfig mem;
+
+  FeedStats stats;
+};
+
+inline FeedHandler::FeedHandler(const MemConfig& mem)
+  : order_pool(4096, decltype(order_pool)::UNLIMITED, 0, mem)
+  , mem(mem)
+{
+}
+
+inline FeedHandler::~FeedHandler() {
+  for ( auto it : book_map ) {
+    delete it.second;
+  }
+  book_map.clear();
+}
+
+inline void FeedHandler::configureBook(const string& symbol, const BookConfig& config) {
+  book_configs[symbol] = config;
+}
+
+inline void FeedHandler::setDefaultBookConfig(const BookConfig& config) {
+  default_config = config;
+}
+
+inline OrderBook* FeedHandler::getBook(const string& symbol) {
+  auto it = book_map.find(symbol);
+  return it != book_map.end() ? it->second : NULL;
+}
+
+inline OrderBook* FeedHandler::bookFor(const string& symbol) {
+  auto it = book_map.find(symbol);
+  if ( it != book_map.end() ) {
+    return it->second;
+  }
+  auto cfg = book_configs.find(symbol);
+  OrderBook *b = newOrderBook( symbol, NULL, cfg != book_configs.end() ? cfg->second : default_config, mem );
+  b->setPublishing(false);
+  book_map[symbol] = b;
+  stats.books.set( book_map.size() );
+  return b;
+}
+
+inline void FeedHandler::onAdd(const Itch::Add& m) {
+  if ( m.locate >= books_by_locate.size() ) {
+    books_by_locate.resize( m.locate + 1, NULL );
+  }
+  OrderBook *&b = books_by_locate[m.locate];
+  if ( b == NULL ) {
+    b = bookFor( Itch::stockName(m.stock) );
+  }
+  addOrder( m.ref, b, m.buy, int(m.price), int(m.shares) );
+}
+
+inline void FeedHandler::addOrder(uint64_t ref, const string& symbol, bool buy, int price, int qty) {
+  addOrder( ref, bookFor(symbol), buy, price, qty );
+}
+
+inline void FeedHandler::addOrder(uint64_t ref, OrderBook *book, bool buy, int price, int qty) {
+  if ( orders_by_ref.find(ref) ) {
+    stats.bad_refs.add();
+    return;
+  }
+  order_id_t h = order_pool.alloc();
+  Order *o = order_pool.get(h);
+  o->setUserOrderId( int(ref) );
+  o->setUser(0);
+  o->setPrice(price);
+  o->setQty(qty);
+  o->setMinQty(0);
+  o->setIsBuy(buy);
+  o->setBook(book);
+  o->setHandle(h);
+  orders_by_ref.insert(ref, o);
+  book->restOrder(o);
+  stats.adds.add();
+  stats.live_orders.add();
+}
+
+inline void FeedHandler::executeOrder(uint64_t ref, int qty) {
+  Order *o = orders_by_ref.find(ref);
+  if ( o == NULL ) {
+    stats.bad_refs.add();
+    return;
+  }
+  stats.executions.add();
+  if ( o->getBook()->fillOrder(o, qty) ) {
+    releaseOrder(ref, o);
+  }
+}
+
+inline void FeedHandler::cancelOrder(uint64_t ref, int qty) {
+  Order *o = orders_by_ref.find(ref);
+  if ( o == NULL ) {
+    stats.bad_refs.add();
+    return;
+  }
+  stats.cancels.add();
+  if ( qty < o->getQty() ) {
+    o->getBook()->reduceOrder(o, qty);
+  } else {
+    o->getBook()->cancelOrder(o);
+    releaseOrder(ref, o);
+  }
+}
+
+inline void FeedHandler::deleteOrder(uint64_t ref) {
+  Order *o = orders_by_ref.find(ref);
+  if ( o == NULL ) {
+    stats.bad_refs.add();
+    return;
+  }
+  stats.deletes.add();
+  o->getBook()->cancelOrder(o);
+  releaseOrder(ref, o);
+}
+
+/** the pooled Order is reused for the new reference */
+inline void FeedHandler::replaceOrder(uint64_t ref, uint64_t new_ref, int price, int qty) {
+  Order *o = orders_by_ref.find(ref);
+  if ( o == NULL || ( new_ref != ref && orders_by_ref.find(new_ref) ) ) {
+    stats.bad_refs.add();
+    return;
+  }
+  stats.replaces.add();
+  OrderBook *b = o->getBook();
+  b->cancelOrder(o);
+  orders_by_ref.erase(ref);
+  if ( qty <= 0 ) {
+    order_pool.free( o->getHandle() );
+    stats.live_orders.sub();
+    return;
+  }
+  o->setUserOrderId( int(new_ref) );
+  o->setPrice(price);
+  o->setQty(qty);
+  orders_by_ref.insert(new_ref, o);
+  b->restOrder(o);
+}
+
+inline void FeedHandler::releaseOrder(uint64_t ref, Order *o) {
+  orders_by_ref.erase(ref);
+  order_pool.free( o->getHandle() );
+  stats.live_orders.sub();
+}
+
+inline void FeedHandler::flushOrders() {
+  for ( auto it : book_map ) {
+    (it.second)->flushOrders();
+  }
+  orders_by_ref.clear();
+  order_pool.clear();
+  stats.live_orders.set(0);
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cwfq.h"
+#include "order.h"
+#include "shm.h"
+
+using std::string;
+using std::vector;
+
+/** Shared memory order entry for co-located clients
+
+    the engine creates one segment per client, prefix.0 .. prefix.n-1,
+    each holding a ClientChannel: a RingFifo of fixed size binary
+    OrderRecords the client pushes into and the engine's ingress thread
+    pops from.  one producer and one consumer per ring so neither side
+    ever takes a lock or makes a syscall, an order costs a cache line
+    handoff instead of a socket read and a text parse.
+
+    the engine decides who a client is.  channel i's user is fixed by
+    the engine when it creates the channel and kept in the engine's own
+    memory, the segment holds nothing but the ring, so nothing a client
+    writes can make its records count as someone else's.  nor can it
+    make the engine read outside its ring: the engine keeps its own
+    read index ( RingFifo::popUntrusted ) and a channel whose write
+    index isn't one is closed for good.  flushes and auction control
+    aren't accepted from clients at all.
+
+    the ingress side polls the channels round robin taking at most
+    BURST records from each in a pass, so one client streaming orders
+    can't starve the others.  a client whose ring is full just sees
+    its push fail and retries, nothing blocks the engine.  a record
+    that isn't accepted is counted and handed on as an eINVALID order
+    for the client's user and the record's order id, which the manager
+    rejects as malformed ( see reject.h ), never written anywhere by
+    the ingress thread.
+
+    acks, trades and TOB come back the way everyone else gets them,
+    on the output ring ( see output.h ).
+*/
+
+/** one order entry message, the OrderParser formats in binary */
+struct OrderRecord {
+  static const size_t SYMBOL_LEN = 16;
+
+  char type;        // N C D R X as in orderparser.h
+  char side;        // 'B' or 'S'
+  char symbol[SYMBOL_LEN]; // NUL padded, new orders and optionally mass cancels
+  int32_t uoid;
+  int32_t price;    // 0 for a market order
+  int32_t qty;      // new qty for a reduce or replace
+  int32_t min_qty;
+  int32_t stop_price; // 0 unless a stop or stop-limit
+  uint64_t sent;    // the client's own, never looked at by the engine
+
+  static OrderRecord newOrder( const string& symbol, bool buy, int price, int qty, int uoid, int min_qty=0,
+                               int stop_price=0 ) {
+    OrderRecord r = make('N', symbol);
+    r.side = buy ? 'B' : 'S';
+    r.uoid = uoid;
+    r.price = price;
+    r.qty = qty;
+    r.min_qty = min_qty;
+    r.stop_price = stop_price;
+    return r;
+  }
+  static OrderRecord cancel( int uoid ) {
+    OrderRecord r = make('C', "");
+    r.uoid = uoid;
+    return r;
+  }
+  static OrderRecord reduce( int uoid, int qty ) {
+    OrderRecord r = make('D', "");
+    r.uoid = uoid;
+    r.qty = qty;
+    return r;
+  }
+  static OrderRecord replace( int uoid, int price, int qty ) {
+    OrderRecord r = make('R', "");
+    r.uoid = uoid;
+    r.price = price;
+    r.qty = qty;
+    return r;
+  }
+  static OrderRecord massCancel( const string& symbol="" ) {
+    return make('X', symbol);
+  }
+
+private:
+  static OrderRecord make( char type, const string& symbol ) {
+    OrderRecord r;
+    memset( &r, 0, sizeof(r) );
+    r.type = type;
+    memcpy( r.symbol, symbol.data(), symbol.size() < SYMBOL_LEN ? symbol.size() : SYMBOL_LEN );
+    return r;
+  }
+};
+
+/** what a client segment holds, only ever the ring */
+struct ClientChannel {
+  using ring_t = CWFQ::RingFifo<OrderRecord, 1023>;
+
+  ring_t ring;
+};
+
+/** the engine's side, owns and unlinks the segments */
+class Gateway {
+public:
+  static const int BURST = 8;
+
+  /** client i enters orders as user first_user + i */
+  Gateway( const string& prefix, int clients, int first_user=0 );
+  ~Gateway();
+
+  /** false if any segment couldn't be created */
+  bool isOpen() const { return !channels.empty(); }
+  static string channelName( const string& prefix, int client ) { return prefix + "." + std::to_string(client); }
+  /** the user client's orders are entered as, tell the client out of band */
+  int getUser( int client ) const { return users[client]; }
+
+  /** one fair pass over every client, each record is handed to
+      sink(Order&) in the order its client sent it, one that isn't
+      accepted as an eINVALID order.  returns the records taken */
+  template <class Sink>
+  size_t poll( Sink& sink );
+
+  uint64_t getAccepted() const { return accepted; }
+  uint64_t getRefused() const { return refused; }
+  /** channels closed for a corrupt ring */
+  size_t getClosed() const { return std::count( closed.begin(), closed.end(), true ); }
+
+  /** the Order a record from user stands for, false if there isn't one */
+  static bool toOrder( const OrderRecord& r, int user, Order& o );
+
+private:
+  string prefix;
+  vector<ClientChannel*> channels;
+  vector<int32_t> users;  // channels[i]'s, never in shared memory
+  vector<size_t> heads;   // channels[i]'s read index, ditto
+  vector<bool> closed;
+  size_t next;      // where the next pass starts
+  uint64_t accepted;
+  uint64_t refused;
+};
+
+/** the client's side, one per client process */
+class GatewayClient {
+public:
+  GatewayClient() : chan(NULL) {}
+  ~GatewayClient() { Shm::unmap(chan); }
+
+  bool open( const string& prefix, int client ) {
+    Shm::unmap(chan);
+    chan = Shm::open<ClientChannel>( Gateway::channelName(prefix, client), true );
+    return chan != NULL;
+  }
+
+  /** false if the ring is full, the record wasn't sent */
+  bool send( const OrderRecord& r ) { return chan->ring.push(r); }
+
+private:
+  ClientChannel *chan;
+};
+
+inline Gateway::Gateway( const string& prefix, int clients, int first_user )
+  : prefix(prefix)
+  , next(0)
+  , accepted(0)
+  , refused(0)
+{
+  for ( int i = 0; i < clients; ++i ) {
+    ClientChannel *c = Shm::create<ClientChannel>( channelName(prefix, i) );
+    if ( c == NULL ) {
+      std::cerr << "Couldn't create gateway channel " << channelName(prefix, i) << std::endl;
+      for ( size_t j = 0; j < channels.size(); ++j ) {
+        Shm::unmap(channels[j]);
+        Shm::unlink( channelName(prefix, int(j)) );
+      }
+      channels.clear();
+      users.clear();
+      heads.clear();
+      closed.clear();
+      return;
+    }
+    channels.push_back(c);
+    users.push_back( int32_t(first_user + i) );
+    heads.push_back(0);
+    closed.push_back(false);
+  }
+}
+
+inline Gateway::~Gateway() {
+  for ( size_t i = 0; i < channels.size(); ++i ) {
+    Shm::unmap(channels[i]);
+    Shm::unlink( channelName(prefix, int(i)) );
+  }
+}
+
+template <class Sink>
+inline size_t Gateway::poll( Sink& sink ) {
+  size_t taken = 0;
+  size_t n = channels.size();
+  for ( size_t k = 0; k < n; ++k ) {
+    size_t i = (next + k) % n;
+    if ( closed[i] ) {
+      continue;
+    }
+    ClientChannel *c = channels[i];
+    int user = users[i];
+    OrderRecord r;
+    Order o;
+    bool corrupt = false;
+    for ( int b = 0; b < BURST && c->ring.popUntrusted(heads[i], r, corrupt); ++b ) {
+      ++taken;
+      if ( toOrder(r, user, o) ) {
+        ++accepted;
+      } else {
+        ++refused;
+        o = Order( Order::eINVALID, r.uoid, user );
+      }
+      sink(o);
+    }
+    if ( corrupt ) {
+      closed[i] = true;
+      std::cerr << "Closed gateway channel " << channelName(prefix, int(i)) << ", its ring is corrupt" << std::endl;
+    }
+  }
+  if ( n ) {
+    next = ( next + 1 ) % n;
+  }
+  return taken;
+}
+
+inline bool Gateway::toOrder( const OrderRecord& r, int user, Order& o ) {
+  Order::OrderType ot = Order::GetOrderType(r.type);
+  if ( ot == Order::eINVALID || ot == Order::eFLUSH || ot == Order::eAUCTION || ot == Order::eUNCROSS ) {
+    return false;
+  }
+  string symbol( r.symbol, strnlen(r.symbol, OrderRecord::SYMBOL_LEN) );
+  if ( ot == Order::eNEW && ( symbol.empty() || r.qty <= 0 || r.price < 0 || r.stop_price < 0 ) ) {
+    return false;
+  }
+  o = Order( ot, r.uoid, user, r.price, r.qty, r.side == 'B', symbol );
+  o.setMinQty( ot == Order::eNEW ? r.min_qty : 0 );
+  o.setStopPrice( ot == Order::eNEW ? r.stop_price : 0 );
+  return true;
+}
+
+#endif
@@ -0,0 +1,617 @@
+/* Synthetic order flow generator
+
+   writes a stream of order entry lines in the OrderParser csv format
+   shaped like real exchange flow, so benchmarks and capacity planning
+   don't have to run on the hand written scenario files.
+
+   usage: ./gen [--option value ...] > flow.csv
+
+   with --format itch it writes what an exchange running that flow
+   would publish instead, the market by order feed of itch.h, for the
+   FeedHandler and ./replay.  only resting orders appear on a feed so
+   aggressors show up as executions against what they hit, and the
+   feed has no flush so one is written as a delete per live order.
+
+   the same seed and options always produce the same bytes with the
+   same libm: every distribution is built directly on mt19937_64 output
+   rather than on the implementation defined std:: distributions, but
+   the exponential gaps and the symbol skew go through std::log and
+   std::pow, which needn't round the same way everywhere.
+
+   the generator keeps a shadow book per symbol and runs every order it
+   writes through it, so cancels and amends only ever name orders that
+   are still resting and the flow stays clean of spurious rejects.
+*/
+
+//system headers
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "itch.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Options {
+  uint64_t seed = 1;
+  uint64_t count = 1000000;     // messages to write
+  int symbols = 8;
+  double skew = 1.0;            // zipf exponent over the symbols, 0 is uniform
+  int users = 64;
+
+  // message mix, relative weights
+  double w_new = 50;
+  double w_cancel = 35;
+  double w_reduce = 5;
+  double w_replace = 10;
+  double w_mass = 0.01;
+
+  // price shape, in ticks
+  int start_mid = 10000;
+  double drift = 0.05;          // chance per message the mid moves a tick
+  int inside_levels = 64;
+  double inside_pct = 90;       // of passive orders within inside_levels of the mid
+  double decay = 8;             // mean distance from the mid of inside orders
+  double far_pct = 1;           // of passive orders at absurd prices
+  double marketable_pct = 5;    // of new orders which cross the spread
+  double market_pct = 20;       // of marketable orders sent as market ( price 0 )
+  double fok_pct = 2;           // of marketable orders sent fill-or-kill
+
+  // sizes, in lots
+  int lot = 100;
+  double size_mean = 3;         // mean lots of a typical order
+  double block_pct = 1;         // of orders which are blocks of 10-100x
+  int live_target = 1000;       // resting orders per symbol the cancel rate is balanced at
+
+  // burst episodes
+  double burst_rate = 0.0005;   // chance per message a burst starts
+  int burst_len = 2000;
+  double burst_factor = 4;      // cancel, replace and marketable weights scale by this
+
+  uint64_t flush_every = 0;     // write an F every n messages, 0 never
+  bool itch = false;            // --format itch
+};
+
+/** reproducible randomness on top of the raw engine */
+class Rng {
+public:
+  explicit Rng( uint64_t seed ) : eng(seed) {}
+
+  /** [0, 1) */
+  double uniform() { return double( eng() >> 11 ) * ( 1.0 / 9007199254740992.0 ); }
+  /** [0, n) */
+  uint64_t below( uint64_t n ) { return uint64_t( uniform() * n ); }
+  bool chance( double pct ) { return uniform() * 100 < pct; }
+  double exponential( double mean ) { return -std::log( 1.0 - uniform() ) * mean; }
+
+  /** index drawn from a cumulative weight table */
+  size_t pick( const vector<double>& cdf ) {
+    double x = uniform() * cdf.back();
+    size_t lo = 0, hi = cdf.size() - 1;
+    while ( lo < hi ) {
+      size_t mid = ( lo + hi ) / 2;
+      if ( cdf[mid] > x ) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    return lo;
+  }
+
+private:
+  std::mt19937_64 eng;
+};
+
+struct Resting {
+  int user;
+  int uoid;
+  int price;
+  int qty;
+  bool buy;
+  size_t live_pos; // index into the symbol's live list
+  uint64_t ref;    // feed order reference
+};
+
+/** just enough of a book to know what is still resting */
+struct Shadow {
+  string name;
+  uint16_t locate;
+  int mid;
+  std::map<int, std::deque<size_t>, std::greater<int>> bids;
+  std::map<int, std::deque<size_t>> asks;
+  vector<size_t> live;
+};
+
+class Generator {
+public:
+  Generator( const Options& opt, std::ostream& out )
+    : opt(opt)
+    , out(out)
+    , rng(opt.seed)
+    , next_uoid(opt.users, 0)
+    , burst_left(0)
+    , clock(opt.seed ^ 0x9e3779b97f4a7c15ULL)
+    , feed(feed_buf)
+    , ts(34200000000000ULL) // 09:30
+    , next_ref(0)
+    , next_match(0)
+  {
+    double sum = 0;
+    for ( int s = 0; s < opt.symbols; ++s ) {
+      sum += 1.0 / std::pow( s + 1, opt.skew );
+      symbol_cdf.push_back(sum);
+      Shadow sh;
+      sh.name = "S" + std::to_string(s);
+      sh.locate = uint16_t(s + 1);
+      sh.mid = opt.start_mid;
+      books.push_back(sh);
+    }
+  }
+
+  void run() {
+    for ( uint64_t n = 0; n < opt.count; ++n ) {
+      if ( opt.flush_every && n && n % opt.flush_every == 0 ) {
+        tick();
+        flush();
+        continue;
+      }
+      if ( burst_left ) {
+        --burst_left;
+      } else if ( rng.uniform() < opt.burst_rate ) {
+        burst_left = opt.burst_len;
+      }
+      Shadow& sh = books[ rng.pick(symbol_cdf) ];
+      if ( rng.uniform() < opt.drift ) {
+        sh.mid += rng.chance(50) ? 1 : -1;
+        if ( sh.mid < opt.inside_levels * 2 ) {
+          sh.mid = opt.inside_levels * 2;
+        }
+      }
+      tick();
+      step(sh);
+      if ( feed_buf.size() > 65536 ) {
+        drain();
+      }
+    }
+    drain();
+  }
+
+private:
+  /** feed timestamps, on their own stream so the csv doesn't depend on them */
+  void tick() {
+    if ( opt.itch ) {
+      ts += 1 + uint64_t( clock.exponential(1000) );
+    }
+  }
+
+  void drain() {
+    out.write( feed_buf.data(), feed_buf.size() );
+    feed_buf.clear();
+  }
+
+  void step( Shadow& sh ) {
+    double burst = burst_left ? opt.burst_factor : 1;
+    // cancels scale with what is resting so each book settles around live_target
+    double crowd = double( sh.live.size() ) / opt.live_target;
+    bool resting = !sh.live.empty();
+    vector<double> cdf;
+    double sum = opt.w_new;
+    cdf.push_back(sum);
+    sum += resting ? opt.w_cancel * burst * crowd : 0;
+    cdf.push_back(sum);
+    sum += resting ? opt.w_reduce : 0;
+    cdf.push_back(sum);
+    sum += resting ? opt.w_replace * burst : 0;
+    cdf.push_back(sum);
+    sum += resting ? opt.w_mass : 0;
+    cdf.push_back(sum);
+
+    switch ( rng.pick(cdf) ) {
+      case 0: newOrder(sh, burst); break;
+      case 1: cancel(sh); break;
+      case 2: reduce(sh); break;
+      case 3: replace(sh); break;
+      case 4: massCancel(sh); break;
+    }
+  }
+
+  int lots() {
+    double mean = rng.chance(opt.block_pct) ? opt.size_mean * ( 10 + rng.below(91) ) : opt.size_mean;
+    return opt.lot * ( 1 + int( rng.exponential( mean - 1 > 0 ? mean - 1 : 0.01 ) ) );
+  }
+
+  /** a passive price for side buy around the mid */
+  int passivePrice( const Shadow& sh, bool buy ) {
+    int offset;
+    double r = rng.uniform() * 100;
+    if ( r < opt.far_pct ) {
+      // the $1 bid for 100 BTC kind of order that sits there all day
+      return buy ? 1 + int( rng.below( sh.mid / 100 + 1 ) ) : sh.mid * 100 + int( rng.below( sh.mid ) );
+    } else if ( r < opt.far_pct + opt.inside_pct ) {
+      offset = int( rng.exponential(opt.decay) ) % opt.inside_levels;
+    } else {
+      offset = opt.inside_levels + int( rng.below( opt.inside_levels * 3 ) );
+    }
+    // bids at mid - 1 and below, asks at mid and above, so a fresh book never crosses
+    int price = buy ? sh.mid - 1 - offset : sh.mid + offset;
+    return price > 0 ? price : 1;
+  }
+
+  void newOrder( Shadow& sh, double burst ) {
+    int user = int( rng.below(opt.users) );
+    int uoid = ++next_uoid[user];
+    bool buy = rng.chance(50);
+    int qty = lots();
+    int price;
+    int min_qty = 0;
+    if ( rng.chance( opt.marketable_pct * burst ) ) {
+      if ( rng.chance(opt.market_pct) ) {
+        price = 0;
+      } else {
+        // through the touch by a few ticks
+        int touch = buy ? ( sh.asks.empty() ? sh.mid : sh.asks.begin()->first )
+                        : ( sh.bids.empty() ? sh.mid - 1 : sh.bids.begin()->first );
+        int through = int( rng.below(4) );
+        price = buy ? touch + through : touch - through;
+        if ( price < 1 ) {
+          price = 1;
+        }
+      }
+      if ( rng.chance(opt.fok_pct) ) {
+        min_qty = qty;
+      }
+    } else {
+      price = passivePrice(sh, buy);
+    }
+
+    if ( !opt.itch ) {
+      out << "N," << user << "," << sh.name << "," << price << "," << qty << ","
+          << ( buy ? "B," : "S," ) << uoid;
+      if ( min_qty ) {
+        out << "," << min_qty;
+      }
+      out << "\n";
+    }
+
+    if ( min_qty && available(sh, buy, price) < min_qty ) {
+      return; // killed
+    }
+    qty = match(sh, buy, price, qty);
+    if ( qty > 0 && price != 0 ) {
+      rest( sh, Resting{user, uoid, price, qty, buy, 0, 0} );
+    }
+  }
+
+  template <class Side>
+  static int64_t availableOn( Side& side, const vector<Resting>& orders, bool buy, int price ) {
+    int64_t total = 0;
+    for ( auto& lvl : side ) {
+      if ( price != 0 && ( buy ? lvl.first > price : lvl.first < price ) ) {
+        break;
+      }
+      for ( size_t id : lvl.second ) {
+        total += orders[id].qty;
+      }
+    }
+    return total;
+  }
+
+  int64_t available( Shadow& sh, bool buy, int price ) {
+    return buy ? availableOn(sh.asks, orders, true, price) : availableOn(sh.bids, orders, false, price);
+  }
+
+  /** fill against the opposite side, returns the remainder */
+  template <class Side>
+  int matchOn( Shadow& sh, Side& side, bool buy, int price, int qty ) {
+    while ( qty > 0 && !side.empty() ) {
+      auto lvl = side.begin();
+      if ( price != 0 && ( buy ? lvl->first > price : lvl->first < price ) ) {
+        break;
+      }
+      while ( qty > 0 && !lvl->second.empty() ) {
+        Resting& r = orders[ lvl->second.front() ];
+        int take = r.qty < qty ? r.qty : qty;
+        if ( opt.itch ) {
+          feed.orderExecuted( sh.locate, ts, r.ref, take, ++next_match );
+        }
+        r.qty -= take;
+        qty -= take;
+        if ( r.qty == 0 ) {
+          size_t id = lvl->second.front();
+          lvl->second.pop_front();
+          unlive(sh, id);
+        }
+      }
+      if ( lvl->second.empty() ) {
+        side.erase(lvl);
+      }
+    }
+    return qty;
+  }
+
+  int match( Shadow& sh, bool buy, int price, int qty ) {
+    return buy ? matchOn(sh, sh.asks, true, price, qty) : matchOn(sh, sh.bids, false, price, qty);
+  }
+
+  /** announce false when the caller already wrote the order to the feed */
+  void rest( Shadow& sh, Resting r, bool announce=true ) {
+    if ( announce ) {
+      r.ref = ++next_ref;
+      if ( opt.itch ) {
+        feed.addOrder( sh.locate, ts, r.ref, r.buy, r.qty, sh.name, r.price );
+      }
+    }
+    size_t id;
+    if ( free_ids.empty() ) {
+      id = orders.size();
+      orders.push_back(r);
+    } else {
+      id = free_ids.back();
+      free_ids.pop_back();
+      orders[id] = r;
+    }
+    orders[id].live_pos = sh.live.size();
+    sh.live.push_back(id);
+    if ( r.buy ) {
+      sh.bids[r.price].push_back(id);
+    } else {
+      sh.asks[r.price].push_back(id);
+    }
+  }
+
+  /** drop id from the live list only, the caller handles the level */
+  void unlive( Shadow& sh, size_t id ) {
+    size_t pos = orders[id].live_pos;
+    sh.live[pos] = sh.live.back();
+    orders[ sh.live[pos] ].live_pos = pos;
+    sh.live.pop_back();
+    free_ids.push_back(id);
+  }
+
+  template <class Side>
+  static void unlevel( Side& side, int price, size_t id ) {
+    auto lvl = side.find(price);
+    auto& q = lvl->second;
+    for ( auto it = q.begin(); it != q.end(); ++it ) {
+      if ( *it == id ) {
+        q.erase(it);
+        break;
+      }
+    }
+    if ( q.empty() ) {
+      side.erase(lvl);
+    }
+  }
+
+  void remove( Shadow& sh, size_t id ) {
+    const Resting& r = orders[id];
+    if ( r.buy ) {
+      unlevel(sh.bids, r.price, id);
+    } else {
+      unlevel(sh.asks, r.price, id);
+    }
+    unlive(sh, id);
+  }
+
+  void cancel( Shadow& sh ) {
+    cancel( sh, sh.live[ rng.below( sh.live.size() ) ] );
+  }
+
+  void cancel( Shadow& sh, size_t id ) {
+    if ( opt.itch ) {
+      feed.orderDelete( sh.locate, ts, orders[id].ref );
+    } else {
+      out << "C," << orders[id].user << "," << orders[id].uoid << "\n";
+    }
+    remove(sh, id);
+  }
+
+  void reduce( Shadow& sh ) {
+    size_t id = sh.live[ rng.below( sh.live.size() ) ];
+    Resting& r = orders[id];
+    if ( r.qty <= opt.lot ) {
+      cancel(sh, id);
+      return;
+    }
+    int qty = opt.lot * ( 1 + int( rng.below( r.qty / opt.lot - 1 ) ) );
+    if ( opt.itch ) {
+      feed.orderCancel( sh.locate, ts, r.ref, r.qty - qty );
+    } else {
+      out << "D," << r.user << "," << r.uoid << "," << qty << "\n";
+    }
+    r.qty = qty;
+  }
+
+  void replace( Shadow& sh ) {
+    size_t id = sh.live[ rng.below( sh.live.size() ) ];
+    Resting r = orders[id];
+    r.price = passivePrice(sh, r.buy);
+    r.qty = lots();
+    if ( !opt.itch ) {
+      out << "R," << r.user << "," << r.uoid << "," << r.price << "," << r.qty << "\n";
+    }
+    if ( r.price == orders[id].price && r.qty < orders[id].qty ) {
+      // a qty down at the same price keeps its queue position
+      if ( opt.itch ) {
+        feed.orderCancel( sh.locate, ts, r.ref, orders[id].qty - r.qty );
+      }
+      orders[id].qty = r.qty;
+      return;
+    }
+    remove(sh, id);
+    if ( crosses(sh, r.buy, r.price) ) {
+      // the feed sees the old order go, the executions and then any remainder
+      if ( opt.itch ) {
+        feed.orderDelete( sh.locate, ts, r.ref );
+      }
+      r.qty = match(sh, r.buy, r.price, r.qty);
+      if ( r.qty > 0 ) {
+        rest(sh, r);
+      }
+    } else {
+      uint64_t old_ref = r.ref;
+      r.ref = ++next_ref;
+      if ( opt.itch ) {
+        feed.orderReplace( sh.locate, ts, old_ref, r.ref, r.qty, r.price );
+      }
+      rest(sh, r, false);
+    }
+  }
+
+  bool crosses( const Shadow& sh, bool buy, int price ) const {
+    return buy ? !sh.asks.empty() && sh.asks.begin()->first <= price
+               : !sh.bids.empty() && sh.bids.begin()->first >= price;
+  }
+
+  void massCancel( Shadow& sh ) {
+    int user = orders[ sh.live[ rng.below( sh.live.size() ) ] ].user;
+    if ( !opt.itch ) {
+      out << "X," << user << "," << sh.name << "\n";
+    }
+    for ( size_t i = sh.live.size(); i-- > 0; ) {
+      size_t id = sh.live[i];
+      if ( orders[id].user == user ) {
+        if ( opt.itch ) {
+          feed.orderDelete( sh.locate, ts, orders[id].ref );
+        }
+        remove(sh, id);
+      }
+    }
+  }
+
+  void flush() {
+    if ( !opt.itch ) {
+      out << "F\n";
+    }
+    for ( Shadow& sh : books ) {
+      if ( opt.itch ) {
+        for ( size_t id : sh.live ) {
+          feed.orderDelete( sh.locate, ts, orders[id].ref );
+        }
+      }
+      sh.bids.clear();
+      sh.asks.clear();
+      sh.live.clear();
+    }
+    orders.clear();
+    free_ids.clear();
+  }
+
+  const Options& opt;
+  std::ostream& out;
+  Rng rng;
+  vector<double> symbol_cdf;
+  vector<Shadow> books;
+  vector<Resting> orders;
+  vector<size_t> free_ids;
+  vector<int> next_uoid;
+  int burst_left;
+
+  Rng clock;
+  string feed_buf;
+  Itch::Writer feed;
+  uint64_t ts;
+  uint64_t next_ref;
+  uint64_t next_match;
+};
+
+void usage() {
+  std::cerr <<
+    "usage: gen [--option value ...] > flow.csv\n"
+    "  --format f          csv order entry or an itch market by order feed ( csv )\n"
+    "  --seed n            random seed ( 1 )\n"
+    "  --count n           messages to write ( 1000000 )\n"
+    "  --symbols n         number of symbols ( 8 )\n"
+    "  --skew z            zipf exponent of symbol activity, 0 uniform ( 1 )\n"
+    "  --users n           number of users ( 64 )\n"
+    "  --mix n,c,d,r,x     weights of new, cancel, reduce, replace, mass cancel ( 50,35,5,10,0.01 )\n"
+    "  --mid p             starting mid in ticks ( 10000 )\n"
+    "  --drift f           chance per message the mid moves a tick ( 0.05 )\n"
+    "  --inside n          levels counted as inside ( 64 )\n"
+    "  --inside-pct p      percent of passive orders inside ( 90 )\n"
+    "  --decay d           mean ticks from the mid of inside orders ( 8 )\n"
+    "  --far-pct p         percent of passive orders at absurd prices ( 1 )\n"
+    "  --marketable-pct p  percent of new orders crossing the spread ( 5 )\n"
+    "  --market-pct p      percent of marketable orders sent at price 0 ( 20 )\n"
+    "  --fok-pct p         percent of marketable orders sent fill-or-kill ( 2 )\n"
+    "  --lot n             lot size ( 100 )\n"
+    "  --size-mean n       mean lots per order ( 3 )\n"
+    "  --block-pct p       percent of orders 10-100x the usual size ( 1 )\n"
+    "  --live n            resting orders per symbol the cancel rate is balanced at ( 1000 )\n"
+    "  --burst-rate f      chance per message a burst starts ( 0.0005 )\n"
+    "  --burst-len n       messages per burst ( 2000 )\n"
+    "  --burst-factor f    cancel, replace and marketable multiplier in a burst ( 4 )\n"
+    "  --flush-every n     write F every n messages, 0 never ( 0 )\n";
+}
+
+bool parseArgs( int argc, char **argv, Options& opt ) {
+  for ( int i = 1; i < argc; i += 2 ) {
+    string key = argv[i];
+    if ( key == "--help" || key == "-h" || i + 1 >= argc ) {
+      return false;
+    }
+    const char *val = argv[i + 1];
+    if ( key == "--seed" ) opt.seed = std::strtoull(val, NULL, 10);
+    else if ( key == "--count" ) opt.count = std::strtoull(val, NULL, 10);
+    else if ( key == "--symbols" ) opt.symbols = std::atoi(val);
+    else if ( key == "--skew" ) opt.skew = std::atof(val);
+    else if ( key == "--users" ) opt.users = std::atoi(val);
+    else if ( key == "--mix" ) {
+      if ( std::sscanf(val, "%lf,%lf,%lf,%lf,%lf", &opt.w_new, &opt.w_cancel,
+                       &opt.w_reduce, &opt.w_replace, &opt.w_mass) < 4 ) {
+        return false;
+      }
+    }
+    else if ( key == "--mid" ) opt.start_mid = std::atoi(val);
+    else if ( key == "--drift" ) opt.drift = std::atof(val);
+    else if ( key == "--inside" ) opt.inside_levels = std::atoi(val);
+    else if ( key == "--inside-pct" ) opt.inside_pct = std::atof(val);
+    else if ( key == "--decay" ) opt.decay = std::atof(val);
+    else if ( key == "--far-pct" ) opt.far_pct = std::atof(val);
+    else if ( key == "--marketable-pct" ) opt.marketable_pct = std::atof(val);
+    else if ( key == "--market-pct" ) opt.market_pct = std::atof(val);
+    else if ( key == "--fok-pct" ) opt.fok_pct = std::atof(val);
+    else if ( key == "--lot" ) opt.lot = std::atoi(val);
+    else if ( key == "--size-mean" ) opt.size_mean = std::atof(val);
+    else if ( key == "--block-pct" ) opt.block_pct = std::atof(val);
+    else if ( key == "--live" ) opt.live_target = std::atoi(val);
+    else if ( key == "--burst-rate" ) opt.burst_rate = std::atof(val);
+    else if ( key == "--burst-len" ) opt.burst_len = std::atoi(val);
+    else if ( key == "--burst-factor" ) opt.burst_factor = std::atof(val);
+    else if ( key == "--flush-every" ) opt.flush_every = std::strtoull(val, NULL, 10);
+    else if ( key == "--format" ) {
+      if ( string(val) == "itch" ) opt.itch = true;
+      else if ( string(val) != "csv" ) return false;
+    }
+    else return false;
+  }
+  return opt.symbols > 0 && opt.users > 0 && opt.lot > 0 && opt.inside_levels > 0
+      && opt.start_mid > 0 && opt.live_target > 0 && opt.symbols < 65535;
+}
+
+}
+
+int main( int argc, char **argv ) {
+  Options opt;
+  if ( !parseArgs(argc, argv, opt) ) {
+    usage();
+    return 1;
+  }
+  std::ios::sync_with_stdio(false);
+  Generator gen(opt, std::cout);
+  gen.run();
+  std::cout.flush();
+  return 0;
+}
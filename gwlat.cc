@@ -0,0 +1,196 @@
+/* Loopback latency of the shared memory order entry path
+
+   runs the whole pipeline in one process but only ever lets the
+   client talk to it through /dev/shm the way a separate process
+   would: a gateway ingress thread polling the client channel, the
+   matcher handling what it enqueues and publishing to a shared
+   memory output ring, and a client that sends one order at a time
+   and waits for its ack on the output ring.
+
+     send ---> channel ring ---> ingress ---> queue ---> matcher
+       ^                                                    |
+       +------------------ output ring <--- ack ------------+
+
+   alternates new orders and their cancels so the book stays small,
+   and reports the round trip from send to ack in ns.  the text output
+   the matcher also writes goes to a null stream.
+
+   usage: ./gwlat [--count n] [--client-cpu n] [--ingress-cpu n] [--matcher-cpu n]
+
+   without three free cores to pin to the threads share and the
+   numbers say more about the scheduler than the path.
+*/
+
+//system headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+//my headers
+#include "cwfq.h"
+#include "gateway.h"
+#include "ordermanager.h"
+#include "output.h"
+#include "placement.h"
+#include "shm.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+using queue_t = CWFQ::RingFifo<Order, 127>;
+
+struct Options {
+  size_t count = 100000;
+  int client_cpu = -1;
+  int ingress_cpu = -1;
+  int matcher_cpu = -1;
+};
+
+class NullBuf : public std::streambuf {
+protected:
+  int overflow( int c ) override { return c; }
+  std::streamsize xsputn( const char*, std::streamsize n ) override { return n; }
+};
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+bool parseArgs( int argc, char **argv, Options& opt ) {
+  for ( int i = 1; i + 1 < argc; i += 2 ) {
+    string key = argv[i];
+    int v = std::atoi(argv[i + 1]);
+    if ( key == "--count" ) opt.count = std::strtoull(argv[i + 1], NULL, 10);
+    else if ( key == "--client-cpu" ) opt.client_cpu = v;
+    else if ( key == "--ingress-cpu" ) opt.ingress_cpu = v;
+    else if ( key == "--matcher-cpu" ) opt.matcher_cpu = v;
+    else return false;
+  }
+  return argc % 2 == 1 && opt.count > 0;
+}
+
+/** wait for the ack of uoid for user on the output ring */
+void awaitAck( const OutputRing *out, OutputRing::Cursor& c, int user, int uoid ) {
+  for ( int idle = 0; ; ) {
+    const OutputRecord *r = out->peek(c);
+    if ( r == NULL ) {
+      // spin while the ack is surely on its way, then let a shared cpu run the engine
+      if ( ++idle > 1000 ) {
+        std::this_thread::yield();
+      }
+      continue;
+    }
+    bool mine = r->type == 'A' && r->user == user && r->oid == uoid;
+    if ( out->release(c) && mine ) {
+      return;
+    }
+  }
+}
+
+}
+
+int main( int argc, char **argv ) {
+  Options opt;
+  if ( !parseArgs(argc, argv, opt) ) {
+    std::cerr << "usage: gwlat [--count n] [--client-cpu n] [--ingress-cpu n] [--matcher-cpu n]" << std::endl;
+    return 1;
+  }
+  string prefix = "/gwlat." + std::to_string(getpid());
+
+  NullBuf null_buf;
+  std::streambuf *old_cout = std::cout.rdbuf(&null_buf);
+
+  Gateway gw( prefix + ".in", 1, 1 );
+  OutputRing *out = Shm::create<OutputRing>( prefix + ".out" );
+  if ( !gw.isOpen() || out == NULL ) {
+    std::cout.rdbuf(old_cout);
+    std::cerr << "couldn't create the shared memory segments" << std::endl;
+    return 1;
+  }
+  // the client's view, as it would map them from its own process
+  GatewayClient client;
+  const OutputRing *acks = Shm::open<OutputRing>( prefix + ".out" );
+  if ( !client.open(prefix + ".in", 0) || acks == NULL ) {
+    std::cout.rdbuf(old_cout);
+    std::cerr << "couldn't open the shared memory segments" << std::endl;
+    return 1;
+  }
+  queue_t *queue = new queue_t;
+  std::atomic<bool> done(false);
+
+  std::thread ingress( [&]() {
+    Placement::pinThread(opt.ingress_cpu);
+    auto enqueue = [&]( Order& o ) {
+      while ( !queue->push(o) ) {
+        std::this_thread::yield();
+      }
+    };
+    while ( !done.load(std::memory_order_relaxed) ) {
+      if ( gw.poll(enqueue) == 0 ) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::thread matcher( [&]() {
+    Placement::pinThread(opt.matcher_cpu);
+    OrderManager mgr;
+    mgr.setOutputRing(out);
+    while ( !done.load(std::memory_order_relaxed) ) {
+      Order *o = new Order;
+      if ( queue->pop(*o) ) {
+        mgr.handle(o);
+      } else {
+        delete o;
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  Placement::pinThread(opt.client_cpu);
+  int user = gw.getUser(0);
+  OutputRing::Cursor c = acks->latest();
+  vector<uint64_t> rtt;
+  rtt.reserve(opt.count);
+  size_t warmup = opt.count / 10;
+  for ( size_t i = 0; i < opt.count + warmup; ++i ) {
+    int uoid = int(i / 2) + 1;
+    OrderRecord r = ( i % 2 == 0 ) ? OrderRecord::newOrder( "IBM", true, 100, 10, uoid )
+                                   : OrderRecord::cancel( uoid );
+    uint64_t t0 = nowNs();
+    while ( !client.send(r) ) {
+      std::this_thread::yield();
+    }
+    awaitAck( acks, c, user, uoid );
+    uint64_t t1 = nowNs();
+    if ( i >= warmup ) {
+      rtt.push_back( t1 - t0 );
+    }
+  }
+
+  done.store(true);
+  ingress.join();
+  matcher.join();
+  std::cout.rdbuf(old_cout);
+
+  std::sort( rtt.begin(), rtt.end() );
+  auto q = [&]( double p ) { return rtt[ std::min( rtt.size() - 1, size_t( p * rtt.size() ) ) ]; };
+  std::cout << "round trips " << rtt.size() << " lost acks " << c.lost << std::endl;
+  std::cout << "ns p50 " << q(0.5) << " p90 " << q(0.9) << " p99 " << q(0.99)
+            << " p99.9 " << q(0.999) << " max " << rtt.back() << std::endl;
+
+  Shm::unmap(acks);
+  Shm::unmap(out);
+  Shm::unlink( prefix + ".out" );
+  delete queue;
+  return 0;
+}
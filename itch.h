@@ -0,0 +1,268 @@
+#ifndef ITCH_H
+#define ITCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using std::string;
+
+/** A simple ITCH like market by order feed
+
+    the order messages of NASDAQ TotalView-ITCH 5.0 with their field
+    layout and big endian integers, each one framed by a two byte big
+    endian length the way MoldUDP64 and SoupBinTCP carry them
+
+      A  add order       locate tracking timestamp ref side shares stock price
+      E  order executed  locate tracking timestamp ref shares match
+      X  order cancel    locate tracking timestamp ref shares
+      D  order delete    locate tracking timestamp ref
+      U  order replace   locate tracking timestamp ref new_ref shares price
+
+    timestamps are 6 bytes of ns since midnight.  prices are whole
+    ticks as everywhere else in the engine rather than ITCH's 4 implied
+    decimals.  every other message type is skipped over, as is anything
+    shorter than its type's layout.
+
+    Decoder works straight off the receive buffer, no message is ever
+    copied before the sink sees its fields.  Writer builds the same
+    frames, for the generator and the tests.
+*/
+namespace Itch {
+
+/** body lengths, type byte included */
+const size_t ADD_LEN = 36;
+const size_t EXECUTED_LEN = 31;
+const size_t CANCEL_LEN = 23;
+const size_t DELETE_LEN = 19;
+const size_t REPLACE_LEN = 35;
+const size_t STOCK_LEN = 8;
+
+struct Header {
+  uint16_t locate;    // the feed's small integer id for the stock
+  uint16_t tracking;
+  uint64_t timestamp;
+  uint64_t ref;       // order reference number, unique for the day
+};
+
+struct Add : Header {
+  bool buy;
+  uint32_t shares;
+  const char *stock;  // STOCK_LEN bytes, space padded, not terminated
+  uint32_t price;
+};
+
+struct Executed : Header {
+  uint32_t shares;
+  uint64_t match;
+};
+
+struct Cancel : Header {
+  uint32_t shares;    // cancelled, not remaining
+};
+
+struct Delete : Header {};
+
+/** the order under ref is gone and new_ref rests in its place, same side */
+struct Replace : Header {
+  uint64_t new_ref;
+  uint32_t shares;
+  uint32_t price;
+};
+
+inline uint16_t get16( const char *p ) {
+  const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+  return uint16_t( ( u[0] << 8 ) | u[1] );
+}
+
+inline uint32_t get32( const char *p ) {
+  return ( uint32_t(get16(p)) << 16 ) | get16(p + 2);
+}
+
+inline uint64_t get48( const char *p ) {
+  return ( uint64_t(get16(p)) << 32 ) | get32(p + 2);
+}
+
+inline uint64_t get64( const char *p ) {
+  return ( uint64_t(get32(p)) << 32 ) | get32(p + 4);
+}
+
+/** the stock field with its padding dropped */
+inline string stockName( const char *stock ) {
+  size_t n = STOCK_LEN;
+  while ( n > 0 && stock[n - 1] == ' ' ) {
+    --n;
+  }
+  return string(stock, n);
+}
+
+class Decoder {
+public:
+  Decoder() : messages(0), skipped(0) {}
+
+  /** hand every whole frame in buf[0..len) to sink, which needs
+      onAdd, onExecuted, onCancel, onDelete and onReplace.  returns the
+      bytes consumed, anything after that is a partial frame to be
+      offered again with the rest of its bytes */
+  template <class Sink>
+  size_t decode( const char *buf, size_t len, Sink& sink );
+
+  uint64_t getMessages() const { return messages; }
+  uint64_t getSkipped() const { return skipped; }
+
+private:
+  static void header( const char *b, Header& h ) {
+    h.locate = get16(b + 1);
+    h.tracking = get16(b + 3);
+    h.timestamp = get48(b + 5);
+    h.ref = get64(b + 11);
+  }
+
+  uint64_t messages;
+  uint64_t skipped;
+};
+
+template <class Sink>
+inline size_t Decoder::decode( const char *buf, size_t len, Sink& sink ) {
+  size_t pos = 0;
+  while ( pos + 2 <= len ) {
+    size_t n = get16(buf + pos);
+    if ( pos + 2 + n > len ) {
+      break;
+    }
+    const char *b = buf + pos + 2;
+    pos += 2 + n;
+    if ( n == 0 ) {
+      ++skipped;
+      continue;
+    }
+    ++messages;
+    switch ( b[0] ) {
+      case 'A':
+        if ( n >= ADD_LEN ) {
+          Add m;
+          header(b, m);
+          m.buy = ( b[19] == 'B' );
+          m.shares = get32(b + 20);
+          m.stock = b + 24;
+          m.price = get32(b + 32);
+          sink.onAdd(m);
+          continue;
+        }
+        break;
+      case 'E':
+        if ( n >= EXECUTED_LEN ) {
+          Executed m;
+          header(b, m);
+          m.shares = get32(b + 19);
+          m.match = get64(b + 23);
+          sink.onExecuted(m);
+          continue;
+        }
+        break;
+      case 'X':
+        if ( n >= CANCEL_LEN ) {
+          Cancel m;
+          header(b, m);
+          m.shares = get32(b + 19);
+          sink.onCancel(m);
+          continue;
+        }
+        break;
+      case 'D':
+        if ( n >= DELETE_LEN ) {
+          Delete m;
+          header(b, m);
+          sink.onDelete(m);
+          continue;
+        }
+        break;
+      case 'U':
+        if ( n >= REPLACE_LEN ) {
+          Replace m;
+          header(b, m);
+          m.new_ref = get64(b + 19);
+          m.shares = get32(b + 27);
+          m.price = get32(b + 31);
+          sink.onReplace(m);
+          continue;
+        }
+        break;
+      default:
+        break;
+    }
+    --messages;
+    ++skipped;
+  }
+  return pos;
+}
+
+/** appends framed messages to a byte string */
+class Writer {
+public:
+  explicit Writer( string& buf ) : buf(buf) {}
+
+  void addOrder( uint16_t locate, uint64_t ts, uint64_t ref, bool buy, uint32_t shares,
+                 const string& stock, uint32_t price ) {
+    frame(ADD_LEN, 'A', locate, ts, ref);
+    buf.push_back( buy ? 'B' : 'S' );
+    put32(shares);
+    string s = stock.substr(0, STOCK_LEN);
+    s.resize(STOCK_LEN, ' ');
+    buf += s;
+    put32(price);
+  }
+
+  void orderExecuted( uint16_t locate, uint64_t ts, uint64_t ref, uint32_t shares, uint64_t match ) {
+    frame(EXECUTED_LEN, 'E', locate, ts, ref);
+    put32(shares);
+    put64(match);
+  }
+
+  void orderCancel( uint16_t locate, uint64_t ts, uint64_t ref, uint32_t shares ) {
+    frame(CANCEL_LEN, 'X', locate, ts, ref);
+    put32(shares);
+  }
+
+  void orderDelete( uint16_t locate, uint64_t ts, uint64_t ref ) {
+    frame(DELETE_LEN, 'D', locate, ts, ref);
+  }
+
+  void orderReplace( uint16_t locate, uint64_t ts, uint64_t ref, uint64_t new_ref,
+                     uint32_t shares, uint32_t price ) {
+    frame(REPLACE_LEN, 'U', locate, ts, ref);
+    put64(new_ref);
+    put32(shares);
+    put32(price);
+  }
+
+private:
+  void frame( size_t len, char type, uint16_t locate, uint64_t ts, uint64_t ref ) {
+    put16( uint16_t(len) );
+    buf.push_back(type);
+    put16(locate);
+    put16(0);
+    put16( uint16_t(ts >> 32) );
+    put32( uint32_t(ts) );
+    put64(ref);
+  }
+
+  void put16( uint16_t v ) {
+    buf.push_back( char(v >> 8) );
+    buf.push_back( char(v) );
+  }
+  void put32( uint32_t v ) {
+    put16( uint16_t(v >> 16) );
+    put16( uint16_t(v) );
+  }
+  void put64( uint64_t v ) {
+    put32( uint32_t(v >> 32) );
+    put32( uint32_t(v) );
+  }
+
+  string& buf;
+};
+
+}
+
+#endif
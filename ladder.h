@@ -0,0 +1,162 @@
+#ifndef LADDER_H
+#define LADDER_H
+
+#include <array>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "util.h"
+#include "level.h"
+
+using std::vector;
+
+/** Ladder policies keep one side of a book's PriceLevels sorted
+
+    Both policies store the levels worst to best so the best price is
+    always in the last slot for bids and asks alike.  The inner levels
+    which flicker in and out the most are then the cheapest to insert
+    and erase, and searches walk outwards from the top of book.
+
+    Better is the side's comparator, std::greater for bids and
+    std::less for asks.  MaxDepth is the compile time depth, 0 means
+    unbounded.
+
+    slots are numbered in storage order ( 0 is the worst level ),
+    depth is numbered from the top of book ( 0 is the best level ).
+
+    isBetter(a, b) is true when a is a strictly better price than b
+    for this side.
+
+    search(p) returns the slot a new level for p would be inserted
+    at, so if a level for p already exists it is in slot search(p)-1
+*/
+
+/** general purpose growable ladder on a sorted vector
+
+    for the reasonably tight books we expect a linear scan from the
+    best end will outperform a binary search, MaxDepth is only used as
+    a reservation hint
+*/
+template <typename Price, class Better, size_t MaxDepth=0>
+class VectorLadder {
+public:
+  using level_t = PriceLevel<Price>;
+
+  VectorLadder() { levels.reserve( MaxDepth ? MaxDepth : 16 ); }
+
+  bool empty() const { return levels.empty(); }
+  size_t size() const { return levels.size(); }
+  void clear() { levels.clear(); }
+  void reserve( size_t n ) { levels.reserve(n); }
+
+  level_t& best() { return levels.back(); }
+  bool isBetter( Price a, Price b ) const { return better(a, b); }
+  level_t& slot( size_t i ) { return levels[i]; }
+  level_t& depth( size_t d ) { return levels[levels.size() - 1 - d]; }
+
+  size_t search( Price p ) const {
+    size_t i = levels.size();
+    while ( i > 0 && better(levels[i-1].l_price, p) ) {
+      --i;
+    }
+    return i;
+  }
+
+  level_t* find( Price p ) {
+    size_t i = search(p);
+    return ( i > 0 && levels[i-1].l_price == p ) ? &levels[i-1] : NULL;
+  }
+
+  void insertAt( size_t i, const level_t& lvl ) {
+    levels.insert( levels.begin() + i, lvl );
+  }
+
+  void eraseAt( size_t i ) {
+    levels.erase( levels.begin() + i );
+  }
+
+  bool erase( Price p ) {
+    size_t i = search(p);
+    if ( i > 0 && levels[i-1].l_price == p ) {
+      eraseAt(i-1);
+      return true;
+    }
+    return false;
+  }
+
+private:
+  Better better;
+  vector<level_t> levels;
+};
+
+/** fixed depth ladder for tight, known depth instruments
+
+    storage is a std::array so the whole ladder lives inline in the
+    book.  search is a branchless count of the levels better than p
+    over all MaxDepth slots which the compiler fully unrolls, there is
+    no data dependent branch to mispredict.  inserting past MaxDepth
+    throws std::bad_alloc just like running out of level pool
+*/
+template <typename Price, class Better, size_t MaxDepth>
+class ArrayLadder {
+  static_assert( MaxDepth > 0, "ArrayLadder needs a compile time depth" );
+public:
+  using level_t = PriceLevel<Price>;
+
+  ArrayLadder() : n(0) {}
+
+  bool empty() const { return n == 0; }
+  size_t size() const { return n; }
+  void clear() { n = 0; }
+  void reserve( size_t ) {}
+
+  level_t& best() { return levels[n-1]; }
+  bool isBetter( Price a, Price b ) const { return better(a, b); }
+  level_t& slot( size_t i ) { return levels[i]; }
+  level_t& depth( size_t d ) { return levels[n - 1 - d]; }
+
+  size_t search( Price p ) const {
+    size_t nbetter = 0;
+#pragma GCC unroll 128
+    for ( size_t k = 0; k < MaxDepth; ++k ) {
+      nbetter += ( k < n ) & better(levels[k].l_price, p);
+    }
+    return n - nbetter;
+  }
+
+  level_t* find( Price p ) {
+    size_t i = search(p);
+    return ( i > 0 && levels[i-1].l_price == p ) ? &levels[i-1] : NULL;
+  }
+
+  void insertAt( size_t i, const level_t& lvl ) {
+    if ( n == MaxDepth ) {
+      throw std::bad_alloc();
+    }
+    std::move_backward( levels.begin() + i, levels.begin() + n, levels.begin() + n + 1 );
+    levels[i] = lvl;
+    ++n;
+  }
+
+  void eraseAt( size_t i ) {
+    std::move( levels.begin() + i + 1, levels.begin() + n, levels.begin() + i );
+    --n;
+  }
+
+  bool erase( Price p ) {
+    size_t i = search(p);
+    if ( i > 0 && levels[i-1].l_price == p ) {
+      eraseAt(i-1);
+      return true;
+    }
+    return false;
+  }
+
+private:
+  Better better;
+  size_t n;
+  std::array<level_t, MaxDepth> levels;
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/** Per stage latency tracing
+
+    build with -DOB_LATENCY to enable, without it every LAT_ macro
+    expands to nothing and Order carries no stamps, so a normal build
+    pays nothing at all.
+
+    each message is stamped with the cpu timestamp counter as it moves
+    through the pipeline
+
+      READ         line read, before parsing
+      PARSED       parsed into an Order
+      ENQUEUED     pushed onto the ring ( after any wait for space )
+      DEQUEUED     popped by the matching thread
+      MATCH_START  OrderManager::handle entered
+      MATCH_END    OrderManager::handle done
+
+    the stamps ride along inside the Order so they survive the copy
+    through the ring.  time spent writing acks, trades and TOB lines is
+    accumulated separately while the message is being handled and
+    taken out of the match stage, so every stage below is disjoint
+
+      parse     READ -> PARSED
+      enqueue   PARSED -> ENQUEUED
+      queue     ENQUEUED -> DEQUEUED
+      dispatch  DEQUEUED -> MATCH_START
+      match     MATCH_START -> MATCH_END less publish
+      publish   sum of the output written for the message
+      total     first stamp -> MATCH_END
+
+    READ is taken before there is an Order to hold it, LAT_MARK keeps it
+    in a local until LAT_SET can store it.
+
+    a stage is only recorded when both its stamps were taken, so orders
+    built directly ( tests, benchmarks ) only show up in match, publish
+    and total.
+
+    histograms are log linear like HDR histogram, 128 sub buckets per
+    power of two so any reported value is within 1% of the truth, and
+    are only ever written from the matching thread.  dump() prints
+    p50 through p99.99 and max per stage in ns, it runs at exit from
+    the demo and whenever SIGUSR1 arrives ( the handler only raises a
+    flag, the matching thread dumps at its next message ).
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Latency {
+
+/** log linear histogram of tick counts, built with or without
+    OB_LATENCY so it can be used and tested on its own */
+class Histogram {
+public:
+  static const unsigned SUB_BITS = 7;
+  static const uint64_t SUB = uint64_t(1) << SUB_BITS;
+
+  Histogram() : counts( (64 - SUB_BITS + 1) * SUB, 0 ), total(0), max_v(0) {}
+
+  void record( uint64_t v ) {
+    ++counts[ index(v) ];
+    ++total;
+    if ( v > max_v ) {
+      max_v = v;
+    }
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t max() const { return max_v; }
+
+  /** the highest value equivalent to the q quantile */
+  uint64_t quantile( double q ) const {
+    if ( total == 0 ) {
+      return 0;
+    }
+    uint64_t want = uint64_t( q * total );
+    if ( want >= total ) {
+      want = total - 1;
+    }
+    uint64_t seen = 0;
+    for ( size_t i = 0; i < counts.size(); ++i ) {
+      seen += counts[i];
+      if ( seen > want ) {
+        uint64_t hi = highest(i);
+        return hi < max_v ? hi : max_v;
+      }
+    }
+    return max_v;
+  }
+
+  void reset() {
+    std::fill( counts.begin(), counts.end(), 0 );
+    total = 0;
+    max_v = 0;
+  }
+
+private:
+  static size_t index( uint64_t v ) {
+    if ( v < SUB ) {
+      return size_t(v);
+    }
+    unsigned shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return size_t( (shift + 1) * SUB + ( (v >> shift) - SUB ) );
+  }
+
+  static uint64_t highest( size_t i ) {
+    if ( i < SUB ) {
+      return i;
+    }
+    unsigned shift = unsigned( i / SUB - 1 );
+    uint64_t sub = i % SUB + SUB;
+    return ( (sub + 1) << shift ) - 1;
+  }
+
+  std::vector<uint64_t> counts;
+  uint64_t total;
+  uint64_t max_v;
+};
+
+}
+
+#ifdef OB_LATENCY
+
+#include <chrono>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace Latency {
+
+enum Stamp {
+  eREAD = 0,
+  ePARSED,
+  eENQUEUED,
+  eDEQUEUED,
+  eMATCH_START,
+  eMATCH_END,
+
+  eSTAMPS
+};
+
+enum Stage {
+  sPARSE = 0,
+  sENQUEUE,
+  sQUEUE,
+  sDISPATCH,
+  sMATCH,
+  sPUBLISH,
+  sTOTAL,
+
+  sSTAGES
+};
+
+/** timestamps carried by each Order, 0 means not taken */
+struct Stamps {
+  uint64_t t[eSTAMPS];
+};
+
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+#endif
+}
+
+/** the matching thread's view of one message in flight plus the stage histograms */
+class Tracer {
+public:
+  static Tracer& instance() {
+    static Tracer t;
+    return t;
+  }
+
+  /** handle() entered for a message */
+  void begin( Stamps& s ) {
+    if ( dump_requested ) {
+      dump_requested = 0;
+      dump(std::cerr);
+    }
+    s.t[eMATCH_START] = now();
+    publish_ticks = 0;
+  }
+
+  /** handle() done, fold the message's stamps into the histograms */
+  void end( Stamps& s ) {
+    s.t[eMATCH_END] = now();
+    span( sPARSE, s, eREAD, ePARSED );
+    span( sENQUEUE, s, ePARSED, eENQUEUED );
+    span( sQUEUE, s, eENQUEUED, eDEQUEUED );
+    span( sDISPATCH, s, eDEQUEUED, eMATCH_START );
+    uint64_t match = s.t[eMATCH_END] - s.t[eMATCH_START];
+    stages[sMATCH].record( match > publish_ticks ? match - publish_ticks : 0 );
+    if ( publish_ticks ) {
+      stages[sPUBLISH].record(publish_ticks);
+    }
+    for ( int i = eREAD; i < eMATCH_END; ++i ) {
+      if ( s.t[i] ) {
+        stages[sTOTAL].record( s.t[eMATCH_END] - s.t[i] );
+        break;
+      }
+    }
+  }
+
+  void addPublish( uint64_t ticks ) { publish_ticks += ticks; }
+
+  void reset() {
+    for ( Histogram& h : stages ) {
+      h.reset();
+    }
+  }
+
+  const Histogram& stage( Stage s ) const { return stages[s]; }
+  double nsPerTick() const { return ns_per_tick; }
+
+  void dump( std::ostream& out ) const {
+    static const char *names[sSTAGES] = { "parse", "enqueue", "queue", "dispatch", "match", "publish", "total" };
+    static const double qs[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+    static const char *cols[] = { "count", "p50", "p90", "p99", "p99.9", "p99.99", "max" };
+    out << std::left << std::setw(10) << "stage ns" << std::right;
+    for ( const char *c : cols ) {
+      out << " " << std::setw(12) << c;
+    }
+    out << std::endl;
+    for ( int i = 0; i < sSTAGES; ++i ) {
+      const Histogram& h = stages[i];
+      out << std::left << std::setw(10) << names[i] << std::right << " " << std::setw(12) << h.count();
+      for ( double q : qs ) {
+        out << " " << std::setw(12) << uint64_t( h.quantile(q) * ns_per_tick );
+      }
+      out << " " << std::setw(12) << uint64_t( h.max() * ns_per_tick ) << std::endl;
+    }
+  }
+
+  /** dump from the matching thread at its next message */
+  static void onSignal( int ) { dump_requested = 1; }
+
+  void installSignalHandler() { std::signal( SIGUSR1, &Tracer::onSignal ); }
+
+private:
+  Tracer() : publish_ticks(0), ns_per_tick(calibrate()) {}
+
+  void span( Stage st, const Stamps& s, Stamp from, Stamp to ) {
+    // stamps from two threads assume an invariant tsc, never go negative if it isn't
+    if ( s.t[from] && s.t[to] ) {
+      stages[st].record( s.t[to] > s.t[from] ? s.t[to] - s.t[from] : 0 );
+    }
+  }
+
+  /** ns per tick of now(), measured against the steady clock */
+  static double calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    auto c0 = std::chrono::steady_clock::now();
+    uint64_t t0 = now();
+    std::this_thread::sleep_for( std::chrono::milliseconds(20) );
+    auto c1 = std::chrono::steady_clock::now();
+    uint64_t t1 = now();
+    return std::chrono::duration<double, std::nano>(c1 - c0).count() / double(t1 - t0);
+#else
+    return 1.0;
+#endif
+  }
+
+  Histogram stages[sSTAGES];
+  uint64_t publish_ticks;
+  static inline volatile std::sig_atomic_t dump_requested = 0;
+  double ns_per_tick;
+};
+
+/** adds the lifetime of the scope to the message's publish time */
+class PublishScope {
+public:
+  PublishScope() : start(now()) {}
+  ~PublishScope() { Tracer::instance().addPublish( now() - start ); }
+private:
+  uint64_t start;
+};
+
+}
+
+#define LAT_STAMP(order, stamp) ( (order)->latencyStamps().t[Latency::stamp] = Latency::now() )
+#define LAT_MARK(var) uint64_t var = Latency::now()
+#define LAT_SET(order, stamp, var) ( (order)->latencyStamps().t[Latency::stamp] = (var) )
+#define LAT_BEGIN(order) Latency::Tracer::instance().begin( (order)->latencyStamps() )
+#define LAT_END(order) Latency::Tracer::instance().end( (order)->latencyStamps() )
+#define LAT_PUBLISH_SCOPE() Latency::PublishScope lat_publish_scope_
+#define LAT_INSTALL_SIGNAL() Latency::Tracer::instance().installSignalHandler()
+#define LAT_DUMP() Latency::Tracer::instance().dump(std::cerr)
+
+#else
+
+#define LAT_STAMP(order, stamp) ((void)0)
+#define LAT_MARK(var) ((void)0)
+#define LAT_SET(order, stamp, var) ((void)0)
+#define LAT_BEGIN(order) ((void)0)
+#define LAT_END(order) ((void)0)
+#define LAT_PUBLISH_SCOPE() ((void)0)
+#define LAT_INSTALL_SIGNAL() ((void)0)
+#define LAT_DUMP() ((void)0)
+
+#endif
+
+#endif
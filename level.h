@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <list>
+#include <deque>
 #include <cassert>
 
 #include "util.h"
@@ -13,100 +14,249 @@ using std::list;
 /**
     price level is a smaller class we'll keep sorted to tie prices into full levels
  */
+template <typename Price>
 class PriceLevel {
 public:
-  PriceLevel( int price, level_id_t lid )
+  PriceLevel( Price price=0, level_id_t lid=level_id_t(0) )
     : l_price(price)
     , l_ptr(lid)
     {}
 
-  int l_price;
+  Price l_price;
   level_id_t l_ptr;
 };
 
-bool operator>(const PriceLevel &a, const PriceLevel& b) {
+template <typename Price>
+bool operator>(const PriceLevel<Price> &a, const PriceLevel<Price>& b) {
   return a.l_price > b.l_price;
 }
 
+/** Queue policies for the time ordered orders resting at a level
+
+    every policy offers push_back, front, pop_front, remove, empty,
+    size, clear and forEach, which visits the orders front to back,
+    over Order pointers.  remove returns how many
+    entries it had to visit to find the order, 0 if it wasn't there.
+
+    ListQueue is the original node based queue, cancels from the middle
+    don't move anything but every step is a pointer chase.
+    DequeQueue keeps the pointers in contiguous blocks which is
+    friendlier to sweeping at the cost of shifting on a middle cancel.
+    Both have to scan for the order to remove.
+
+    IntrusiveQueue threads the queue through the Order's own queue
+    links so there is no node allocation and removing any order is O(1)
+*/
+template <template <class, class> class Container>
+class StdQueue {
+public:
+  void push_back( Order *o ) { q.push_back(o); }
+  Order* front() { return q.front(); }
+  void pop_front() { q.pop_front(); }
+  bool empty() const { return q.empty(); }
+  size_t size() const { return q.size(); }
+  void clear() { q.clear(); }
+  template <class F> void forEach( F f ) const {
+    for ( Order *o : q ) {
+      f(o);
+    }
+  }
+
+  size_t remove( Order *o ) {
+    size_t visited = 0;
+    for ( auto it = q.begin(); it != q.end(); ++it ) {
+      ++visited;
+      if ( *it == o ) {
+        q.erase(it);
+        return visited;
+      }
+    }
+    return 0;
+  }
+
+private:
+  Container< Order*, std::allocator<Order*> > q;
+};
+
+using ListQueue = StdQueue<std::list>;
+using DequeQueue = StdQueue<std::deque>;
+
+class IntrusiveQueue {
+public:
+  IntrusiveQueue() : head(NULL), tail(NULL), count(0) {}
+
+  void push_back( Order *o ) {
+    Order::Links& l = o->queueLinks();
+    l.prev = tail;
+    l.next = NULL;
+    if ( tail ) {
+      tail->queueLinks().next = o;
+    } else {
+      head = o;
+    }
+    tail = o;
+    ++count;
+  }
+
+  Order* front() { return head; }
+  void pop_front() { remove(head); }
+  bool empty() const { return count == 0; }
+  size_t size() const { return count; }
+  void clear() { head = tail = NULL; count = 0; }
+  template <class F> void forEach( F f ) const {
+    for ( Order *o = head; o; o = o->queueLinks().next ) {
+      f(o);
+    }
+  }
+
+  /** 0 if o isn't queued here: an order with nothing ahead of it has
+      to be the head, one that was removed has no links at all */
+  size_t remove( Order *o ) {
+    Order::Links& l = o->queueLinks();
+    if ( l.prev == NULL && head != o ) {
+      return 0;
+    }
+    if ( l.prev ) {
+      l.prev->queueLinks().next = l.next;
+    } else {
+      head = l.next;
+    }
+    if ( l.next ) {
+      l.next->queueLinks().prev = l.prev;
+    } else {
+      tail = l.prev;
+    }
+    l.prev = l.next = NULL;
+    --count;
+    return 1;
+  }
+
+private:
+  Order *head;
+  Order *tail;
+  size_t count;
+};
+
 /** Represent a level in the book
 
     A level is a number of orders sorted by time for a given symbol
+
+    Price and Qty are the book's own representation, Qty being the
+    type we aggregate into so a deep book can widen it past what a
+    single Order carries.  Queue is one of the queue policies above.
 */
-class Level {
+template <typename Price, typename Qty, class Queue=IntrusiveQueue>
+class BasicLevel {
 public:
-  Level(int price=0, int qty=0)
+  BasicLevel(Price price=0, Qty qty=0)
     : valid(false)
     , price(price)
     , qty(qty)
     {}
 
-  ~Level();
+  ~BasicLevel();
 
   /* mutators */
   void addOrder(Order *o);
-  void cancelOrder(Order *o);
+  /** returns the queue entries visited to find o, 0 if it wasn't here */
+  size_t cancelOrder(Order *o);
   void reduceOrder(Order *o, int qty);
   void flushOrders();
-  void setPrice(int price);
-  void setQty(int qty);
+  Order* popFront();
+  void fillFront(Qty fill);
+  void setPrice(Price price);
+  void setQty(Qty qty);
   void setValid(bool b); //reserved for future usage..
 
   /* accessors */
-  int getQty() const { return qty; }
-  int getPrice() const { return price; }
+  Qty getQty() const { return qty; }
+  Price getPrice() const { return price; }
   int getNumOrders() const { return orders.size(); }
+  bool empty() const { return orders.empty(); }
   int getValid() const { return valid; }
   Order* getFrontOrder() { return orders.front(); }
+  /** f(Order*) for every order in time priority */
+  template <class F> void forEachOrder( F f ) const { orders.forEach(f); }
 
 private:
   bool valid;
-  int price; //price of level
-  int qty; // total qty at level
-  list<Order *> orders; // kept sorted by time
+  Price price; //price of level
+  Qty qty; // total qty at level
+  Queue orders; // kept sorted by time
 };
 
-inline void Level::setPrice(int price) {
+/** the int/int level of the standard book */
+using Level = BasicLevel<int, int, IntrusiveQueue>;
+
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::setPrice(Price price) {
   this->price = price;
 }
 
-inline void Level::setQty(int qty) {
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::setQty(Qty qty) {
   this->qty = qty;
 }
 
-inline void Level::setValid(bool valid) {
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::setValid(bool valid) {
   this->valid = valid;
 }
 
-inline void Level::addOrder(Order *o) {
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::addOrder(Order *o) {
   assert( o->getPrice() == price ); //"We shouldn't be adding this order to this price level");
   qty += o->getQty();
   orders.push_back(o);
 }
 
-inline void Level::cancelOrder(Order *o) {
+template <typename Price, typename Qty, class Queue>
+inline size_t BasicLevel<Price, Qty, Queue>::cancelOrder(Order *o) {
   assert( o->getPrice() == price );  //"We shouldn't be adding this order to this price level");
-  for ( auto it = orders.begin(); it != orders.end(); ++it ) {
-    if ( (*it)->getUserOrderId() == o->getUserOrderId() ) {
-      qty -= o->getQty();
-      orders.erase(it);
-      return; //not just break
-    }
+  size_t visited = orders.remove(o);
+  if ( visited ) {
+    qty -= o->getQty();
   }
+  return visited;
+}
+
+/** quantity down amend in place, the order keeps its place in the queue */
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::reduceOrder(Order *o, int qty) {
+  assert( o->getPrice() == price );
+  assert( qty < o->getQty() );
+  o->setQty( o->getQty() - qty );
+  this->qty -= qty;
+}
+
+/** unlink the front order, taking its whole qty off the level, for
+    the sweep once it has been completely filled */
+template <typename Price, typename Qty, class Queue>
+inline Order* BasicLevel<Price, Qty, Queue>::popFront() {
+  Order *o = orders.front();
+  orders.pop_front();
+  qty -= o->getQty();
+  return o;
+}
 
-  std::cerr << "Couldn't remove order in level of price " << o->getPrice()
-            << " for symbol " << o->getSymbol()
-            << " for orderID << " << o->getUserOrderId()
-            << ". It was not found" << std::endl;
+/** partial fill of the front order, it keeps its place in the queue */
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::fillFront(Qty fill) {
+  Order *o = orders.front();
+  o->setQty( o->getQty() - fill );
+  qty -= fill;
 }
 
 /** Delete all orders and then clear the array */
-inline void Level::flushOrders() {
+template <typename Price, typename Qty, class Queue>
+inline void BasicLevel<Price, Qty, Queue>::flushOrders() {
   orders.clear();
   qty = 0;
   valid = false;
 }
 
-inline Level::~Level() {
+template <typename Price, typename Qty, class Queue>
+inline BasicLevel<Price, Qty, Queue>::~BasicLevel() {
   flushOrders();
 }
 
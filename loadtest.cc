@@ -0,0 +1,236 @@
+/* Open loop load test of the whole pipeline
+
+   drives ingress, the RingFifo, the OrderManager and its output at a
+   fixed message rate from a pre-generated flow ( see gen.cc ), then
+   again at each higher rate, and reports per rate
+
+     rate,messages,seconds,throughput,p50,p90,p99,p99.9,max
+
+   with the percentiles in ns, and saturated on the end of any rate
+   the throughput fell more than 5% short of.  message i is due at
+   start + i / rate whatever happened to the messages before it: the
+   ingress thread never waits on the matcher beyond a full ring, and
+   latency runs from when the message was due, not from when it finally
+   got onto the ring, so time spent queued behind a slow message is
+   counted against every message it held up rather than quietly left
+   out.  once the matcher can't keep up throughput flattens below the
+   rate and the latencies grow with the length of the run, that rate
+   is the saturation point.
+
+   the flow is parsed up front so reading and parsing don't limit the
+   rate.  every rate starts a fresh OrderManager on the flow from its
+   first message, for rate * seconds messages or the whole flow if
+   that's shorter.  the matcher applies whatever backlog it finds as
+   one batch exactly as the demo does and a message's latency ends when
+   its batch is done.  text output goes to a null stream, so the
+   numbers include formatting every line but not writing it: neither
+   stdout nor the publisher thread ( see publisher.h ) is measured.
+
+   usage: ./loadtest [--rates r1,r2,...] [--seconds s] [--ingress-cpu n] [--matcher-cpu n] flow_file
+
+   without two free cores to pin to the threads share and the numbers
+   say more about the scheduler than the pipeline.
+*/
+
+//system headers
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//my headers
+#include "cwfq.h"
+#include "ordermanager.h"
+#include "orderparser.h"
+#include "placement.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+using queue_t = CWFQ::RingFifo<Order, 128>;
+
+struct Options {
+  vector<double> rates = { 100000, 200000, 500000, 1000000, 2000000, 5000000 };
+  double seconds = 1;
+  int ingress_cpu = -1;
+  int matcher_cpu = -1;
+  string file;
+};
+
+class NullBuf : public std::streambuf {
+protected:
+  int overflow( int c ) override { return c; }
+  std::streamsize xsputn( const char*, std::streamsize n ) override { return n; }
+};
+
+uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+bool parseRates( const string& arg, vector<double>& rates ) {
+  rates.clear();
+  std::istringstream in(arg);
+  string r;
+  while ( std::getline(in, r, ',') ) {
+    double v = std::atof( r.c_str() );
+    if ( v <= 0 ) {
+      return false;
+    }
+    rates.push_back(v);
+  }
+  return !rates.empty();
+}
+
+bool parseArgs( int argc, char **argv, Options& opt ) {
+  for ( int i = 1; i < argc; ++i ) {
+    string arg = argv[i];
+    if ( arg == "--rates" && i + 1 < argc ) {
+      if ( !parseRates(argv[++i], opt.rates) ) {
+        return false;
+      }
+    } else if ( arg == "--seconds" && i + 1 < argc ) {
+      opt.seconds = std::atof(argv[++i]);
+    } else if ( arg == "--ingress-cpu" && i + 1 < argc ) {
+      opt.ingress_cpu = std::atoi(argv[++i]);
+    } else if ( arg == "--matcher-cpu" && i + 1 < argc ) {
+      opt.matcher_cpu = std::atoi(argv[++i]);
+    } else if ( arg[0] != '-' && opt.file.empty() ) {
+      opt.file = arg;
+    } else {
+      return false;
+    }
+  }
+  return !opt.file.empty() && opt.seconds > 0;
+}
+
+bool loadFlow( const string& file, vector<Order>& flow ) {
+  std::ifstream in(file);
+  if ( !in.is_open() ) {
+    std::cerr << "couldn't read " << file << std::endl;
+    return false;
+  }
+  string line;
+  while ( std::getline(in, line) ) {
+    Order *o = OrderParser::parse(line);
+    if ( o ) {
+      flow.push_back(*o);
+      delete o;
+    }
+  }
+  return !flow.empty();
+}
+
+struct Step {
+  size_t messages;
+  double seconds;   // from the first message being due to the last being done
+  vector<uint64_t> latency;
+};
+
+/** flow[0..n) at rate, message i due at start + i * period */
+void runStep( const Options& opt, const vector<Order>& flow, size_t n, double rate, Step& step ) {
+  queue_t *queue = new queue_t;
+  OrderManager *mgr = new OrderManager;
+  step.messages = n;
+  step.latency.assign( n, 0 );
+  double period = 1e9 / rate;
+  // far enough out for the ingress thread to be running and spinning
+  uint64_t start = nowNs() + 1000000;
+
+  std::thread ingress( [&]() {
+    Placement::pinThread(opt.ingress_cpu);
+    size_t i = 0;
+    while ( i < n ) {
+      uint64_t now = nowNs();
+      // everything now due goes at once, a late start is caught up on
+      // rather than pushed back
+      size_t due = i;
+      while ( i < n && start + uint64_t( i * period ) <= now ) {
+        if ( !queue->push(flow[i]) ) {
+          break;
+        }
+        ++i;
+      }
+      if ( i == due ) {
+        // nothing due or the ring is full, let a shared cpu run the matcher
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  const size_t BATCH = 64;
+  Order *batch[BATCH];
+  size_t done = 0;
+  while ( done < n ) {
+    size_t k = 0;
+    while ( k < BATCH ) {
+      Order *o = new Order;
+      if ( !queue->pop(*o) ) {
+        delete o;
+        break;
+      }
+      batch[k++] = o;
+    }
+    if ( k == 0 ) {
+      std::this_thread::yield();
+      continue;
+    }
+    mgr->handleBatch(batch, k);
+    uint64_t now = nowNs();
+    for ( size_t j = 0; j < k; ++j, ++done ) {
+      uint64_t due = start + uint64_t( done * period );
+      step.latency[done] = now > due ? now - due : 0;
+    }
+  }
+  step.seconds = double( nowNs() - start ) / 1e9;
+
+  ingress.join();
+  delete mgr;
+  delete queue;
+}
+
+}
+
+int main( int argc, char **argv ) {
+  Options opt;
+  if ( !parseArgs(argc, argv, opt) ) {
+    std::cerr << "usage: loadtest [--rates r1,r2,...] [--seconds s] [--ingress-cpu n] [--matcher-cpu n] flow_file" << std::endl;
+    return 1;
+  }
+  vector<Order> flow;
+  if ( !loadFlow(opt.file, flow) ) {
+    return 1;
+  }
+  Placement::pinThread(opt.matcher_cpu);
+
+  std::cout << "rate,messages,seconds,throughput,p50,p90,p99,p99.9,max" << std::endl;
+  for ( double rate : opt.rates ) {
+    size_t n = std::min( flow.size(), size_t( rate * opt.seconds ) );
+    if ( n == 0 ) {
+      continue;
+    }
+    NullBuf null_buf;
+    std::streambuf *old_cout = std::cout.rdbuf(&null_buf);
+    std::streambuf *old_cerr = std::cerr.rdbuf(&null_buf);
+    Step step;
+    runStep( opt, flow, n, rate, step );
+    std::cout.rdbuf(old_cout);
+    std::cerr.rdbuf(old_cerr);
+
+    vector<uint64_t>& lat = step.latency;
+    std::sort( lat.begin(), lat.end() );
+    auto q = [&]( double p ) { return lat[ std::min( lat.size() - 1, size_t( p * lat.size() ) ) ]; };
+    double throughput = step.messages / step.seconds;
+    std::cout << uint64_t(rate) << "," << step.messages << "," << step.seconds << "," << uint64_t(throughput)
+              << "," << q(0.5) << "," << q(0.9) << "," << q(0.99) << "," << q(0.999) << "," << lat.back()
+              << ( throughput < rate * 0.95 ? ",saturated" : "" ) << std::endl;
+  }
+  return 0;
+}
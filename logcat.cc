@@ -0,0 +1,91 @@
+/* Prints a binary event log as the engine's text output
+
+   usage: ./logcat [--from ns] [--to ns] [--time] [--symbols] [--blocks] file
+
+   the same lines the engine wrote to cout when it made the log
+
+     A,user,oid
+     R,user,oid,reason
+     T,buy_user,buy_oid,sell_user,sell_oid,price,qty
+     B,side,price,qty        ( - for an empty side )
+
+   --from and --to keep to the events stamped in that range, ns since
+   the epoch inclusive, reading only the blocks the index says overlap
+   it.  --time puts each event's stamp in front of its line and
+   --symbols adds the symbol to trades and TOB the way shmcat does.
+   --blocks prints the index instead.  see eventlog.h for the format.
+*/
+
+//system headers
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+
+//my headers
+#include "eventlog.h"
+#include "output.h"
+
+using std::string;
+
+namespace {
+
+struct Printer {
+  bool time = false;
+  bool symbols = false;
+
+  void operator()( uint64_t ts, const OutputRecord& r ) {
+    if ( time ) {
+      std::cout << ts << ",";
+    }
+    formatRecord(std::cout, r, symbols);
+  }
+};
+
+}
+
+int main( int argc, char **argv ) {
+  uint64_t from = 0;
+  uint64_t to = std::numeric_limits<uint64_t>::max();
+  bool blocks = false;
+  Printer printer;
+  string name;
+  for ( int i = 1; i < argc; ++i ) {
+    string arg = argv[i];
+    if ( arg == "--from" && i + 1 < argc ) {
+      from = std::strtoull( argv[++i], NULL, 10 );
+    } else if ( arg == "--to" && i + 1 < argc ) {
+      to = std::strtoull( argv[++i], NULL, 10 );
+    } else if ( arg == "--time" ) {
+      printer.time = true;
+    } else if ( arg == "--symbols" ) {
+      printer.symbols = true;
+    } else if ( arg == "--blocks" ) {
+      blocks = true;
+    } else if ( arg[0] != '-' && name.empty() ) {
+      name = arg;
+    } else {
+      name.clear();
+      break;
+    }
+  }
+  if ( name.empty() ) {
+    std::cerr << "usage: logcat [--from ns] [--to ns] [--time] [--symbols] [--blocks] file" << std::endl;
+    return 1;
+  }
+  EventLog::Reader reader;
+  if ( !reader.open(name) ) {
+    return 1;
+  }
+  if ( reader.isTruncated() ) {
+    std::cerr << name << " wasn't closed, decoding the " << reader.getIndex().size() << " whole blocks" << std::endl;
+  }
+  if ( blocks ) {
+    for ( const EventLog::IndexEntry& e : reader.getIndex() ) {
+      std::cout << e.offset << "," << e.first_ts << "," << e.last_ts << ","
+                << e.events << "," << e.bytes << "\n";
+    }
+    return 0;
+  }
+  return reader.decode( from, to, printer ) ? 0 : 1;
+}
@@ -1,6 +1,11 @@
 #ifndef ORDERBOOK_H
 #define ORDERBOOK_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <limits>
 #include <iostream>
 #include <string>
 #include <vector>
@@ -13,21 +18,91 @@ using std::endl;
 #include "util.h"
 #include "order.h"
 #include "level.h"
+#include "ladder.h"
+#include "depthindex.h"
 #include "pool.h"
+#include "stats.h"
+#include "output.h"
+#include "eventlog.h"
+#include "publisher.h"
+#include "trigger.h"
 
 class OrderManager; //fwd declare
 
-/** Models an OrderBook for a single symbol has a bid side and ask side
+/** one execution between an aggressor and a resting order, by value
+    so it can be published after the resting order has been retired */
+struct Fill {
+  int buy_user;
+  int buy_oid;
+  int sell_user;
+  int sell_oid;
+  int price;
+  int qty;
+  // the two sides' lists, for the manager's position counters
+  UserOrderList *buy_list;
+  UserOrderList *sell_list;
+
+  Fill( Order *aggressor, Order *resting, int price, int qty )
+    : price(price)
+    , qty(qty)
+  {
+    Order *buy = aggressor->getIsBuy() ? aggressor : resting;
+    Order *sell = aggressor->getIsBuy() ? resting : aggressor;
+    buy_user = buy->getUser();
+    buy_oid = buy->getUserOrderId();
+    sell_user = sell->getUser();
+    sell_oid = sell->getUserOrderId();
+    buy_list = buy->getUserList();
+    sell_list = sell->getUserList();
+  }
+};
+
+/** per symbol sizing for a book, typically loaded from symbol config
+
+    num_levels is the depth per side we expect to see and is reserved
+    up front, max_levels caps the total number of live levels across
+    both sides ( 0 for unlimited ) after which an order that needs a
+    new price is refused ( book_full, see reject.h ) rather than
+    rested.  level storage grows in chunks of
+    level_chunk levels ( 0 to size chunks off num_levels )
+
+    book_type selects which compiled specialization of BasicOrderBook
+    OrderManager instantiates for the symbol, see the typedefs below.
+    Fixed depth types ignore the sizing fields.
+*/
+struct BookConfig {
+  enum BookType {
+    eSTANDARD_BOOK = 0,
+    eTIGHT_BOOK = 1,
+    eDEEP_BOOK = 2,
+  };
+
+  int num_levels;
+  int max_levels;
+  int level_chunk;
+  BookType book_type;
+
+  BookConfig( int num_levels=16, int max_levels=0, int level_chunk=0, BookType book_type=eSTANDARD_BOOK )
+    : num_levels(num_levels)
+    , max_levels(max_levels)
+    , level_chunk(level_chunk)
+    , book_type(book_type)
+    {}
+};
 
-    OrderBook for extensibility would template on type T for the order
-    type which should be Order or Order dervived Type if we wanted
-    additional details or potentially more complciated architecture to
-    have a templated type for each level which was templated on the
-    order as well
+/** Models an OrderBook for a single symbol has a bid side and ask side
 
-    take parameter for number of levels to maintain assuming we are
-    operating for a reasonably tight book where N <= 16 or at worst
-    32.  If we wanted to support arbitrarilty large books I would
+    OrderBook is the interface OrderManager and Order hold on to, the
+    actual book is BasicOrderBook templated on a policy carrying the
+    price and quantity types, the ladder policy, the level queue
+    policy and a compile time maximum depth so that different symbol
+    classes can run different specializations in the same binary.
+
+    take a BookConfig for number of levels to maintain, the level
+    pool grows in chunks beyond that so a name that needs 8 levels
+    doesnt pay for 5,000 and one that needs 5,000 doesnt fall over at
+    33. The sorted ladders assume we are operating for a reasonably
+    tight book where N <= 16 or at worst 32.  If we wanted to support arbitrarilty large books I would
     switch implementation to a hybrid skip-list so that innermost
     levels were in a vector but skip list handled levels outside where
     usually little no to activity takes place.. at least once the book
@@ -84,12 +159,53 @@ class OrderManager; //fwd declare
 class OrderBook {
 public:
   static const int DEFAULT_NUM_LEVELS = 16;
-  OrderBook(const string& symbol, OrderManager *mgr=NULL, int num_levels=DEFAULT_NUM_LEVELS );
+  virtual ~OrderBook() {}
 
   /** Insert an Order and carry out approriate matching if need be*/
-  void addOrder(Order *o);
-  void cancelOrder(Order *o);
-  void flushOrders();
+  virtual void addOrder(Order *o) = 0;
+  virtual void cancelOrder(Order *o) = 0;
+  /** take qty off a resting order in place, it keeps its time priority */
+  virtual void reduceOrder(Order *o, int qty) = 0;
+  /** atomically move a resting order to a new price and qty, it loses
+      its time priority and may trade if the new price is marketable */
+  virtual void replaceOrder(Order *o, int price, int qty) = 0;
+  /** cancel every order on a list threaded through Order::userLinks,
+      publishing the resulting TOB changes once */
+  virtual void cancelOrders(Order *head) = 0;
+  virtual void flushOrders() = 0;
+
+  /** feed mode, see FeedHandler: the book mirrors someone else's
+      matching so these never match or retire anything
+
+      restOrder: put o on its side as is, even if that crosses the book
+      fillOrder: qty of resting o traded, returns true if that took all
+      of it and it has left the book ( the caller owns releasing it ) */
+  virtual void restOrder(Order *o) = 0;
+  virtual bool fillOrder(Order *o, int qty) = 0;
+
+  /** park a stop order until a trade reaches its stop price, one the
+      last trade already reached is handed straight back to the manager
+      to enter.  the other calls above take stops as well, a cancel,
+      reduce or replace of one that hasn't triggered never touches the
+      ladders */
+  virtual void addStop(Order *o) = 0;
+  virtual size_t getNumStops() const = 0;
+
+  /** call auction: from startAuction on nothing matches, limit orders
+      rest even if they cross, market orders queue per side ahead of
+      any price and no TOB is published.  uncross() then trades
+      everything that can at the one price executing the most volume,
+      publishes the fills as one batch and the TOB change since the
+      auction started once, kills whatever is left of the market
+      orders and goes back to continuous matching.  returns the qty
+      executed.  indicativeUncross is the price and qty uncross()
+      would execute right now, price 0 if nothing would trade */
+  virtual void startAuction() = 0;
+  virtual int64_t uncross() = 0;
+  virtual int64_t indicativeUncross(int& price) = 0;
+  bool inAuction() const { return auction; }
+  /** 0 before the first trade since the last flush */
+  int getLastTradePrice() const { return last_trade; }
 
   /** Note with more time i would maintain pointers to these that
       didnt require lookups and switches and which were not guaranteed
@@ -100,310 +216,717 @@ public:
       to 0 and then went negative!
    */
 
-  int getBestBidPrice();
-  int getBestBidQty();
-  Level* getBestBidLevel();
+  virtual int getBestBidPrice() = 0;
+  virtual int64_t getBestBidQty() = 0;
+
+  virtual int getBestOfferPrice() = 0;
+  virtual int64_t getBestOfferQty() = 0;
+
+  /** cumulative depth queries from the point of view of an aggressor,
+      ie isBuy asks about the offers.  all are O(log levels)
+
+      getDepthToPrice: qty resting at price or better, price 0 for the whole side
+      getCostToFill: notional to take qty from the top of book, -1 if there isn't qty
+      getVwapToQty: average price to take qty from the top of book, 0 if there isn't qty
+  */
+  virtual int64_t getDepthToPrice(bool isBuy, int price) = 0;
+  virtual int64_t getCostToFill(bool isBuy, int64_t qty) = 0;
+  virtual double getVwapToQty(bool isBuy, int64_t qty) = 0;
+
+  /** hint that o is about to be amended or cancelled, pull its level
+      and queue neighbours towards the cache */
+  virtual void prefetch(Order *o) = 0;
+
+  /* level storage introspection */
+  virtual size_t getLevelCapacity() const = 0;
+  virtual size_t getNumLevels() const = 0;
+
+  /** hash of what the book holds: every level's price, qty and order
+      count on both sides with its orders' users and ids in time
+      priority, the stops, the auction and the last trade.  O(orders),
+      for a replica to check it's still the same book, see replica.h */
+  virtual uint64_t checksum() = 0;
+
+  const string& getSymbol() const { return symbol; }
+
+  /** counters written only by the matching thread, safe to read from any */
+  const BookStats& getStats() const { return stats; }
+
+  /** off stops the book writing TOB lines, a mirrored book is read
+      through the getters instead */
+  void setPublishing(bool on) { publishing = on; }
+  bool getPublishing() const { return publishing; }
+  /** TOB changes are also pushed here, NULL for none */
+  void setOutputRing(OutputRing *ring) { out_ring = ring; }
+  /** and logged here, NULL for none */
+  void setEventLog(EventLog::Writer *log) { event_log = log; }
+  /** text goes through publisher instead of cout, NULL for cout, see publisher.h */
+  void setPublisher(Publisher *p) { publisher = p; }
+  /** the TOB held back while publisher was congested, if any, see
+      publisher.h.  false if it's still congested */
+  bool publishHeldTob();
+
+protected:
+  OrderBook(const string& symbol, OrderManager *mgr)
+    : symbol(symbol)
+    , mgr(mgr)
+    , publishing(true)
+    , out_ring(NULL)
+    , event_log(NULL)
+    , publisher(NULL)
+    , last_trade(0)
+    , auction(false)
+    {}
+
+  const string symbol;
+  OrderManager* mgr;
+  BookStats stats;
+  bool publishing;
+  OutputRing *out_ring;
+  EventLog::Writer *event_log;
+  Publisher *publisher;
+  int last_trade;
+  bool auction;
 
-  int getBestOfferPrice();
-  int getBestOfferQty();
-  Level* getBestOfferLevel();
+  /** side's latest TOB to publisher, or held while it's congested */
+  void publishTob(char side, int price, int64_t quantity);
 
 private:
-  const string& symbol;
-  const int num_levels;
-  using sorted_levels_t = vector<PriceLevel>;
-  sorted_levels_t asks; //keep sorted
-  sorted_levels_t bids; //keep sorted
-  pool<Level, level_id_t, DEFAULT_NUM_LEVELS * 2> all_levels; //single allocation
-  OrderManager* mgr;
+  struct HeldTob {
+    bool held;
+    int price;
+    int64_t qty;
+  };
+  HeldTob held_tob[2] = {}; // bid, offer
+};
+
+/** Bundles the compile time choices for a BasicOrderBook
+
+    Price and Qty are the book's internal representation ( Qty being
+    what levels aggregate into ), Ladder is one of the ladder policies
+    from ladder.h, Queue one of the level queue policies from level.h
+    and MaxDepth the compile time depth per side, 0 for unbounded.
+*/
+template <typename Price, typename Qty,
+          template <typename, class, size_t> class Ladder,
+          class Queue, size_t MaxDepth>
+struct BookPolicy {
+  using price_t = Price;
+  using qty_t = Qty;
+  using queue_t = Queue;
+  static constexpr size_t max_depth = MaxDepth;
+  template <class Better> using ladder_t = Ladder<Price, Better, MaxDepth>;
+};
+
+template <class Policy>
+class BasicOrderBook final : public OrderBook {
+public:
+  using price_t = typename Policy::price_t;
+  using qty_t = typename Policy::qty_t;
+  using level_t = BasicLevel<price_t, qty_t, typename Policy::queue_t>;
+  using bid_ladder_t = IndexedLadder< typename Policy::template ladder_t< std::greater<price_t> >,
+                                      price_t, qty_t, std::greater<price_t> >;
+  using ask_ladder_t = IndexedLadder< typename Policy::template ladder_t< std::less<price_t> >,
+                                      price_t, qty_t, std::less<price_t> >;
+  using level_pool_t = pool<level_t, level_id_t>;
+
+  /** mem places the level storage, see placement.h */
+  BasicOrderBook(const string& symbol, OrderManager *mgr=NULL, const BookConfig& config=BookConfig(DEFAULT_NUM_LEVELS),
+                 const MemConfig& mem=MemConfig() );
+
+  void addOrder(Order *o) override;
+  void cancelOrder(Order *o) override;
+  void reduceOrder(Order *o, int qty) override;
+  void replaceOrder(Order *o, int price, int qty) override;
+  void cancelOrders(Order *head) override;
+  void flushOrders() override;
+  void restOrder(Order *o) override;
+  bool fillOrder(Order *o, int qty) override;
+  void addStop(Order *o) override;
+  size_t getNumStops() const override { return buy_stops.size() + sell_stops.size(); }
+  void startAuction() override;
+  int64_t uncross() override;
+  int64_t indicativeUncross(int& price) override;
+
+  int getBestBidPrice() override;
+  int64_t getBestBidQty() override;
+  level_t* getBestBidLevel();
+
+  int getBestOfferPrice() override;
+  int64_t getBestOfferQty() override;
+  level_t* getBestOfferLevel();
+
+  int64_t getDepthToPrice(bool isBuy, int price) override;
+  int64_t getCostToFill(bool isBuy, int64_t qty) override;
+  double getVwapToQty(bool isBuy, int64_t qty) override;
+
+  void prefetch(Order *o) override;
+
+  size_t getLevelCapacity() const override { return all_levels.capacity(); }
+  size_t getNumLevels() const override { return all_levels.size(); }
+  uint64_t checksum() override;
 
-  void executeOrder( Order *o );
-  void executeMarketBuy( Order *o);
-  void executeMarketSell( Order *o);
-  void executeBuy( Order *o);
-  void executeSell( Order *o);
-  void insertOrder( Order *o, bool isTob );
-  void deleteLevel( Order *o );
+private:
+  const int num_levels;
+  ask_ladder_t asks; //keep sorted, best last
+  bid_ladder_t bids; //keep sorted, best last
+  level_pool_t all_levels; //chunked, handles and addresses are stable
+
+  static size_t levelCapacity(const BookConfig& config);
+  static size_t levelMax(const BookConfig& config);
+
+  vector<Fill> fills; //scratch for batching a sweep's trades
+
+  TriggerIndex< std::greater<int> > buy_stops;
+  TriggerIndex< std::less<int> > sell_stops;
+  void cancelStop(Order *o);
+  void triggerStops(int low, int high);
+
+  // market orders waiting for the uncross, in time order
+  level_t auction_bids;
+  level_t auction_asks;
+  void auctionAdd(Order *o);
+  void auctionRemove(Order *o);
+  template <class Side> Order* auctionFront( Side& side, level_t& market );
+  template <class Side> void auctionFill( Side& side, level_t& market, Order *o, int qty );
+  void auctionKill( level_t& market );
+  template <class Side> uint64_t checksumSide( uint64_t h, Side& side );
+
+  template <class Own, class Opp> void addOrder( Own& own, Opp& opp, Order *o );
+  template <class Side> bool isMarketable( Side& opp, Order *o ) const;
+  template <class Side> int64_t depthToPrice( Side& opp, int price ) const;
+  template <class Own, class Opp> void executeOrder( Own& own, Opp& opp, Order *o );
+  template <class Own, class Opp> void matchOrder( Own& own, Opp& opp, Order *o );
+  template <class Own, class Opp> void replaceOrder( Own& own, Opp& opp, Order *o, int price, int qty );
+  template <class Side> void sweep( Side& opp, Order *o );
+  template <class Side> bool insertOrder( Side& side, Order *o );
+  template <class Side> bool placeOrder( Side& side, Order *o );
+  template <class Side> bool removeOrder( Side& side, Order *o );
+  template <class Side> void reduceOrder( Side& side, Order *o, int qty );
+
+  /** top of book on both sides so a multi step operation can publish
+      only what actually changed once it's done */
+  struct TobState {
+    int bidP;
+    int64_t bidQ;
+    int askP;
+    int64_t askQ;
+  };
+  TobState getTob();
+  void publishTobChanges(const TobState& pre);
   void tobChange(Order *o);
-  void tobChange(char side, int price, int quantity);
+  void tobChange(char side, int price, int64_t quantity);
+  TobState auction_pre; // what was last published before the auction
 
 };
 
-inline OrderBook::OrderBook(const string& symbol, OrderManager *mgr, int num_levels)
-  : symbol(symbol)
-  , num_levels(num_levels)
-  , mgr(mgr)
+/** the standard book, int prices and quantities on growable vector ladders */
+using StandardBook = BookPolicy<int, int, VectorLadder, IntrusiveQueue, 0>;
+using StandardOrderBook = BasicOrderBook<StandardBook>;
+
+/** tight known depth instruments ( eg futures ), 16 levels per side inline */
+using TightBook = BookPolicy<int, int, ArrayLadder, IntrusiveQueue, 16>;
+using TightOrderBook = BasicOrderBook<TightBook>;
+
+/** deep books with lots of far away resting size ( eg crypto ), wide aggregates */
+using DeepBook = BookPolicy<int, int64_t, VectorLadder, IntrusiveQueue, 0>;
+using DeepOrderBook = BasicOrderBook<DeepBook>;
+
+template <class Policy>
+inline size_t BasicOrderBook<Policy>::levelCapacity(const BookConfig& config) {
+  return Policy::max_depth ? Policy::max_depth * 2 : config.num_levels * 2;
+}
+
+template <class Policy>
+inline size_t BasicOrderBook<Policy>::levelMax(const BookConfig& config) {
+  if ( Policy::max_depth ) {
+    return Policy::max_depth * 2;
+  }
+  return config.max_levels > 0 ? config.max_levels : level_pool_t::UNLIMITED;
+}
+
+template <class Policy>
+inline BasicOrderBook<Policy>::BasicOrderBook(const string& symbol, OrderManager *mgr, const BookConfig& config,
+                                              const MemConfig& mem)
+  : OrderBook(symbol, mgr)
+  , num_levels( Policy::max_depth ? Policy::max_depth : config.num_levels )
+  , all_levels( levelCapacity(config), levelMax(config), Policy::max_depth ? 0 : config.level_chunk, mem )
 {
+  fills.reserve(64);
   flushOrders();
 }
 
-inline int OrderBook::getBestBidPrice() {
+template <class Policy>
+inline int BasicOrderBook<Policy>::getBestBidPrice() {
   if ( !bids.empty() ) {
-    return bids.back().l_price;
+    return bids.best().l_price;
   }
   else {
     return 0;
   }
 }
 
-inline Level* OrderBook::getBestBidLevel() {
+template <class Policy>
+inline typename BasicOrderBook<Policy>::level_t* BasicOrderBook<Policy>::getBestBidLevel() {
   if ( !bids.empty() ) {
-    return &all_levels[bids.back().l_ptr];
+    return &all_levels[bids.best().l_ptr];
   } else {
     return NULL;
   }
 }
 
-inline int OrderBook::getBestBidQty() {
+template <class Policy>
+inline int64_t BasicOrderBook<Policy>::getBestBidQty() {
   if ( !bids.empty() ) {
-    return all_levels[bids.back().l_ptr].getQty();
+    return all_levels[bids.best().l_ptr].getQty();
   } else {
     return 0;
   }
 }
 
-inline int OrderBook::getBestOfferPrice() {
+template <class Policy>
+inline int BasicOrderBook<Policy>::getBestOfferPrice() {
   if ( !asks.empty() ) {
-    return asks.front().l_price;
+    return asks.best().l_price;
   }
   else {
     return 0;
   }
 }
 
-inline Level* OrderBook::getBestOfferLevel() {
-  if ( !bids.empty() ) {
-    return &all_levels[asks.front().l_ptr];
+template <class Policy>
+inline typename BasicOrderBook<Policy>::level_t* BasicOrderBook<Policy>::getBestOfferLevel() {
+  if ( !asks.empty() ) {
+    return &all_levels[asks.best().l_ptr];
   } else {
     return NULL;
   }
 }
 
-inline int OrderBook::getBestOfferQty() {
+template <class Policy>
+inline int64_t BasicOrderBook<Policy>::getBestOfferQty() {
   if ( !asks.empty() ) {
-    return all_levels[asks.front().l_ptr].getQty();
+    return all_levels[asks.best().l_ptr].getQty();
   } else {
     return 0;
   }
 }
 
-inline void OrderBook::flushOrders() {
+/** O(1) per book, the levels are only forgotten here and are reset
+    as they get reused, the orders are the OrderManager's to release */
+template <class Policy>
+inline void BasicOrderBook<Policy>::flushOrders() {
   asks.clear();
   bids.clear();
   all_levels.clear();
+  buy_stops.clear();
+  sell_stops.clear();
+  auction_bids.flushOrders();
+  auction_asks.flushOrders();
+  auction = false;
+  last_trade = 0;
+  stats.live_orders.set(0);
+  stats.live_levels.set(0);
+  stats.live_stops.set(0);
+  stats.level_bytes.set( all_levels.capacity() * sizeof(level_t) );
 
   //reset
   asks.reserve(num_levels);
   bids.reserve(num_levels);
 }
 
-void OrderBook::addOrder(Order *o) {
-  if ( o->getIsBuy() ) {
-    // buy/bid
-    if ( o->getPrice() == 0 ) {
-      if ( getBestOfferPrice() != 0 ) {
-        executeOrder(o);
-        tobChange('S', getBestOfferPrice(), getBestOfferQty() );
-      } else {
-        // @TODO can't execute report no trade?
-      }
-    }
-    else {
-      if ( !bids.empty() ) {
-        if ( o->getPrice() > getBestBidPrice() ) {
-          if ( getBestOfferPrice() != 0 && o->getPrice() >= getBestOfferPrice() ) {
-            int preBidP = getBestBidPrice();
-            int preBidQ = getBestBidQty();
-            int preAskP = getBestOfferPrice();
-            int preAskQ = getBestOfferQty();
-
-            executeOrder(o);
-
-            int postBidP = getBestBidPrice();
-            int postBidQ = getBestBidQty();
-            int postAskP = getBestOfferPrice();
-            int postAskQ = getBestOfferQty();
-
-            if ( preBidP != postBidP || preBidQ != postBidQ ) {
-              tobChange('B', postBidP, postBidQ);
-            }
-            if ( preAskP != postAskP || preAskQ != postAskQ ) {
-              tobChange('S', postAskP, postAskQ);
-            }
-
-          } else {
-            insertOrder(o, true);
-          }
-
-        } else if ( o->getPrice() == getBestBidPrice() ) {
-          getBestBidLevel()->addOrder(o);
-          tobChange(o);
-        } else {
-          insertOrder(o, false);
-        }
-      }
-      else {
-        insertOrder(o, true);
-      }
-    }
+template <class Policy>
+void BasicOrderBook<Policy>::addOrder(Order *o) {
+  stats.orders_added.add();
+  if ( auction ) {
+    auctionAdd(o);
+  } else if ( o->getIsBuy() ) {
+    addOrder(bids, asks, o);
+  } else {
+    addOrder(asks, bids, o);
   }
-  else {
-    //its a sell/ask
-    if ( o->getPrice() == 0 ) {
-      if ( getBestBidPrice() != 0 ) {
-        executeOrder(o);
-        tobChange('B', getBestBidPrice(), getBestBidQty() );
-      } else {
-        //@TODO  can't execute report no trade?
-      }
-    }
-    else {
-      if ( ! asks.empty() ) {
-        if ( o->getPrice() < getBestOfferPrice() ) {
-          if ( getBestBidPrice() != 0 && o->getPrice() <= getBestBidPrice() ) {
-            int preBidP = getBestBidPrice();
-            int preBidQ = getBestBidQty();
-            int preAskP = getBestOfferPrice();
-            int preAskQ = getBestOfferQty();
-
-            executeOrder(o);
-
-            int postBidP = getBestBidPrice();
-            int postBidQ = getBestBidQty();
-            int postAskP = getBestOfferPrice();
-            int postAskQ = getBestOfferQty();
-
-            if ( preBidP != postBidP || preBidQ != postBidQ ) {
-              tobChange('B', postBidP, postBidQ);
-            }
-            if ( preAskP != postAskP || preAskQ != postAskQ ) {
-              tobChange('S', postAskP, postAskQ);
-            }
-
-          } else {
-            insertOrder(o, true);
-          }
-        } else if ( o->getPrice() == getBestOfferPrice() ) {
-          getBestOfferLevel()->addOrder(o);
-          tobChange(o);
-        } else {
-          insertOrder(o, false);
-        }
-      }
-      else {
-        insertOrder(o, true);
-      }
-    }
+}
+
+/** resting orders are inserted directly, marketable ones and those
+    with a minimum qty go through the sweep which publishes the TOB
+    changes it caused once at the end */
+template <class Policy>
+template <class Own, class Opp>
+inline void BasicOrderBook<Policy>::addOrder(Own& own, Opp& opp, Order *o) {
+  if ( o->getMinQty() > 0 || isMarketable(opp, o) ) {
+    executeOrder(own, opp, o);
+  } else if ( placeOrder(own, o) ) {
+    tobChange(o);
+  }
+}
+
+/** market orders always go to the sweep, even against an empty side,
+    limits only if they reach the opposite best */
+template <class Policy>
+template <class Side>
+inline bool BasicOrderBook<Policy>::isMarketable(Side& opp, Order *o) const {
+  if ( o->getPrice() == 0 ) {
+    return true;
   }
+  return !opp.empty() && !opp.isBetter( o->getPrice(), opp.best().l_price );
 }
 
-inline void OrderBook::insertOrder(Order *order, bool tob) {
-  sorted_levels_t *sorted_levels = order->getIsBuy() ? &bids : &asks;
+template <class Policy>
+template <class Side>
+inline int64_t BasicOrderBook<Policy>::depthToPrice(Side& opp, int price) const {
+  return price == 0 ? opp.index().total() : opp.index().depthTo(price);
+}
 
-  //Search descending since best prices are at top
-  auto it = sorted_levels->end();
-  bool found = false;
-  while ( it-- != sorted_levels->begin() )
-  {
-    PriceLevel &cur_lvl = *it;
-    if ( cur_lvl.l_price == order->getPrice() ) {
-      order->setLevelId( cur_lvl.l_ptr );
-      found = true;
-      break;
-    } else if ( order->getPrice() > cur_lvl.l_price ) {
-      // it will be -1 if price < all prices
-      break;
-    }
+template <class Policy>
+inline int64_t BasicOrderBook<Policy>::getDepthToPrice(bool isBuy, int price) {
+  return isBuy ? depthToPrice(asks, price) : depthToPrice(bids, price);
+}
+
+template <class Policy>
+inline int64_t BasicOrderBook<Policy>::getCostToFill(bool isBuy, int64_t qty) {
+  int64_t notional;
+  bool ok = isBuy ? asks.index().costToFill(qty, notional) : bids.index().costToFill(qty, notional);
+  return ok ? notional : -1;
+}
+
+template <class Policy>
+inline double BasicOrderBook<Policy>::getVwapToQty(bool isBuy, int64_t qty) {
+  return isBuy ? asks.index().vwapToQty(qty) : bids.index().vwapToQty(qty);
+}
+
+template <class Policy>
+inline void BasicOrderBook<Policy>::prefetch(Order *o) {
+  if ( o->getStopPrice() || o->getPrice() == 0 ) {
+    return; // not on a level
   }
-  if ( !found ) {
+  __builtin_prefetch( &all_levels[o->getLevelId()], 1 );
+  const Order::Links& l = o->queueLinks();
+  if ( l.prev ) {
+    __builtin_prefetch( l.prev, 1 );
+  }
+  if ( l.next ) {
+    __builtin_prefetch( l.next, 1 );
+  }
+}
+
+/** returns true if the order landed on the top of book, throws
+    std::bad_alloc with the book unchanged if there's no level for it */
+template <class Policy>
+template <class Side>
+inline bool BasicOrderBook<Policy>::insertOrder(Side& side, Order *order) {
+  //Search descending since best prices are at top
+  size_t pos = side.search( order->getPrice() );
+  bool tob = ( pos == side.size() );
+  if ( pos > 0 && side.slot(pos-1).l_price == order->getPrice() ) {
+    order->setLevelId( side.slot(pos-1).l_ptr );
+    --pos;
+  } else {
     level_id_t lvl_id = all_levels.alloc();
     order->setLevelId(lvl_id);
-    Level& lvl = all_levels[lvl_id];
+    level_t& lvl = all_levels[lvl_id];
+    lvl.flushOrders(); // may be left over from before a flush
     lvl.setPrice( order->getPrice() );
-    lvl.setQty( 0 );
     lvl.setValid( true );
-    PriceLevel const px(order->getPrice(), lvl_id);
-    ++it;
-    sorted_levels->insert(it, px);
+    size_t shifted = side.size() - pos;
+    try {
+      side.insertAt( pos, PriceLevel<price_t>(order->getPrice(), lvl_id) );
+    } catch ( ... ) {
+      all_levels.free(lvl_id);
+      throw;
+    }
+    stats.levels_created.add();
+    stats.level_shifts.add(shifted);
+    stats.live_levels.add();
+    stats.level_bytes.set( all_levels.capacity() * sizeof(level_t) );
   }
   all_levels[order->getLevelId()].addOrder(order);
+  side.addQty( pos, order->getQty() );
+  stats.live_orders.add();
 
-  if (tob) {
+  return tob;
+}
+
+template <class Policy>
+inline void BasicOrderBook<Policy>::cancelOrder(Order *order) {
+  stats.orders_cancelled.add();
+  if ( order->getStopPrice() ) {
+    cancelStop(order);
+    return;
+  }
+  if ( auction ) {
+    auctionRemove(order);
+    return;
+  }
+  bool tob = order->getIsBuy() ? removeOrder(bids, order) : removeOrder(asks, order);
+  if ( tob ) {
     tobChange(order);
   }
+}
 
+template <class Policy>
+inline void BasicOrderBook<Policy>::cancelOrders(Order *head) {
+  TobState pre = getTob();
+  for ( Order *o = head; o; o = o->userLinks().next ) {
+    stats.orders_cancelled.add();
+    if ( o->getStopPrice() ) {
+      cancelStop(o);
+    } else if ( auction ) {
+      auctionRemove(o);
+    } else if ( o->getIsBuy() ) {
+      removeOrder(bids, o);
+    } else {
+      removeOrder(asks, o);
+    }
+  }
+  publishTobChanges(pre);
 }
 
-inline void OrderBook::cancelOrder(Order *order) {
-  auto lvl_id = order->getLevelId();
-  all_levels[lvl_id].cancelOrder(order); //removes order from list and qty
-  if ( all_levels[lvl_id].getQty() == 0 ) {
-    deleteLevel(order);
+/** unlink a resting order from its level and the depth index, freeing
+    the level if it empties.  returns true if it was on the top of book */
+template <class Policy>
+template <class Side>
+inline bool BasicOrderBook<Policy>::removeOrder(Side& side, Order *order) {
+  size_t pos = side.search( order->getPrice() ) - 1;
+  level_id_t lvl_id = order->getLevelId();
+  level_t& lvl = all_levels[lvl_id];
+  bool tob = ( pos == side.size() - 1 );
+
+  stats.cancel_scans.add( lvl.cancelOrder(order) ); //removes order from list and qty
+  stats.live_orders.sub();
+  if ( lvl.empty() ) {
+    side.eraseAt(pos);
+    all_levels.free(lvl_id);
+    stats.levels_destroyed.add();
+    stats.level_shifts.add( side.size() - pos );
+    stats.live_levels.sub();
+  } else {
+    side.addQty( pos, -order->getQty() );
   }
+  return tob;
 }
 
-//also can be called into by execute
-inline void OrderBook::deleteLevel( Order *o ) {
-  bool changeTOB = false;
-  level_id_t lvl_id = o->getLevelId();
-  int price = o->getPrice();
-  sorted_levels_t *sorted_levels = NULL;
+template <class Policy>
+inline void BasicOrderBook<Policy>::restOrder(Order *order) {
+  stats.orders_added.add();
+  bool tob = order->getIsBuy() ? insertOrder(bids, order) : insertOrder(asks, order);
+  if ( tob ) {
+    tobChange(order);
+  }
+}
 
-  if ( o->getIsBuy() ) {
-    sorted_levels = &bids;
-    if ( o->getPrice() == getBestBidPrice() ) {
-      changeTOB = true;
-    }
+template <class Policy>
+template <class Side>
+inline uint64_t BasicOrderBook<Policy>::checksumSide( uint64_t h, Side& side ) {
+  h = hashMix( h, side.size() );
+  for ( size_t i = 0; i < side.size(); ++i ) {
+    const level_t& lvl = all_levels[ side.slot(i).l_ptr ];
+    h = hashMix( h, uint64_t( side.slot(i).l_price ) );
+    h = hashMix( h, uint64_t( lvl.getQty() ) );
+    h = hashMix( h, uint64_t( lvl.getNumOrders() ) );
+    lvl.forEachOrder( [&h]( const Order *o ) {
+      h = hashMix( h, uint64_t( uint32_t( o->getUser() ) ) << 32 | uint32_t( o->getUserOrderId() ) );
+    });
+  }
+  return h;
+}
+
+template <class Policy>
+inline uint64_t BasicOrderBook<Policy>::checksum() {
+  uint64_t h = checksumSide( hashMix( 0, 'B' ), bids );
+  h = checksumSide( hashMix( h, 'S' ), asks );
+  h = hashMix( h, uint64_t( auction_bids.getQty() ) );
+  h = hashMix( h, uint64_t( auction_asks.getQty() ) );
+  h = hashMix( h, buy_stops.size() );
+  h = hashMix( h, sell_stops.size() );
+  h = hashMix( h, uint64_t( last_trade ) );
+  return hashMix( h, auction );
+}
+
+template <class Policy>
+inline void BasicOrderBook<Policy>::startAuction() {
+  if ( !auction ) {
+    auction_pre = getTob();
+    auction = true;
+  }
+}
+
+/** nothing matches: a limit rests where it is even through the other
+    side, a market order joins its side's queue.  a minimum qty only
+    means anything against a standing book so it's dropped */
+template <class Policy>
+inline void BasicOrderBook<Policy>::auctionAdd(Order *order) {
+  order->setMinQty(0);
+  if ( order->getPrice() == 0 ) {
+    ( order->getIsBuy() ? auction_bids : auction_asks ).addOrder(order);
+    order->setLevelId( level_id_t(0) );
+    stats.live_orders.add();
+  } else if ( order->getIsBuy() ) {
+    placeOrder(bids, order);
   } else {
-    sorted_levels = &asks;
-    if ( o->getPrice() == getBestOfferPrice() ) {
-      changeTOB = true;
-    }
+    placeOrder(asks, order);
+  }
+}
+
+template <class Policy>
+inline void BasicOrderBook<Policy>::auctionRemove(Order *order) {
+  if ( order->getPrice() == 0 ) {
+    ( order->getIsBuy() ? auction_bids : auction_asks ).cancelOrder(order);
+    stats.live_orders.sub();
+  } else if ( order->getIsBuy() ) {
+    removeOrder(bids, order);
+  } else {
+    removeOrder(asks, order);
   }
+}
 
-  auto it = sorted_levels->end();
-  while ( it-- != sorted_levels->begin() ) {
-    if ( it->l_price == price ) {
-      sorted_levels->erase(it);
-      break;
+/** O(levels): one pass up the merged prices of both ladders carrying
+    the cumulative supply ( market asks plus asks at or under p ) and
+    demand ( market bids plus bids at or over p ).  the most volume
+    wins, then the smallest imbalance, then the price nearest the last
+    trade, then the lowest */
+template <class Policy>
+inline int64_t BasicOrderBook<Policy>::indicativeUncross(int& price) {
+  const int NONE = std::numeric_limits<int>::max();
+  int64_t demand_total = auction_bids.getQty();
+  for ( size_t i = 0; i < bids.size(); ++i ) {
+    demand_total += all_levels[bids.slot(i).l_ptr].getQty();
+  }
+  int64_t below = 0;  // bid qty under the candidate price
+  int64_t supply = auction_asks.getQty();
+  size_t i = 0;             // bids are stored lowest first
+  size_t j = asks.size();   // asks highest first so walk them backwards
+  int64_t best = 0;
+  int64_t best_imbalance = 0;
+  price = 0;
+  while ( i < bids.size() || j > 0 ) {
+    int p = std::min( i < bids.size() ? int(bids.slot(i).l_price) : NONE,
+                      j > 0 ? int(asks.slot(j - 1).l_price) : NONE );
+    while ( j > 0 && asks.slot(j - 1).l_price <= p ) {
+      supply += all_levels[asks.slot(j - 1).l_ptr].getQty();
+      --j;
+    }
+    int64_t demand = demand_total - below;
+    int64_t vol = std::min(demand, supply);
+    int64_t imbalance = demand > supply ? demand - supply : supply - demand;
+    if ( vol > 0 && ( vol > best || ( vol == best && ( imbalance < best_imbalance ||
+         ( imbalance == best_imbalance && last_trade &&
+           std::abs(int64_t(p) - last_trade) < std::abs(int64_t(price) - last_trade) ) ) ) ) ) {
+      best = vol;
+      best_imbalance = imbalance;
+      price = p;
+    }
+    while ( i < bids.size() && bids.slot(i).l_price <= p ) {
+      below += all_levels[bids.slot(i).l_ptr].getQty();
+      ++i;
     }
   }
-  all_levels.free(lvl_id);
+  if ( best == 0 && last_trade && auction_bids.getQty() && auction_asks.getQty() ) {
+    // nothing but market orders, they meet at the last trade
+    price = last_trade;
+    best = std::min<int64_t>( auction_bids.getQty(), auction_asks.getQty() );
+  }
+  return best;
+}
 
-  if ( changeTOB ) {
-    tobChange(o);
+template <class Policy>
+inline void BasicOrderBook<Policy>::cancelStop(Order *order) {
+  if ( order->getIsBuy() ? buy_stops.erase(order) : sell_stops.erase(order) ) {
+    stats.live_stops.sub();
   }
 }
 
-inline void OrderBook::tobChange(Order *o) {
-  int price;
-  int quantity;
-  string p_s;
-  string q_s;
-  char side;
+/** a partial fill takes qty off in place like a reduce, the order
+    keeps its time priority */
+template <class Policy>
+inline bool BasicOrderBook<Policy>::fillOrder(Order *order, int qty) {
+  stats.trades.add();
+  if ( qty < order->getQty() ) {
+    reduceOrder(order, qty);
+    return false;
+  }
+  bool tob = order->getIsBuy() ? removeOrder(bids, order) : removeOrder(asks, order);
+  if ( tob ) {
+    tobChange(order);
+  }
+  return true;
+}
 
-  if ( o->getIsBuy() ) {
-    price = getBestBidPrice();
-    quantity = getBestBidQty();
-    side = 'B';
+template <class Policy>
+inline void BasicOrderBook<Policy>::reduceOrder(Order *order, int qty) {
+  if ( order->getStopPrice() ) {
+    order->setQty( order->getQty() - qty );
+  } else if ( order->getPrice() == 0 ) {
+    ( order->getIsBuy() ? auction_bids : auction_asks ).reduceOrder(order, qty);
+  } else if ( order->getIsBuy() ) {
+    reduceOrder(bids, order, qty);
   } else {
-    price = getBestOfferPrice();
-    quantity = getBestOfferQty();
-    side = 'S';
+    reduceOrder(asks, order, qty);
   }
+}
 
-  if ( price != 0 && quantity != 0 ) {
-    p_s = std::to_string(price);
-    q_s = std::to_string(quantity);
-  } else {
-    p_s = "-";
-    q_s = "-";
+template <class Policy>
+template <class Side>
+inline void BasicOrderBook<Policy>::reduceOrder(Side& side, Order *order, int qty) {
+  size_t pos = side.search( order->getPrice() ) - 1;
+  all_levels[order->getLevelId()].reduceOrder(order, qty);
+  side.addQty( pos, -qty );
+  if ( pos == side.size() - 1 ) {
+    tobChange(order);
+  }
+}
+
+template <class Policy>
+inline typename BasicOrderBook<Policy>::TobState BasicOrderBook<Policy>::getTob() {
+  TobState t;
+  t.bidP = getBestBidPrice();
+  t.bidQ = getBestBidQty();
+  t.askP = getBestOfferPrice();
+  t.askQ = getBestOfferQty();
+  return t;
+}
+
+template <class Policy>
+inline void BasicOrderBook<Policy>::publishTobChanges(const TobState& pre) {
+  if ( !publishing || auction ) {
+    return;
   }
+  TobState post = getTob();
+  if ( pre.bidP != post.bidP || pre.bidQ != post.bidQ ) {
+    tobChange('B', post.bidP, post.bidQ);
+  }
+  if ( pre.askP != post.askP || pre.askQ != post.askQ ) {
+    tobChange('S', post.askP, post.askQ);
+  }
+}
 
-  cout << "B," << side << "," << p_s << "," << q_s << endl;
+template <class Policy>
+inline void BasicOrderBook<Policy>::tobChange(Order *o) {
+  if ( !publishing || auction ) {
+    return;
+  }
+  if ( o->getIsBuy() ) {
+    tobChange( 'B', getBestBidPrice(), getBestBidQty() );
+  } else {
+    tobChange( 'S', getBestOfferPrice(), getBestOfferQty() );
+  }
 }
 
-inline void OrderBook::tobChange(char side, int price, int quantity) {
+template <class Policy>
+inline void BasicOrderBook<Policy>::tobChange(char side, int price, int64_t quantity) {
+  if ( !publishing || auction ) {
+    return;
+  }
+  LAT_PUBLISH_SCOPE();
+  if ( out_ring ) {
+    out_ring->push( OutputRecord::tob(symbol, side, price, quantity) );
+  }
+  if ( event_log ) {
+    event_log->tob( EventLog::now(), symbol, side, price, quantity );
+  }
+  if ( publisher ) {
+    publishTob( side, price, quantity );
+    return;
+  }
   string p_s;
   string q_s;
   if ( price != 0 && quantity != 0 ) {
@@ -413,7 +936,7 @@ inline void OrderBook::tobChange(char side, int price, int quantity) {
     p_s = "-";
     q_s = "-";
   }
-  cout << "B," << side << "," << p_s << "," << q_s << endl;
+  cout << "B," << side << "," << p_s << "," << q_s << "\n";
 }
 
 #endif
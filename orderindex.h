@@ -0,0 +1,162 @@
+#ifndef ORDERINDEX_H
+#define ORDERINDEX_H
+
+#include <cstdint>
+#include <vector>
+
+#include "order.h"
+
+using std::vector;
+
+/** Open addressing hash of order key to live Order with O(1) clear
+
+    linear probing over a power of two table with Fibonacci hashing,
+    deletes use backward shifting so there are no tombstones.
+
+    every slot is stamped with the generation it was written in and
+    a slot from any other generation is treated as empty on sight, so
+    clear() is just bumping the generation no matter how many orders
+    were live.  The table keeps its size across clears which is what
+    we want between sessions of similar size anyway.
+
+    key 0 is fine, emptiness is only ever decided by the generation
+*/
+class OrderIndex {
+public:
+  explicit OrderIndex( size_t capacity=1024 )
+    : generation(1)
+    , count(0)
+  {
+    size_t cap = 16;
+    while ( cap < capacity * 2 ) {
+      cap <<= 1;
+    }
+    resize(cap);
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  size_t bytes() const { return slots.capacity() * sizeof(Slot); }
+
+  Order* find( uint64_t key ) const {
+    for ( size_t i = home(key); ; i = (i + 1) & mask ) {
+      const Slot& s = slots[i];
+      if ( s.gen != generation ) {
+        return NULL;
+      }
+      if ( s.key == key ) {
+        return s.order;
+      }
+    }
+  }
+
+  /** insert or overwrite */
+  void insert( uint64_t key, Order *o ) {
+    if ( (count + 1) * 2 > slots.size() ) {
+      resize( slots.size() * 2 );
+    }
+    for ( size_t i = home(key); ; i = (i + 1) & mask ) {
+      Slot& s = slots[i];
+      if ( s.gen != generation ) {
+        s.key = key;
+        s.order = o;
+        s.gen = generation;
+        ++count;
+        return;
+      }
+      if ( s.key == key ) {
+        s.order = o;
+        return;
+      }
+    }
+  }
+
+  bool erase( uint64_t key ) {
+    size_t i = home(key);
+    for ( ; ; i = (i + 1) & mask ) {
+      const Slot& s = slots[i];
+      if ( s.gen != generation ) {
+        return false;
+      }
+      if ( s.key == key ) {
+        break;
+      }
+    }
+    // shift back any entry in the run after i that may sit in i
+    for ( size_t j = (i + 1) & mask; slots[j].gen == generation; j = (j + 1) & mask ) {
+      size_t h = home(slots[j].key);
+      bool stays = ( i <= j ) ? ( i < h && h <= j ) : ( i < h || h <= j );
+      if ( !stays ) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i].gen = 0;
+    --count;
+    return true;
+  }
+
+  /** forget every entry in O(1) */
+  void clear() {
+    count = 0;
+    if ( ++generation == 0 ) {
+      // wrapped, really wipe once every 4 billion clears
+      for ( Slot& s : slots ) {
+        s.gen = 0;
+      }
+      generation = 1;
+    }
+  }
+
+  /** address of the key's home slot so a caller can prefetch it */
+  const void* homeSlot( uint64_t key ) const { return &slots[home(key)]; }
+
+  /** visit every live order */
+  template <class F>
+  void forEach( F f ) const {
+    for ( const Slot& s : slots ) {
+      if ( s.gen == generation ) {
+        f( s.key, s.order );
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t key;
+    Order *order;
+    uint32_t gen;
+  };
+
+  size_t home( uint64_t key ) const {
+    return size_t( (key * 0x9E3779B97F4A7C15ULL) >> shift );
+  }
+
+  void resize( size_t cap ) {
+    vector<Slot> old;
+    old.swap(slots);
+    slots.assign( cap, Slot{0, NULL, 0} );
+    mask = cap - 1;
+    shift = 64;
+    while ( cap > 1 ) {
+      cap >>= 1;
+      --shift;
+    }
+    uint32_t old_gen = generation;
+    generation = 1;
+    count = 0;
+    for ( const Slot& s : old ) {
+      if ( s.gen == old_gen ) {
+        insert( s.key, s.order );
+      }
+    }
+  }
+
+  vector<Slot> slots;
+  size_t mask;
+  unsigned shift;
+  uint32_t generation;
+  size_t count;
+};
+
+#endif
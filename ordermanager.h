@@ -1,246 +1,1245 @@
 #ifndef ORDERMANAGER_H
 #define ORDERMANAGER_H
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 using std::string;
 using std::unordered_map;
+using std::vector;
 using std::cout;
 using std::endl;
 
 #include "orderbook.h"
+#include "orderindex.h"
+#include "pool.h"
+#include "reject.h"
+#include "risk.h"
+#include "stats.h"
+
+/** a user's live orders in one book, threaded through Order::userLinks
+    so that they can all be pulled without touching anyone else's.
+    also where the user's risk counters for the symbol are kept */
+struct UserOrderList {
+  Order *head;
+  int count;
+  uint32_t epoch; // a list from an older epoch is empty
+  int64_t position;  // bought less sold
+  int64_t open_buy;  // qty still open on the user's live orders
+  int64_t open_sell;
+  UserRisk *risk;    // the user's counters over every symbol
+};
+
+/** everything the manager keeps per user */
+struct UserOrders {
+  unordered_map<OrderBook*, UserOrderList> books;
+  UserRisk risk;
+};
+
+/** pick the compiled book specialization for the symbol's class */
+inline OrderBook* newOrderBook(const string& symbol, OrderManager *mgr, const BookConfig& cfg,
+                               const MemConfig& mem) {
+  switch ( cfg.book_type ) {
+    case BookConfig::eTIGHT_BOOK:
+      return new TightOrderBook( symbol, mgr, cfg, mem );
+    case BookConfig::eDEEP_BOOK:
+      return new DeepOrderBook( symbol, mgr, cfg, mem );
+    case BookConfig::eSTANDARD_BOOK:
+    default:
+      return new StandardOrderBook( symbol, mgr, cfg, mem );
+  }
+}
 
 class OrderManager {
 public:
-  OrderManager();
+  /** mem places the order pool and every book's levels, construct the
+      manager on the matching thread after pinning it, see placement.h */
+  explicit OrderManager(const MemConfig& mem=MemConfig());
   ~OrderManager();
 
+  /** apply one message, the message itself is always freed; a new
+      order is copied into the manager's own order pool.  the text
+      written for it is flushed to cout once it's done */
   void handle(Order *o);
-  void ackOrder(Order *o);
-  /* make sure a is the fully filled order*/
-  void publishTrade(Order *a, Order *b);
-  void addOrder(Order *o);
+  /** apply msgs[0..n) strictly in order exactly as handle() would,
+      while prefetching what the messages a few places ahead will touch
+      so their cache misses overlap with the current one */
+  void handleBatch(Order **msgs, size_t n);
+  /** messages between a prefetch stage and the next, see handleBatch */
+  static const size_t PREFETCH_STRIDE = 4;
+  void ackOrder(const Order *o);
+  /** o refused, by the risk gate ( see risk.h ) or for any of the
+      reasons in reject.h.  published instead of an ack */
+  void rejectOrder(const Order *o, RejectReason reason);
+  void publishTrades(const string& symbol, const Fill *fills, size_t n);
+  /** o is the new order message, the manager keeps its own copy.
+      entered as is, handle() risk checks and acks it first */
+  void addOrder(const Order *o);
+  /** cancel and reduce are applied as is too, nothing happens if o
+      names no live order or a reduce wouldn't reduce.  handle() rejects
+      those instead of acking them */
   void cancelOrder(Order *o);
+  /** o is the amend message, its qty is the resting order's new qty */
+  void reduceOrder(Order *o);
+  /** o is the amend message carrying the resting order's new price and
+      qty.  risk checked like a new order, acked unless refused or it
+      names no live order */
+  void replaceOrder(Order *o);
+  /** a resting order has been filled out of the book, forget and free it */
+  void retireOrder(Order *o);
+  /** o was acked but can't trade or rest, reject it for reason and
+      retire it so its user learns it's gone */
+  void killOrder(Order *o, RejectReason reason);
+  /** a stop order's trigger was reached, it enters its book once the
+      current message is done, after any stop triggered before it */
+  void stopTriggered(Order *o) { triggered.push_back(o); }
+  /** pull every order of o's user, only in o's symbol if it has one */
+  void massCancel(Order *o);
+  /** O(books + users): bump the epoch, drop every order in bulk and
+      every user's lists */
   void flushOrders();
+  /** put symbol's book into a call auction, see OrderBook::startAuction.
+      with messages it uncrosses by itself once that many more messages
+      have been handled, counted rather than timed so a replay uncrosses
+      at the same point */
+  void startAuction(const string& symbol, uint64_t messages=0);
+  /** uncross symbol's auction now, returns the qty executed, 0 if
+      symbol isn't in an auction */
+  int64_t uncross(const string& symbol);
+
+  size_t getNumOrders() const { return orders_by_id.size(); }
+  /** ( user, book ) lists kept, live or not, O(users) */
+  size_t getNumUserLists() const {
+    size_t n = 0;
+    for ( const auto& it : orders_by_user ) {
+      n += it.second.books.size();
+    }
+    return n;
+  }
+  /** every book's OrderBook::checksum with its symbol and the live
+      order count, the same on any manager that handled the same
+      messages.  matching thread only */
+  uint64_t checksum();
+
+  /** consistent copy of the manager's and every book's counters, may
+      be called from any thread while the matcher runs.  only the first
+      MAX_STAT_BOOKS books are listed individually */
+  void getStats(StatsSnapshot& snap) const;
+  static const size_t MAX_STAT_BOOKS = 4096;
+
+  /** orders are identified by user and the user's own order id */
+  static uint64_t orderKey(int user, int uoid) {
+    return ( uint64_t(uint32_t(user)) << 32 ) | uint32_t(uoid);
+  }
+  static uint64_t orderKey(const Order *o) { return orderKey(o->getUser(), o->getUserOrderId()); }
+
+  /** per symbol book sizing, must be set before the first order for
+      that symbol arrives; anything unconfigured gets the default */
+  void configureBook(const string& symbol, const BookConfig& config);
+  void setDefaultBookConfig(const BookConfig& config);
+  OrderBook* getBook(const string& symbol);
+
+  /** everything published also goes into ring, NULL to stop, see output.h */
+  void setOutputRing(OutputRing *ring);
+  /** and logged in binary, NULL to stop, see eventlog.h */
+  void setEventLog(EventLog::Writer *log);
+  /** text goes to publisher instead of cout, NULL for cout, see
+      publisher.h.  a TOB the old one still couldn't take is dropped */
+  void setPublisher(Publisher *p);
+  /** whatever publisher has held back that now fits, the matcher's
+      side calls this between messages when it's idle.  true once
+      nothing is held back */
+  bool flushOutput();
+  /** b is holding a TOB until publisher has room */
+  void tobHeld(OrderBook *b) { held_tobs.push_back(b); }
+
+  /** pre-trade limits, see risk.h.  a user's own limits win over the
+      default whenever they were set, both take effect with the next order */
+  void setRiskLimits(int user, const RiskLimits& limits);
+  void setDefaultRiskLimits(const RiskLimits& limits);
+  /** user's net position in symbol since the last flush */
+  int64_t getPosition(int user, const string& symbol);
 
 private:
+  OrderBook* makeBook(const string& symbol);
+  OrderBook* bookFor(const string& symbol);
+  /** the user's list in book, started over if it's from an older epoch */
+  UserOrderList& userList(int user, OrderBook *book);
+  void newOrder(const Order *msg);
+  /** msg is a cancel or reduce of a live order, rejected if not */
+  bool amendable(const Order *msg);
+  void enterOrder(const Order *msg, OrderBook *book, UserOrderList& list);
+  RiskReason checkRisk(const UserOrderList& l, OrderBook *book, const Order *msg,
+                       int open_orders, int64_t open_side);
+  void linkUserOrder(Order *o, UserOrderList& l);
+  void unlinkUserOrder(Order *o);
+  void reduceOpen(Order *o, int qty);
+  void massCancel(UserOrderList& list);
+  void refreshStats();
+  void prefetchSlot(const Order *msg) const;
+  void prefetchOrder(const Order *msg) const;
+  void prefetchLevel(const Order *msg) const;
+  void enterTriggered();
+  void uncrossDue();
+
   //could speed this up with symbol to int mapping so that i could use
   //book id's would generally do this by getting all symbols and
   //enumerating
   unordered_map<string, OrderBook*> book_map;
   // would be nice to use a vector if we can guarantee theyll be tight
   // and monotonicincreasing...
-  unordered_map<int, Order*> orders_by_id;
+  OrderIndex orders_by_id;
+  // user -> book -> that user's orders in the book, nodes are stable so
+  // each Order can point straight back at its list
+  unordered_map<int, UserOrders> orders_by_user;
+  RiskLimits default_limits;
+  // every resting order lives here, released in bulk by a flush
+  pool<Order, order_id_t> order_pool;
+  uint32_t epoch;
+  // stops waiting to enter, in the order they triggered
+  vector<Order*> triggered;
+  // auctions that uncross by themselves, at stats.messages == at
+  struct AuctionDeadline {
+    OrderBook *book;
+    uint64_t at;
+  };
+  vector<AuctionDeadline> auction_deadlines;
+
+  unordered_map<string, BookConfig> book_configs;
+  BookConfig default_config;
+  MemConfig mem;
+  OutputRing *out_ring;
+  EventLog::Writer *event_log;
+  Publisher *publisher;
+  // books holding a TOB back, in the order they started to
+  vector<OrderBook*> held_tobs;
 
+  // written only by the matching thread, each message is one seqlock write
+  ManagerStats stats;
+  SeqLock stats_lock;
+  // books in creation order for readers, slots never move
+  std::unique_ptr<std::atomic<const OrderBook*>[]> stat_books;
+  std::atomic<size_t> num_stat_books;
 };
 
-OrderManager::OrderManager() {}
+OrderManager::OrderManager(const MemConfig& mem)
+  : order_pool(4096, decltype(order_pool)::UNLIMITED, 0, mem)
+  , epoch(1)
+  , mem(mem)
+  , out_ring(NULL)
+  , event_log(NULL)
+  , publisher(NULL)
+  , stat_books( new std::atomic<const OrderBook*>[MAX_STAT_BOOKS] )
+  , num_stat_books(0)
+{
+  triggered.reserve(64);
+  refreshStats();
+}
 
 inline void OrderManager::handle(Order *order) {
+  LAT_BEGIN(order);
+  stats_lock.writeBegin();
+  stats.messages.add();
   switch ( order->getType() ) {
     case Order::eFLUSH:
       flushOrders();
       break;
     case Order::eCANCEL:
-      ackOrder(order);
-      cancelOrder(order);
+      if ( amendable(order) ) {
+        ackOrder(order);
+        cancelOrder(order);
+      }
       break;
     case Order::eNEW:
-      ackOrder(order);
-      addOrder(order);
+      newOrder(order);
+      break;
+    case Order::eREDUCE:
+      if ( amendable(order) ) {
+        ackOrder(order);
+        reduceOrder(order);
+      }
+      break;
+    case Order::eREPLACE:
+      replaceOrder(order);
+      break;
+    case Order::eMASS_CANCEL:
+      massCancel(order);
+      break;
+    case Order::eAUCTION:
+      startAuction(order->getSymbol(), order->getQty());
+      break;
+    case Order::eUNCROSS:
+      if ( OrderBook *b = getBook(order->getSymbol()) ) {
+        if ( b->inAuction() ) {
+          uncross(order->getSymbol());
+          break;
+        }
+      }
+      rejectOrder(order, eREJECT_NO_AUCTION);
       break;
-    default: //unreachable as its prehandled
-      std::cerr << "Unhandled invalid order type" << std::endl;
+    default: // a line the parser couldn't make sense of
+      rejectOrder(order, eREJECT_MALFORMED);
       break;
   }
+  if ( !auction_deadlines.empty() ) {
+    uncrossDue();
+  }
+  if ( !triggered.empty() ) {
+    enterTriggered();
+  }
+  if ( publisher ) {
+    flushOutput();
+  }
+  refreshStats();
+  stats_lock.writeEnd();
+  if ( publisher == NULL ) {
+    // the write, and any wait on a slow stdout, kept out of the stats section
+    LAT_PUBLISH_SCOPE();
+    cout.flush();
+  }
+  LAT_END(order);
+  // every other message is done with once it's been applied
+  delete order;
 }
 
-inline void OrderManager::addOrder(Order *o) {
-  orders_by_id[o->getUserOrderId()] = o;
+/** a software pipeline three stages deep, each stage a
+    PREFETCH_STRIDE messages behind the last:
 
-  OrderBook *p = NULL;
-  auto it = book_map.find(o->getSymbol());
-  if ( it == book_map.end() ) {
-    p = new OrderBook( o->getSymbol(), this );
-    book_map[o->getSymbol()] = p;
-  } else {
-    p = it->second;
+      index slot  the message's home slot in orders_by_id
+      order       the resting Order the slot points at
+      level       the order's Level, its queue neighbours and its
+                  neighbours on the user's list
+
+    by the time a message is handled its whole chain of dependent
+    loads ( slot, order, level, neighbours ) is already in flight or
+    in cache.  the prefetches only ever read, a message earlier in the
+    batch changing what a later one finds just makes its prefetch a
+    wasted one, it can't change what gets applied */
+inline void OrderManager::handleBatch(Order **msgs, size_t n) {
+  const size_t S = PREFETCH_STRIDE;
+  for ( size_t j = 0; j < n && j < 3 * S; ++j ) {
+    prefetchSlot(msgs[j]);
+  }
+  for ( size_t j = 0; j < n && j < 2 * S; ++j ) {
+    prefetchOrder(msgs[j]);
+  }
+  for ( size_t j = 0; j < n && j < S; ++j ) {
+    prefetchLevel(msgs[j]);
   }
+  for ( size_t i = 0; i < n; ++i ) {
+    if ( i + 3 * S < n ) {
+      prefetchSlot(msgs[i + 3 * S]);
+    }
+    if ( i + 2 * S < n ) {
+      prefetchOrder(msgs[i + 2 * S]);
+    }
+    if ( i + S < n ) {
+      prefetchLevel(msgs[i + S]);
+    }
+    handle(msgs[i]);
+  }
+}
+
+/** every message naming one order looks it up */
+inline void OrderManager::prefetchSlot(const Order *msg) const {
+  Order::OrderType t = msg->getType();
+  if ( t == Order::eNEW || t == Order::eCANCEL || t == Order::eREDUCE || t == Order::eREPLACE ) {
+    __builtin_prefetch( orders_by_id.homeSlot(orderKey(msg)), 1 );
+  }
+}
+
+inline void OrderManager::prefetchOrder(const Order *msg) const {
+  Order::OrderType t = msg->getType();
+  if ( t == Order::eCANCEL || t == Order::eREDUCE || t == Order::eREPLACE ) {
+    if ( const Order *o = orders_by_id.find(orderKey(msg)) ) {
+      // both halves, an amend or cancel reads the cold line for its book and price
+      __builtin_prefetch( o, 1 );
+      __builtin_prefetch( reinterpret_cast<const char*>(o) + CACHE_LINE, 1 );
+    }
+  }
+}
+
+inline void OrderManager::prefetchLevel(const Order *msg) const {
+  Order::OrderType t = msg->getType();
+  if ( t == Order::eCANCEL || t == Order::eREDUCE || t == Order::eREPLACE ) {
+    if ( Order *o = orders_by_id.find(orderKey(msg)) ) {
+      o->getBook()->prefetch(o);
+      // and the neighbours on the user's list it gets unlinked from
+      const Order::Links& u = o->userLinks();
+      if ( u.prev ) {
+        __builtin_prefetch( u.prev, 1 );
+      }
+      if ( u.next ) {
+        __builtin_prefetch( u.next, 1 );
+      }
+    }
+  }
+}
+
+/** the book and the user's list are looked up once, for the risk
+    check and for entering the order */
+inline void OrderManager::newOrder(const Order *msg) {
+  if ( orders_by_id.find(orderKey(msg)) ) {
+    rejectOrder(msg, eREJECT_DUPLICATE_ID);
+    return;
+  }
+  OrderBook *p = bookFor(msg->getSymbol());
+  UserOrderList& l = userList(msg->getUser(), p);
+  RiskReason r = checkRisk( l, p, msg, l.risk->open_orders,
+                            msg->getIsBuy() ? l.open_buy : l.open_sell );
+  if ( r != eRISK_OK ) {
+    rejectOrder(msg, RejectReason(r));
+    return;
+  }
+  if ( msg->getPrice() == 0 && msg->getStopPrice() == 0 && !p->inAuction()
+       && ( msg->getIsBuy() ? p->getBestOfferPrice() : p->getBestBidPrice() ) == 0 ) {
+    rejectOrder(msg, eREJECT_NO_LIQUIDITY);
+    return;
+  }
+  ackOrder(msg);
+  enterOrder(msg, p, l);
+}
+
+/** the lookup is repeated by the cancel or reduce itself, the slot and
+    order are already in cache from the prefetch */
+inline bool OrderManager::amendable(const Order *msg) {
+  const Order *o = orders_by_id.find(orderKey(msg));
+  if ( o == NULL ) {
+    rejectOrder(msg, eREJECT_UNKNOWN_ORDER);
+    return false;
+  }
+  if ( msg->getType() == Order::eREDUCE && msg->getQty() >= o->getQty() ) {
+    rejectOrder(msg, eREJECT_QTY_UP);
+    return false;
+  }
+  return true;
+}
+
+inline void OrderManager::addOrder(const Order *msg) {
+  OrderBook *p = bookFor(msg->getSymbol());
+  enterOrder(msg, p, userList(msg->getUser(), p));
+}
+
+inline void OrderManager::enterOrder(const Order *msg, OrderBook *p, UserOrderList& l) {
+  order_id_t h = order_pool.alloc();
+  Order *o = order_pool.get(h);
+  *o = *msg;
+  o->setHandle(h);
+  orders_by_id.insert(orderKey(o), o);
   o->setBook(p);
-  p->addOrder(o);
+  linkUserOrder(o, l);
+  if ( o->getStopPrice() ) {
+    p->addStop(o);
+  } else {
+    p->addOrder(o);
+  }
+}
+
+/** a cascade is worked off here rather than by recursion: a triggered
+    stop that trades can trigger more, which join the back of the queue */
+inline void OrderManager::enterTriggered() {
+  for ( size_t i = 0; i < triggered.size(); ++i ) {
+    triggered[i]->getBook()->addOrder( triggered[i] );
+  }
+  triggered.clear();
+}
+
+inline OrderBook* OrderManager::bookFor(const string& symbol) {
+  auto it = book_map.find(symbol);
+  if ( it != book_map.end() ) {
+    return it->second;
+  }
+  OrderBook *p = makeBook(symbol);
+  book_map[symbol] = p;
+  size_t n = num_stat_books.load(std::memory_order_relaxed);
+  if ( n < MAX_STAT_BOOKS ) {
+    stat_books[n].store(p, std::memory_order_relaxed);
+    num_stat_books.store(n + 1, std::memory_order_release);
+  }
+  return p;
+}
+
+inline UserOrderList& OrderManager::userList(int user, OrderBook *book) {
+  UserOrders& u = orders_by_user[user];
+  if ( u.risk.epoch != epoch ) {
+    if ( u.risk.epoch == 0 && !u.risk.custom ) {
+      u.risk.limits = default_limits;
+    }
+    u.risk.open_orders = 0;
+    u.risk.epoch = epoch;
+  }
+  UserOrderList& l = u.books[book];
+  if ( l.epoch != epoch ) {
+    l.head = NULL;
+    l.count = 0;
+    l.epoch = epoch;
+    l.position = 0;
+    l.open_buy = 0;
+    l.open_sell = 0;
+    l.risk = &u.risk;
+  }
+  return l;
+}
+
+/** a handful of compares against counters on lines the order is
+    about to touch anyway, the book's TOB is only read when a limit
+    needs a reference price */
+inline RiskReason OrderManager::checkRisk(const UserOrderList& l, OrderBook *book, const Order *msg,
+                                          int open_orders, int64_t open_side) {
+  const RiskLimits& lim = l.risk->limits;
+  bool buy = msg->getIsBuy();
+  int ref = 0;
+  int opp = 0;
+  if ( msg->getStopPrice() ) {
+    // it can only trade once the market has reached the stop
+    ref = opp = msg->getStopPrice();
+  } else if ( lim.price_band_bps || ( lim.max_notional && msg->getPrice() == 0 ) ) {
+    int bid = book->getBestBidPrice();
+    int ask = book->getBestOfferPrice();
+    opp = buy ? ask : bid;
+    ref = opp ? opp : ( buy ? bid : ask );
+  }
+  return ::checkRisk( lim, open_orders, l.position, open_side, buy,
+                      msg->getPrice(), msg->getQty(), ref, opp );
+}
+
+inline void OrderManager::setRiskLimits(int user, const RiskLimits& limits) {
+  UserRisk& r = orders_by_user[user].risk;
+  r.limits = limits;
+  r.custom = true;
+}
+
+inline void OrderManager::setDefaultRiskLimits(const RiskLimits& limits) {
+  default_limits = limits;
+  for ( auto& it : orders_by_user ) {
+    if ( !it.second.risk.custom ) {
+      it.second.risk.limits = limits;
+    }
+  }
+}
+
+inline int64_t OrderManager::getPosition(int user, const string& symbol) {
+  auto u = orders_by_user.find(user);
+  auto b = book_map.find(symbol);
+  if ( u == orders_by_user.end() || b == book_map.end() ) {
+    return 0;
+  }
+  auto l = u->second.books.find(b->second);
+  if ( l == u->second.books.end() || l->second.epoch != epoch ) {
+    return 0;
+  }
+  return l->second.position;
+}
+
+inline void OrderManager::linkUserOrder(Order *o, UserOrderList& l) {
+  Order::Links& links = o->userLinks();
+  links.prev = NULL;
+  links.next = l.head;
+  if ( l.head ) {
+    l.head->userLinks().prev = o;
+  }
+  l.head = o;
+  ++l.count;
+  ++l.risk->open_orders;
+  ( o->getIsBuy() ? l.open_buy : l.open_sell ) += o->getQty();
+  o->setUserList(&l);
+}
+
+inline void OrderManager::unlinkUserOrder(Order *o) {
+  UserOrderList *l = o->getUserList();
+  Order::Links& links = o->userLinks();
+  if ( links.prev ) {
+    links.prev->userLinks().next = links.next;
+  } else {
+    l->head = links.next;
+  }
+  if ( links.next ) {
+    links.next->userLinks().prev = links.prev;
+  }
+  --l->count;
+  --l->risk->open_orders;
+  ( o->getIsBuy() ? l->open_buy : l->open_sell ) -= o->getQty();
+  o->setUserList(NULL);
 }
 
 inline void OrderManager::cancelOrder(Order *o) {
-  auto it = orders_by_id.find(o->getUserOrderId());
-  if ( it != orders_by_id.end() ) {
-    Order *temp = it->second;
+  Order *temp = orders_by_id.find(orderKey(o));
+  if ( temp ) {
     temp->getBook()->cancelOrder(temp);
-    //finally delete it
-    delete temp;
-    orders_by_id.erase(it);
+    //finally release it
+    orders_by_id.erase(orderKey(temp));
+    unlinkUserOrder(temp);
+    order_pool.free(temp->getHandle());
   }
-  else {
-    std::cerr << "Can't cancel order that can't be found: " << o->getUserOrderId() << "!" << std::endl;
-    return;
+}
+
+inline void OrderManager::configureBook(const string& symbol, const BookConfig& config) {
+  book_configs[symbol] = config;
+}
+
+inline void OrderManager::setDefaultBookConfig(const BookConfig& config) {
+  default_config = config;
+}
+
+inline OrderBook* OrderManager::makeBook(const string& symbol) {
+  auto it = book_configs.find(symbol);
+  const BookConfig& cfg = it != book_configs.end() ? it->second : default_config;
+  OrderBook *b = newOrderBook( symbol, this, cfg, mem );
+  b->setOutputRing(out_ring);
+  b->setEventLog(event_log);
+  b->setPublisher(publisher);
+  return b;
+}
+
+inline void OrderManager::setOutputRing(OutputRing *ring) {
+  out_ring = ring;
+  for ( auto it : book_map ) {
+    it.second->setOutputRing(ring);
   }
 }
 
-inline void OrderManager::flushOrders() {
+inline void OrderManager::setEventLog(EventLog::Writer *log) {
+  event_log = log;
   for ( auto it : book_map ) {
-    (it.second)->flushOrders();
+    it.second->setEventLog(log);
   }
+}
 
-  //clear the memory
-  for ( auto it : orders_by_id ) {
-    delete it.second;
+inline void OrderManager::setPublisher(Publisher *p) {
+  flushOutput();
+  publisher = p;
+  for ( auto it : book_map ) {
+    it.second->setPublisher(p);
   }
-  orders_by_id.clear();
 }
 
-inline OrderManager::~OrderManager() {
+/** summed so the books can be visited in whatever order the map keeps them */
+inline uint64_t OrderManager::checksum() {
+  uint64_t h = hashMix( 0, orders_by_id.size() );
   for ( auto it : book_map ) {
-    delete it.second;
+    h += hashMix( std::hash<string>()(it.first), it.second->checksum() );
   }
-  book_map.clear();
+  return h;
 }
 
-inline void OrderManager::ackOrder(Order *o) {
-  cout << "A," << o->getUser() << "," << o->getUserOrderId() << endl;
+inline bool OrderManager::flushOutput() {
+  if ( publisher == NULL ) {
+    return true;
+  }
+  if ( !publisher->flush() ) {
+    return false;
+  }
+  size_t i = 0;
+  while ( i < held_tobs.size() && held_tobs[i]->publishHeldTob() ) {
+    ++i;
+  }
+  held_tobs.erase( held_tobs.begin(), held_tobs.begin() + i );
+  return held_tobs.empty();
 }
 
-inline void OrderManager::publishTrade(Order *a, Order *b) {
-  Order *buy, *sell;
-  if ( a->getIsBuy() ) {
-    buy = a;
-    sell = b;
+inline OrderBook* OrderManager::getBook(const string& symbol) {
+  auto it = book_map.find(symbol);
+  return it != book_map.end() ? it->second : NULL;
+}
+
+inline void OrderManager::reduceOrder(Order *o) {
+  Order *temp = orders_by_id.find(orderKey(o));
+  if ( temp == NULL ) {
+    return;
+  }
+  if ( o->getQty() <= 0 ) {
+    cancelOrder(o);
+  } else if ( o->getQty() < temp->getQty() ) {
+    reduceOpen(temp, temp->getQty() - o->getQty());
+    temp->getBook()->reduceOrder(temp, temp->getQty() - o->getQty());
+  }
+}
+
+inline void OrderManager::replaceOrder(Order *o) {
+  Order *temp = orders_by_id.find(orderKey(o));
+  if ( temp == NULL ) {
+    rejectOrder(o, eREJECT_UNKNOWN_ORDER);
+    return;
+  }
+  bool qty_down = o->getPrice() == temp->getPrice() && o->getQty() < temp->getQty();
+  if ( o->getQty() > 0 && !qty_down ) {
+    // checked as if it were new with the order it replaces gone
+    UserOrderList& l = *temp->getUserList();
+    int64_t open_side = ( temp->getIsBuy() ? l.open_buy : l.open_sell ) - temp->getQty();
+    o->setIsBuy( temp->getIsBuy() );
+    o->setStopPrice( temp->getStopPrice() );
+    RiskReason r = checkRisk( l, temp->getBook(), o, l.risk->open_orders - 1, open_side );
+    if ( r != eRISK_OK ) {
+      rejectOrder(o, RejectReason(r));
+      return;
+    }
+  }
+  ackOrder(o);
+  if ( o->getQty() <= 0 ) {
+    cancelOrder(o);
+  } else if ( qty_down ) {
+    // nothing but a qty down, keep the queue position
+    reduceOpen(temp, temp->getQty() - o->getQty());
+    temp->getBook()->reduceOrder(temp, temp->getQty() - o->getQty());
   } else {
-    buy = b;
-    sell = a;
+    reduceOpen(temp, temp->getQty() - o->getQty());
+    temp->getBook()->replaceOrder(temp, o->getPrice(), o->getQty());
   }
+}
 
-  cout << "T," << buy->getUser()  << "," << buy->getUserOrderId()
-       << ","  << sell->getUser() << "," << sell->getUserOrderId()
-       << "," << a->getPrice()
-       << "," << a->getQty() << endl;
+/** qty came off o without it leaving the book, negative for a replace up */
+inline void OrderManager::reduceOpen(Order *o, int qty) {
+  UserOrderList *l = o->getUserList();
+  ( o->getIsBuy() ? l->open_buy : l->open_sell ) -= qty;
 }
 
-/**  These funcs from OrderBook arent defined until now because we need OrderManager defined first */
+inline void OrderManager::retireOrder(Order *o) {
+  orders_by_id.erase(orderKey(o));
+  unlinkUserOrder(o);
+  order_pool.free(o->getHandle());
+}
 
-void OrderBook::executeOrder( Order *o ) {
-  if ( o->getPrice() == 0 ) {
-    if ( o->getIsBuy() ) {
-      executeMarketBuy(o);
-    } else {
-      executeMarketSell(o);
+inline void OrderManager::killOrder(Order *o, RejectReason reason) {
+  rejectOrder(o, reason);
+  retireOrder(o);
+}
+
+/** O(orders pulled): walks only the user's own lists, each book
+    removes its share in one go and publishes its TOB changes once.
+    a book's orders are acked in the order they were entered, user
+    wide the books come in no particular order */
+inline void OrderManager::massCancel(Order *o) {
+  auto user = orders_by_user.find(o->getUser());
+  if ( user == orders_by_user.end() ) {
+    return;
+  }
+  if ( o->getSymbol().empty() ) {
+    for ( auto& it : user->second.books ) {
+      massCancel(it.second);
     }
   } else {
-    if ( o->getIsBuy() ) {
-      executeBuy(o);
+    auto book = book_map.find(o->getSymbol());
+    if ( book == book_map.end() ) {
+      return;
+    }
+    auto it = user->second.books.find(book->second);
+    if ( it != user->second.books.end() ) {
+      massCancel(it->second);
+    }
+  }
+}
+
+inline void OrderManager::massCancel(UserOrderList& list) {
+  if ( list.epoch != epoch || list.head == NULL ) {
+    return;
+  }
+  // the list is newest first, ack from the tail so the acks go out in
+  // the order the orders were entered
+  Order *last = list.head;
+  while ( last->userLinks().next ) {
+    last = last->userLinks().next;
+  }
+  for ( Order *cur = last; cur; cur = cur->userLinks().prev ) {
+    ackOrder(cur);
+  }
+  list.head->getBook()->cancelOrders(list.head);
+
+  Order *cur = list.head;
+  while ( cur ) {
+    Order *next = cur->userLinks().next;
+    orders_by_id.erase(orderKey(cur));
+    order_pool.free(cur->getHandle());
+    cur = next;
+  }
+  list.risk->open_orders -= list.count;
+  list.head = NULL;
+  list.count = 0;
+  list.open_buy = 0;
+  list.open_sell = 0;
+}
+
+inline void OrderManager::flushOrders() {
+  for ( auto it : book_map ) {
+    (it.second)->flushOrders();
+  }
+
+  // nothing is visited per order, every index and list from the old
+  // epoch reads as empty and the pool storage is reused as is
+  orders_by_id.clear();
+  order_pool.clear();
+  auction_deadlines.clear();
+  ++epoch;
+
+  // the lists are all empty now and positions start over, so only a
+  // user with limits of its own is worth keeping.  otherwise every
+  // ( user, book ) seen would be kept for good
+  for ( auto it = orders_by_user.begin(); it != orders_by_user.end(); ) {
+    if ( it->second.risk.custom ) {
+      it->second.books.clear();
+      ++it;
     } else {
-      executeSell(o);
+      it = orders_by_user.erase(it);
     }
   }
+}
 
-  if ( o->getQty() == 0 ) {
-    mgr->cancelOrder(o);
+inline void OrderManager::startAuction(const string& symbol, uint64_t messages) {
+  OrderBook *b = bookFor(symbol);
+  b->startAuction();
+  if ( messages ) {
+    auction_deadlines.push_back( AuctionDeadline{ b, stats.messages.get() + messages } );
   }
 }
 
-void OrderBook::executeMarketBuy( Order *o ) {
-  /** Simple case of fill and kill against asks*/
+inline int64_t OrderManager::uncross(const string& symbol) {
+  OrderBook *b = getBook(symbol);
+  if ( b == NULL || !b->inAuction() ) {
+    return 0;
+  }
+  for ( size_t i = 0; i < auction_deadlines.size(); ) {
+    if ( auction_deadlines[i].book == b ) {
+      auction_deadlines.erase( auction_deadlines.begin() + i );
+    } else {
+      ++i;
+    }
+  }
+  return b->uncross();
+}
 
-  while ( o->getQty() != 0 && getBestOfferPrice() != 0 ) {
-    Level *inside_level = getBestOfferLevel();
-    //exhaust all the offer at this level that we can, until we have to switch levels
-    while ( o->getQty() != 0 && getBestOfferLevel() == inside_level ) {
-      Order* front = inside_level->getFrontOrder();
-      if ( o->getQty() < front->getQty() ) {
-        mgr->publishTrade(o, front);
-        front->setQty( front->getQty() - o->getQty() );
-        o->setQty(0); //this will break us out
-      } else {
-        //o is bigger so we can remove front entirely which could nuke the level
-        mgr->publishTrade(front, o);
-        o->setQty( o->getQty() - front->getQty() );
-        mgr->cancelOrder(front);
-      }
+/** the deadlines are few, a scan after each message while any are set */
+inline void OrderManager::uncrossDue() {
+  uint64_t now = stats.messages.get();
+  for ( size_t i = 0; i < auction_deadlines.size(); ) {
+    if ( auction_deadlines[i].at <= now ) {
+      OrderBook *b = auction_deadlines[i].book;
+      auction_deadlines.erase( auction_deadlines.begin() + i );
+      b->uncross();
+    } else {
+      ++i;
     }
   }
 }
 
-void OrderBook::executeMarketSell( Order *o ) {
-  /** Simple case of fill and kill against asks*/
+/** the gauges that aren't tracked incrementally */
+inline void OrderManager::refreshStats() {
+  stats.live_orders.set( orders_by_id.size() );
+  stats.books.set( book_map.size() );
+  stats.order_bytes.set( order_pool.bytes() );
+  stats.index_bytes.set( orders_by_id.bytes() );
+}
 
-  while ( o->getQty() != 0 && getBestBidPrice() != 0 ) {
-    Level *inside_level = getBestBidLevel();
-    //exhaust all the offer at this level that we can, until we have to switch levels
-    while ( o->getQty() != 0 && getBestBidLevel() == inside_level ) {
-      Order* front = inside_level->getFrontOrder();
-      if ( o->getQty() < front->getQty() ) {
-        mgr->publishTrade(o, front);
-        front->setQty( front->getQty() - o->getQty() );
-        o->setQty(0); //this will break us out
-      } else {
-        //o is bigger so we can remove front entirely which could nuke the level
-        mgr->publishTrade(front, o);
-        o->setQty( o->getQty() - front->getQty() );
-        mgr->cancelOrder(front);
-      }
+inline void OrderManager::getStats(StatsSnapshot& snap) const {
+  snap.version = stats_lock.read( [&]() {
+    snap.messages = stats.messages.get();
+    snap.rejects = stats.rejects.get();
+    for ( int r = 0; r < eREJECT_REASONS; ++r ) {
+      snap.reject_reasons[r] = stats.reject_reasons[r].get();
     }
+    snap.live_orders = stats.live_orders.get();
+    snap.num_books = stats.books.get();
+    snap.order_bytes = stats.order_bytes.get();
+    snap.index_bytes = stats.index_bytes.get();
+    size_t n = num_stat_books.load(std::memory_order_acquire);
+    snap.books.resize(n);
+    snap.book_bytes = 0;
+    for ( size_t i = 0; i < n; ++i ) {
+      const OrderBook *b = stat_books[i].load(std::memory_order_relaxed);
+      snap.books[i].copy( b->getSymbol(), b->getStats() );
+      snap.book_bytes += snap.books[i].level_bytes;
+    }
+  });
+}
+
+inline OrderManager::~OrderManager() {
+  for ( auto it : book_map ) {
+    delete it.second;
+  }
+  book_map.clear();
+}
+
+inline void OrderManager::ackOrder(const Order *o) {
+  LAT_PUBLISH_SCOPE();
+  if ( out_ring ) {
+    out_ring->push( OutputRecord::ack(o->getUser(), o->getUserOrderId()) );
+  }
+  if ( event_log ) {
+    event_log->ack( EventLog::now(), o->getUser(), o->getUserOrderId() );
+  }
+  if ( publisher ) {
+    publisher->push( OutputRecord::ack(o->getUser(), o->getUserOrderId()) );
+    return;
   }
+  cout << "A," << o->getUser() << "," << o->getUserOrderId() << "\n";
 }
 
-void OrderBook::executeBuy( Order *o ) {
-  int p = o->getPrice();
+inline void OrderManager::rejectOrder(const Order *o, RejectReason reason) {
+  LAT_PUBLISH_SCOPE();
+  stats.rejects.add();
+  stats.reject_reasons[reason].add();
+  if ( out_ring ) {
+    out_ring->push( OutputRecord::reject(o->getUser(), o->getUserOrderId(), reason) );
+  }
+  if ( event_log ) {
+    event_log->reject( EventLog::now(), o->getUser(), o->getUserOrderId(), reason );
+  }
+  if ( publisher ) {
+    publisher->push( OutputRecord::reject(o->getUser(), o->getUserOrderId(), reason) );
+    return;
+  }
+  cout << "R," << o->getUser() << "," << o->getUserOrderId() << "," << rejectReasonName(reason) << "\n";
+}
 
-  while ( o->getQty() != 0 && p >= getBestOfferPrice() ) {
-    Level *inside_level = getBestOfferLevel();
-    while ( o->getQty() !=0 && getBestOfferLevel() != 0 ) {
-      Order* front = inside_level->getFrontOrder();
-      if ( o->getQty() < front->getQty() ) {
-        mgr->publishTrade(o, front);
-        front->setQty( front->getQty() - o->getQty() );
-        o->setQty(0); //this will break us out
-      } else {
-        //o is bigger so we can remove front entirely which could nuke the level
-        mgr->publishTrade(front, o);
-        o->setQty( o->getQty() - front->getQty() );
-        mgr->cancelOrder(front);
-      }
+/** fills are also where positions move and open qty comes off both sides */
+inline void OrderManager::publishTrades(const string& symbol, const Fill *fills, size_t n) {
+  LAT_PUBLISH_SCOPE();
+  uint64_t ts = event_log ? EventLog::now() : 0;
+  for ( size_t i = 0; i < n; ++i ) {
+    const Fill& f = fills[i];
+    f.buy_list->position += f.qty;
+    f.buy_list->open_buy -= f.qty;
+    f.sell_list->position -= f.qty;
+    f.sell_list->open_sell -= f.qty;
+    if ( out_ring ) {
+      out_ring->push( OutputRecord::trade(symbol, f.buy_user, f.buy_oid, f.sell_user, f.sell_oid, f.price, f.qty) );
+    }
+    if ( event_log ) {
+      event_log->trade( ts, symbol, f.buy_user, f.buy_oid, f.sell_user, f.sell_oid, f.price, f.qty );
     }
+    if ( publisher ) {
+      publisher->push( OutputRecord::trade(symbol, f.buy_user, f.buy_oid, f.sell_user, f.sell_oid, f.price, f.qty) );
+      continue;
+    }
+    cout << "T," << f.buy_user  << "," << f.buy_oid
+         << ","  << f.sell_user << "," << f.sell_oid
+         << "," << f.price
+         << "," << f.qty << "\n";
+  }
+}
+
+/**  These funcs from OrderBook arent defined until now because we need OrderManager defined first */
+
+/** an update while one is already held overwrites it, so the held one
+    stays ahead of anything newer */
+inline void OrderBook::publishTob(char side, int price, int64_t quantity) {
+  HeldTob& h = held_tob[ side == 'B' ? 0 : 1 ];
+  if ( !h.held && !publisher->congested() ) {
+    publisher->push( OutputRecord::tob(symbol, side, price, quantity) );
+    return;
+  }
+  if ( h.held ) {
+    stats.tob_conflated.add();
+  } else if ( !held_tob[0].held && !held_tob[1].held ) {
+    mgr->tobHeld(this);
   }
-  if (o->getQty() != 0) {
+  h.held = true;
+  h.price = price;
+  h.qty = quantity;
+}
+
+inline bool OrderBook::publishHeldTob() {
+  for ( int i = 0; i < 2; ++i ) {
+    HeldTob& h = held_tob[i];
+    if ( !h.held ) {
+      continue;
+    }
+    if ( publisher == NULL ) {
+      h.held = false;
+      continue;
+    }
+    if ( publisher->congested() ) {
+      return false;
+    }
+    publisher->push( OutputRecord::tob(symbol, i == 0 ? 'B' : 'S', h.price, h.qty) );
+    h.held = false;
+  }
+  return true;
+}
+
+/** insertOrder for an order the manager owns: one there's no level
+    for, the level pool at max_levels or a fixed ladder full, is refused
+    and retired by the manager instead, nothing having changed */
+template <class Policy>
+template <class Side>
+inline bool BasicOrderBook<Policy>::placeOrder(Side& side, Order *order) {
+  try {
+    return insertOrder(side, order);
+  } catch ( const std::bad_alloc& ) {
+    stats.orders_refused.add();
+    mgr->killOrder(order, eREJECT_BOOK_FULL);
+    return false;
+  }
+}
+
+/** sweep the opposite side then either rest the remainder or retire
+    the aggressor; a market order's unfilled remainder is killed.
+    minimum qty is checked against the depth index up front */
+template <class Policy>
+template <class Own, class Opp>
+void BasicOrderBook<Policy>::executeOrder( Own& own, Opp& opp, Order *o ) {
+  TobState pre = getTob();
+  matchOrder(own, opp, o);
+  publishTobChanges(pre);
+}
+
+template <class Policy>
+template <class Own, class Opp>
+void BasicOrderBook<Policy>::matchOrder( Own& own, Opp& opp, Order *o ) {
+  if ( o->getMinQty() > 0 && depthToPrice(opp, o->getPrice()) < o->getMinQty() ) {
+    // fill-or-kill / minimum qty that can't be met, kill before any fill
+    mgr->killOrder(o, eREJECT_MIN_QTY);
+    return;
+  }
+
+  int qty = o->getQty();
+  sweep(opp, o);
+
+  if ( o->getPrice() == 0 && o->getQty() == qty ) {
+    // a market order that traded nothing, a triggered stop or a replace
+    // to market finding the other side empty.  entry rejects new ones
+    mgr->killOrder(o, eREJECT_NO_LIQUIDITY);
+  } else if ( o->getQty() == 0 || o->getPrice() == 0 ) {
+    mgr->retireOrder(o);
+  } else {
     // this is the remainder order after it swept everything it could
     // match against that goes into the book
-    mgr->addOrder(o);
+    o->setMinQty(0);
+    placeOrder(own, o);
   }
 }
 
-void OrderBook::executeSell( Order *o ) {
-  int p = o->getPrice();
+template <class Policy>
+void BasicOrderBook<Policy>::replaceOrder( Order *o, int price, int qty ) {
+  if ( o->getStopPrice() ) {
+    // still waiting, keeps its stop and its place among the stops
+    o->setPrice(price);
+    o->setQty(qty);
+    return;
+  }
+  if ( auction ) {
+    auctionRemove(o);
+    o->setPrice(price);
+    o->setQty(qty);
+    auctionAdd(o);
+    return;
+  }
+  TobState pre = getTob();
+  if ( o->getIsBuy() ) {
+    replaceOrder(bids, asks, o, price, qty);
+  } else {
+    replaceOrder(asks, bids, o, price, qty);
+  }
+  publishTobChanges(pre);
+}
 
-  while ( o->getQty() != 0 && p <= getBestBidPrice() ) {
-    Level *inside_level = getBestBidLevel();
-    while ( o->getQty() !=0 && getBestBidLevel() != 0 ) {
-      Order* front = inside_level->getFrontOrder();
-      if ( o->getQty() < front->getQty() ) {
-        mgr->publishTrade(o, front);
-        front->setQty( front->getQty() - o->getQty() );
-        o->setQty(0); //this will break us out
-      } else {
-        //o is bigger so we can remove front entirely which could nuke the level
-        mgr->publishTrade(front, o);
+/** pull the order, re-price it and send it back in as if it were new
+    but without the second trip through OrderManager */
+template <class Policy>
+template <class Own, class Opp>
+void BasicOrderBook<Policy>::replaceOrder( Own& own, Opp& opp, Order *o, int price, int qty ) {
+  removeOrder(own, o);
+  o->setPrice(price);
+  o->setQty(qty);
+  if ( isMarketable(opp, o) ) {
+    matchOrder(own, opp, o);
+  } else {
+    placeOrder(own, o);
+  }
+}
+
+/** one sweep for both sides, Side's comparator decides what crosses
+
+    when the aggressor covers the whole inside level we consume it in
+    one pass popping the FIFO front directly and delete the level once,
+    otherwise we fill from the front until the aggressor runs out.
+    Trades always print at the resting level's price and are published
+    as one batch at the end of the sweep
+*/
+template <class Policy>
+template <class Side>
+void BasicOrderBook<Policy>::sweep( Side& opp, Order *o ) {
+  bool market = ( o->getPrice() == 0 );
+  uint64_t levels = 0;
+
+  while ( o->getQty() != 0 && !opp.empty() &&
+          ( market || !opp.isBetter( o->getPrice(), opp.best().l_price ) ) ) {
+    PriceLevel<price_t> inside = opp.best();
+    level_t& lvl = all_levels[inside.l_ptr];
+    ++levels;
+
+    if ( o->getQty() >= lvl.getQty() ) {
+      while ( !lvl.empty() ) {
+        Order *front = lvl.popFront();
+        fills.emplace_back( o, front, inside.l_price, front->getQty() );
         o->setQty( o->getQty() - front->getQty() );
-        mgr->cancelOrder(front);
+        front->setQty(0); // all of it traded, nothing left open when it retires
+        mgr->retireOrder(front);
+        stats.live_orders.sub();
+      }
+      lvl.flushOrders();
+      opp.eraseAt( opp.size() - 1 );
+      all_levels.free( inside.l_ptr );
+      stats.levels_destroyed.add();
+      stats.live_levels.sub();
+    } else {
+      // the aggressor runs out inside this level so all of it comes off the level
+      int level_fill = o->getQty();
+      while ( o->getQty() != 0 ) {
+        Order *front = lvl.getFrontOrder();
+        if ( o->getQty() < front->getQty() ) {
+          fills.emplace_back( o, front, inside.l_price, o->getQty() );
+          lvl.fillFront( o->getQty() );
+          o->setQty(0); //this will break us out
+        } else {
+          fills.emplace_back( o, front, inside.l_price, front->getQty() );
+          o->setQty( o->getQty() - front->getQty() );
+          lvl.popFront();
+          front->setQty(0);
+          mgr->retireOrder(front);
+          stats.live_orders.sub();
+        }
       }
+      opp.addQty( opp.size() - 1, -level_fill );
     }
   }
-  if (o->getQty() != 0) {
-    // this is the remainder order after it swept everything it could
-    // match against that goes into the book
-    mgr->addOrder(o);
+
+  if ( levels ) {
+    stats.sweeps.add();
+    stats.sweep_levels.add(levels);
+    stats.sweep_max_levels.max(levels);
+  }
+  if ( !fills.empty() ) {
+    stats.trades.add( fills.size() );
+    mgr->publishTrades( symbol, fills.data(), fills.size() );
+    // a sweep's prices only move away from the aggressor's side
+    int first = fills.front().price;
+    last_trade = fills.back().price;
+    fills.clear();
+    triggerStops( std::min(first, last_trade), std::max(first, last_trade) );
+  }
+}
+
+template <class Policy>
+void BasicOrderBook<Policy>::addStop( Order *o ) {
+  int stop = o->getStopPrice();
+  if ( last_trade && ( o->getIsBuy() ? last_trade >= stop : last_trade <= stop ) ) {
+    o->setStopPrice(0);
+    stats.stops_triggered.add();
+    mgr->stopTriggered(o);
+  } else {
+    if ( o->getIsBuy() ) {
+      buy_stops.insert(o);
+    } else {
+      sell_stops.insert(o);
+    }
+    stats.live_stops.add();
+  }
+}
+
+/** O(triggered): a sweep that traded from low to high sets off every
+    buy stop at or under high and every sell stop at or over low, each
+    a run at the end of its index.  buys go first, each side in
+    trigger order */
+template <class Policy>
+void BasicOrderBook<Policy>::triggerStops( int low, int high ) {
+  while ( buy_stops.triggers(high) ) {
+    Order *o = buy_stops.popNext();
+    o->setStopPrice(0);
+    stats.stops_triggered.add();
+    stats.live_stops.sub();
+    mgr->stopTriggered(o);
+  }
+  while ( sell_stops.triggers(low) ) {
+    Order *o = sell_stops.popNext();
+    o->setStopPrice(0);
+    stats.stops_triggered.add();
+    stats.live_stops.sub();
+    mgr->stopTriggered(o);
+  }
+}
+
+/** trade everything indicativeUncross says can trade at its price,
+    market orders first then price then time on each side exactly as a
+    sweep would take them, and publish it all as one batch */
+template <class Policy>
+int64_t BasicOrderBook<Policy>::uncross() {
+  if ( !auction ) {
+    return 0;
+  }
+  int price;
+  int64_t qty = indicativeUncross(price);
+  for ( int64_t left = qty; left > 0; ) {
+    Order *b = auctionFront(bids, auction_bids);
+    Order *s = auctionFront(asks, auction_asks);
+    int q = int( std::min<int64_t>( left, std::min( b->getQty(), s->getQty() ) ) );
+    fills.emplace_back( b, s, price, q );
+    auctionFill( bids, auction_bids, b, q );
+    auctionFill( asks, auction_asks, s, q );
+    left -= q;
+  }
+  // market orders don't survive into continuous trading
+  auctionKill(auction_bids);
+  auctionKill(auction_asks);
+  auction = false;
+  stats.uncrosses.add();
+  if ( !fills.empty() ) {
+    stats.trades.add( fills.size() );
+    mgr->publishTrades( symbol, fills.data(), fills.size() );
+    fills.clear();
+    last_trade = price;
+  }
+  publishTobChanges(auction_pre);
+  if ( qty ) {
+    triggerStops( price, price );
+  }
+  return qty;
+}
+
+template <class Policy>
+template <class Side>
+Order* BasicOrderBook<Policy>::auctionFront( Side& side, level_t& market ) {
+  return market.empty() ? all_levels[side.best().l_ptr].getFrontOrder() : market.getFrontOrder();
+}
+
+/** qty off o, the front of auctionFront's queue */
+template <class Policy>
+template <class Side>
+void BasicOrderBook<Policy>::auctionFill( Side& side, level_t& market, Order *o, int qty ) {
+  bool from_market = !market.empty();
+  level_id_t lvl_id = side.empty() ? level_id_t(0) : side.best().l_ptr;
+  level_t& lvl = from_market ? market : all_levels[lvl_id];
+  if ( qty < o->getQty() ) {
+    lvl.fillFront(qty);
+  } else {
+    lvl.popFront();
+    o->setQty(0);
+    mgr->retireOrder(o);
+    stats.live_orders.sub();
+  }
+  if ( from_market ) {
+    return;
+  }
+  if ( lvl.empty() ) {
+    side.eraseAt( side.size() - 1 );
+    all_levels.free(lvl_id);
+    stats.levels_destroyed.add();
+    stats.live_levels.sub();
+  } else {
+    side.addQty( side.size() - 1, -qty );
+  }
+}
+
+template <class Policy>
+void BasicOrderBook<Policy>::auctionKill( level_t& market ) {
+  while ( !market.empty() ) {
+    Order *o = market.popFront();
+    stats.orders_cancelled.add();
+    stats.live_orders.sub();
+    mgr->retireOrder(o);
   }
 }
 
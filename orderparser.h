@@ -1,9 +1,9 @@
 #ifndef ORDERPARSER_H
 #define ORDERPARSER_H
 
+#include <cstdlib>
 #include <string>
 #include <vector>
-#include <iostream>
 #include <boost/algorithm/string.hpp>
 
 #include "order.h"
@@ -15,30 +15,75 @@ using std::vector;
    OrderParser takes a line of entry and returns a new order of the approriate type
 
    input formats:
-   New order   : 'N', user(int), symbol(string), price(int), qty(int), side(B or S), userOrderId(int)
-   Cancel Order: 'C', userOrderId(int)
+   New order   : 'N', user(int), symbol(string), price(int), qty(int), side(B or S), userOrderId(int) [, minQty(int) [, stopPrice(int)]]
+   Cancel Order: 'C', user(int), userOrderId(int)
+   Reduce Order: 'D', user(int), userOrderId(int), qty(int)           new lower qty, keeps priority
+   Replace     : 'R', user(int), userOrderId(int), price(int), qty(int) new price and qty, loses priority
+   Mass cancel : 'X', user(int) [, symbol(string)]  every live order of the user, optionally only in symbol
+   Auction     : 'Q', symbol(string) [, messages(int)]  call auction in symbol, uncrossed after that many more messages
+   Uncross     : 'U', symbol(string)                    uncross symbol's auction now
    Flush OB:   'F', <None>
 
    Notes: price 0 is for market order, non zero is limit order
+   optional minQty must be available immediately or the order is killed, minQty == qty is fill-or-kill
+   optional stopPrice holds the order back until a trade at or through it ( at or above for a buy,
+   at or below for a sell ), it then enters as a market order for price 0 or a limit order otherwise
    Between scenarios flush order books
 
 */
 class OrderParser {
 public:
-  // return a pointer, NULL if invalid
+  /** never NULL: a line that isn't one of the above, one missing a
+      field or with a number that isn't one comes back as an eINVALID
+      order carrying whatever user and order id could be read, which
+      the manager rejects as malformed ( see reject.h ) */
   static Order* parse(const string& input);
+
+private:
+  /** strs[i] as an int, ok cleared if there's no such field or it
+      doesn't start with a number */
+  static int field(const vector<string>& strs, size_t i, bool& ok);
+  static Order* malformed(const vector<string>& strs, Order::OrderType ot);
 };
 
-Order* OrderParser::parse(const string& input) {
+inline int OrderParser::field(const vector<string>& strs, size_t i, bool& ok) {
+  if ( i >= strs.size() ) {
+    ok = false;
+    return 0;
+  }
+  const char *s = strs[i].c_str();
+  char *end;
+  long v = std::strtol(s, &end, 10);
+  if ( end == s ) {
+    ok = false;
+  }
+  return int(v);
+}
+
+/** the user is the first field and the order id is where the type
+    keeps it, each only if it's there */
+inline Order* OrderParser::malformed(const vector<string>& strs, Order::OrderType ot) {
+  bool ok = true;
+  int user = ot == Order::eAUCTION || ot == Order::eUNCROSS ? 0 : field(strs, 1, ok);
+  size_t at = ot == Order::eNEW ? 6
+            : ot == Order::eCANCEL || ot == Order::eREDUCE || ot == Order::eREPLACE ? 2 : 0;
+  int uoid = at ? field(strs, at, ok) : 0;
+  if ( !ok ) {
+    user = uoid = 0;
+  }
+  return new Order(Order::eINVALID, uoid, user);
+}
+
+inline Order* OrderParser::parse(const string& input) {
   vector<string> strs;
   boost::split(strs, input, boost::is_any_of(","));
 
   Order::OrderType ot = Order::GetOrderType(strs[0][0]);
   if ( strs[0].size() != 1 || ot == Order::eINVALID || ot == Order::eLAST ) {
-    std::cerr << "Invalid Order Type!" << std::endl;
-    return NULL;
+    return malformed(strs, Order::eINVALID);
   }
 
+  bool ok = true;
   Order *result;
   switch (ot) {
     case Order::eFLUSH:
@@ -47,26 +92,76 @@ Order* OrderParser::parse(const string& input) {
     case Order::eCANCEL:
       result = Order::buildOrder(
         ot,
-        std::stoi(strs[1]), //user
-        std::stoi(strs[2]) //uoid
+        field(strs, 2, ok), //uoid
+        field(strs, 1, ok) //user
+        );
+      break;
+    case Order::eREDUCE:
+      result = Order::buildOrder(
+        ot,
+        field(strs, 2, ok), //uoid
+        field(strs, 1, ok), //user
+        0, //price
+        field(strs, 3, ok) //qty
+        );
+      break;
+    case Order::eMASS_CANCEL:
+      result = Order::buildOrder(
+        ot,
+        0, //uoid
+        field(strs, 1, ok), //user
+        0, 0, false,
+        strs.size() > 2 ? strs[2] : "" //symbol
+        );
+      break;
+    case Order::eAUCTION:
+    case Order::eUNCROSS:
+      ok = strs.size() > 1 && !strs[1].empty();
+      result = Order::buildOrder(
+        ot,
+        0, 0, 0,
+        ot == Order::eAUCTION && strs.size() > 2 ? field(strs, 2, ok) : 0, //messages
+        false,
+        ok ? strs[1] : "" //symbol
+        );
+      break;
+    case Order::eREPLACE:
+      result = Order::buildOrder(
+        ot,
+        field(strs, 2, ok), //uoid
+        field(strs, 1, ok), //user
+        field(strs, 3, ok), //price
+        field(strs, 4, ok) //qty
         );
       break;
     case Order::eNEW:
+      ok = strs.size() > 6 && !strs[2].empty() && !strs[5].empty()
+        && ( strs[5][0] == 'B' || strs[5][0] == 'S' );
       result = Order::buildOrder(
         ot,
-        std::stoi(strs[6]), //uoid
-        std::stoi(strs[1]), //user
-        std::stoi(strs[3]), //price
-        std::stoi(strs[4]), //qty
-        strs[5][0] == 'B' ? true : false, //side
-        strs[2] //symbol
+        field(strs, 6, ok), //uoid
+        field(strs, 1, ok), //user
+        field(strs, 3, ok), //price
+        field(strs, 4, ok), //qty
+        ok && strs[5][0] == 'B', //side
+        ok ? strs[2] : "" //symbol
         );
+      if ( strs.size() > 7 ) {
+        result->setMinQty( field(strs, 7, ok) );
+      }
+      if ( strs.size() > 8 ) {
+        result->setStopPrice( field(strs, 8, ok) );
+      }
       break;
     default: //unreachable as its prehandled
       result = NULL;
       break;
   }
 
+  if ( !ok ) {
+    delete result;
+    return malformed(strs, ot);
+  }
   return result;
 }
 
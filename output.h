@@ -0,0 +1,128 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#include "cwfq.h"
+#include "reject.h"
+
+using std::string;
+
+/** Binary engine output for readers in other processes
+
+    the same acks, rejects, trades and TOB changes that are written to cout, as
+    fixed size records pushed into an OutputRing the engine places in
+    shared memory ( see shm.h and demo --shm-out ).  any number of
+    readers map the ring read only and follow it with their own
+    cursors, see CWFQ::BroadcastRing.  a reader too slow to keep up is
+    overwritten rather than slowing the engine and finds out through
+    its cursor's lost count.
+
+    unlike the text lines trades and TOB records name their symbol,
+    truncated to SYMBOL_LEN bytes and NUL padded.
+*/
+struct OutputRecord {
+  static const size_t SYMBOL_LEN = 16;
+
+  char type;        // 'A' ack, 'R' reject, 'T' trade, 'B' top of book
+  char side;        // TOB: 'B' or 'S'
+  char symbol[SYMBOL_LEN];
+  char reason;      // reject: a RejectReason
+  int32_t price;    // trade price, TOB price or 0 for an empty side
+  int64_t qty;
+  int32_t user;     // ack, reject: the order's user and id, trade: the buyer's
+  int32_t oid;
+  int32_t sell_user;
+  int32_t sell_oid;
+
+  static OutputRecord ack( int user, int oid ) {
+    OutputRecord r = make('A', "");
+    r.user = user;
+    r.oid = oid;
+    return r;
+  }
+
+  static OutputRecord reject( int user, int oid, int reason ) {
+    OutputRecord r = make('R', "");
+    r.reason = char(reason);
+    r.user = user;
+    r.oid = oid;
+    return r;
+  }
+
+  static OutputRecord trade( const string& symbol, int buy_user, int buy_oid,
+                             int sell_user, int sell_oid, int price, int qty ) {
+    OutputRecord r = make('T', symbol);
+    r.price = price;
+    r.qty = qty;
+    r.user = buy_user;
+    r.oid = buy_oid;
+    r.sell_user = sell_user;
+    r.sell_oid = sell_oid;
+    return r;
+  }
+
+  static OutputRecord tob( const string& symbol, char side, int price, int64_t qty ) {
+    OutputRecord r = make('B', symbol);
+    r.side = side;
+    r.price = qty != 0 ? price : 0;
+    r.qty = price != 0 ? qty : 0;
+    return r;
+  }
+
+  string getSymbol() const { return string( symbol, strnlen(symbol, SYMBOL_LEN) ); }
+
+private:
+  static OutputRecord make( char type, const string& symbol ) {
+    OutputRecord r;
+    memset( &r, 0, sizeof(r) );
+    r.type = type;
+    memcpy( r.symbol, symbol.data(), symbol.size() < SYMBOL_LEN ? symbol.size() : SYMBOL_LEN );
+    return r;
+  }
+};
+static_assert( sizeof(OutputRecord) == 48, "an OutputRecord and its stamp fit a 64 byte slot" );
+
+/** r as the matcher writes it to cout, with symbols the symbol goes
+    in front of a trade's users and a TOB's side */
+inline void formatRecord( std::ostream& out, const OutputRecord& r, bool symbols=false ) {
+  switch ( r.type ) {
+    case 'A':
+      out << "A," << r.user << "," << r.oid << "\n";
+      break;
+    case 'R':
+      out << "R," << r.user << "," << r.oid << "," << rejectReasonName(r.reason) << "\n";
+      break;
+    case 'T':
+      out << "T,";
+      if ( symbols ) {
+        out << r.getSymbol() << ",";
+      }
+      out << r.user << "," << r.oid << "," << r.sell_user << "," << r.sell_oid << ","
+          << r.price << "," << r.qty << "\n";
+      break;
+    case 'B':
+      out << "B,";
+      if ( symbols ) {
+        out << r.getSymbol() << ",";
+      }
+      out << r.side << ",";
+      if ( r.price != 0 ) {
+        out << r.price << "," << r.qty << "\n";
+      } else {
+        out << "-,-\n";
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+/** 64k slots of one cache line each, a 48 byte OutputRecord and its
+    sequence stamp, about 4MB */
+using OutputRing = CWFQ::BroadcastRing<OutputRecord, 65536>;
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+using std::string;
+
+/** Thread and memory placement for the pipeline
+
+    pinThread keeps a pipeline thread on one core so the scheduler
+    never migrates it away from its caches.
+
+    MemConfig says where a thread's large allocations ( the order and
+    level pools, the rings ) come from.  With huge_pages they are
+    mapped on 2MB pages, explicitly reserved ones ( MAP_HUGETLB ) if
+    the box has any and transparent huge pages otherwise, which cuts
+    the TLB entries a deep book walks through by 512x.  numa_node binds
+    the pages to a node, -1 leaves them to the first touch which is
+    already local if the owning thread was pinned before allocating.
+    prefault touches every page up front so the first burst of orders
+    doesn't pay for page faults.
+
+    everything here degrades to a plain allocation off linux or when
+    the kernel refuses, a placement failure is never fatal.  plain or
+    mapped, storage always starts on a cache line so pooled objects
+    that are laid out by the line ( see Order ) stay that way.
+*/
+struct MemConfig {
+  bool huge_pages;
+  bool prefault;
+  int numa_node;
+
+  MemConfig( bool huge_pages=false, bool prefault=false, int numa_node=-1 )
+    : huge_pages(huge_pages)
+    , prefault(prefault)
+    , numa_node(numa_node)
+    {}
+
+  /** nothing asked for, use the ordinary heap */
+  bool isDefault() const { return !huge_pages && !prefault && numa_node < 0; }
+};
+
+namespace Placement {
+
+const size_t PAGE = 4096;
+const size_t HUGE_PAGE = size_t(2) << 20;
+
+/** cpu is one of this machine's, numbered from 0 */
+inline bool cpuExists( int cpu ) {
+  return cpu >= 0 && unsigned(cpu) < std::thread::hardware_concurrency();
+}
+
+/** pin the calling thread to cpu, false if that wasn't possible or
+    there's no such cpu */
+inline bool pinThread( int cpu ) {
+#ifdef __linux__
+  if ( !cpuExists(cpu) ) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+/** restores the calling thread's cpu mask, as it was when the guard
+    was made, when it goes out of scope */
+class AffinityGuard {
+public:
+#ifdef __linux__
+  AffinityGuard() : saved( pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0 ) {}
+  ~AffinityGuard() {
+    if ( saved ) {
+      pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+    }
+  }
+private:
+  cpu_set_t mask;
+  bool saved;
+#endif
+};
+
+/** NUMA node cpu belongs to, -1 if unknown */
+inline int cpuNode( int cpu ) {
+#ifdef __linux__
+  for ( int node = 0; node < 64; ++node ) {
+    string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpu" + std::to_string(cpu);
+    if ( access( path.c_str(), F_OK ) == 0 ) {
+      return node;
+    }
+  }
+#else
+  (void)cpu;
+#endif
+  return -1;
+}
+
+/** bytes actually mapped for a request of bytes */
+inline size_t mappedSize( size_t bytes, const MemConfig& mem ) {
+  size_t unit = mem.huge_pages ? HUGE_PAGE : PAGE;
+  return ( bytes + unit - 1 ) / unit * unit;
+}
+
+/** raw storage placed per mem, release with the same bytes and mem */
+inline void* allocate( size_t bytes, const MemConfig& mem ) {
+  if ( mem.isDefault() ) {
+    return ::operator new( bytes, std::align_val_t(CACHE_LINE) );
+  }
+#ifdef __linux__
+  size_t len = mappedSize(bytes, mem);
+  void *p = MAP_FAILED;
+  if ( mem.huge_pages ) {
+    p = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+  }
+  if ( p == MAP_FAILED ) {
+    p = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( p == MAP_FAILED ) {
+      throw std::bad_alloc();
+    }
+    if ( mem.huge_pages ) {
+      madvise( p, len, MADV_HUGEPAGE );
+    }
+  }
+  if ( mem.numa_node >= 0 && mem.numa_node < 64 ) {
+    // MPOL_PREFERRED, straight to the syscall so we don't need libnuma
+    unsigned long mask = 1UL << mem.numa_node;
+    syscall( SYS_mbind, p, len, 1, &mask, 64, 0 );
+  }
+  if ( mem.prefault ) {
+    volatile char *c = static_cast<char*>(p);
+    for ( size_t off = 0; off < len; off += PAGE ) {
+      c[off] = 0;
+    }
+  }
+  return p;
+#else
+  return ::operator new( bytes, std::align_val_t(CACHE_LINE) );
+#endif
+}
+
+inline void release( void *p, size_t bytes, const MemConfig& mem ) {
+  if ( p == NULL ) {
+    return;
+  }
+#ifdef __linux__
+  if ( !mem.isDefault() ) {
+    munmap( p, mappedSize(bytes, mem) );
+    return;
+  }
+#endif
+  (void)bytes;
+  ::operator delete( p, std::align_val_t(CACHE_LINE) );
+}
+
+/** a single object, eg a ring, placed per mem */
+template <class T>
+T* create( const MemConfig& mem ) {
+  void *p = allocate( sizeof(T), mem );
+  try {
+    return new (p) T();
+  } catch ( ... ) {
+    release( p, sizeof(T), mem );
+    throw;
+  }
+}
+
+template <class T>
+void destroy( T *t, const MemConfig& mem ) {
+  if ( t ) {
+    t->~T();
+    release( t, sizeof(T), mem );
+  }
+}
+
+}
+
+#endif
@@ -2,70 +2,153 @@
 #define POOL_H
 
 #include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <vector>
 
+#include "placement.h"
+
 using std::vector;
 
-/** A custom pooling allocator of fixed size
+/** A custom pooling allocator of runtime sized, chunked capacity
 
-    using a non-shrinking vector as the pool source
+    using a list of fixed size chunks as the pool source
     using a LIFO stack as the free list
 
-    if there are no free locations return the reserved id 0
-
     If free location, pop address off free list
     Free objects by pushing address to free list
 
-    Because I won't resize pointers are stable but I won't rely on
-    them as such in case we want to grow. ( Though I would generally suggest a skip list in that approach )
+    Chunks are only ever appended, never reallocated or moved, so both
+    T* and ptr_t handles stay valid as the pool grows.  Chunk size is
+    rounded up to a power of two so a handle splits into chunk and
+    offset with a shift and a mask instead of a divide.
+
+    capacity is the number of slots we keep warm, max_size is the hard
+    ceiling after which alloc throws std::bad_alloc ( defaults to
+    unlimited ).  clear() shrinks storage back to the larger of the
+    reserved capacity and the high water mark of the session that just
+    ended, so a one-off burst doesn't pin memory forever but a
+    consistently deep book keeps its chunks warm between flushes.
 
-    Performance: should be very stable and O(1) since its just pop and decrement and dereference ( which is likely into the cache ).  Deallocation is just a decrement and a write to memory
+    clear() does not touch the objects, it only forgets them, so it
+    costs nothing per live object.  alloc() hands a slot back exactly
+    as it was last left and it is up to the caller to reinitialize it.
+
+    chunks are placed per the MemConfig ( see placement.h ), with huge
+    pages a chunk is grown to fill at least one whole huge page.
+
+    Performance: should be very stable and O(1) since its just pop and decrement and dereference ( which is likely into the cache ).  Deallocation is just a decrement and a write to memory.  Growth costs one chunk allocation every chunk_size allocs.
 
 */
 
-template <class T, typename ptr_t, size_t SIZE>
+template <class T, typename ptr_t>
   class pool
 {
 public:
   using size_ptr = typename std::underlying_type<ptr_t>::type;
-  vector<T> t_allocated;
-  vector<ptr_t> t_free;
+  static const size_t UNLIMITED = ~size_t(0);
 
   /* CTOR */
-  pool() {
-    clear();
+  explicit pool( size_t capacity=16, size_t max_size=UNLIMITED, size_t chunk_size=0, const MemConfig& mem=MemConfig() )
+    : reserved(capacity)
+    , max_size(max_size)
+    , used(0)
+    , mem(mem)
+  {
+    size_t want = chunk_size ? chunk_size : capacity;
+    if ( mem.huge_pages && want * sizeof(T) < Placement::HUGE_PAGE ) {
+      want = ( Placement::HUGE_PAGE + sizeof(T) - 1 ) / sizeof(T);
+    }
+    shift = 0;
+    while ( (size_t(1) << shift) < want ) {
+      ++shift;
+    }
+    mask = (size_t(1) << shift) - 1;
+    reserve(capacity);
   }
 
   /* getters */
-  T* get(ptr_t idx) { return &t_allocated[size_ptr(idx)]; }
-  T& operator[](ptr_t idx) { return t_allocated[size_ptr(idx)]; }
+  T* get(ptr_t idx) { return &(*this)[idx]; }
+  T& operator[](ptr_t idx) {
+    size_t i = size_ptr(idx);
+    return chunks[i >> shift][i & mask];
+  }
 
   ptr_t alloc(void) {
     if ( !t_free.empty() ) {
       auto res = ptr_t( t_free.back() );
       t_free.pop_back();
       return res;
-    } else {
-      //only insert until we reach size
-      if ( t_allocated.size() <= SIZE ) {
-        auto res = ptr_t( t_allocated.size() );
-        t_allocated.push_back(T());
-        return res;
-      } else
-      {
-        throw std::bad_alloc();
-      }
     }
+    if ( used >= max_size ) {
+      throw std::bad_alloc();
+    }
+    if ( used == capacity() ) {
+      grow();
+    }
+    return ptr_t( used++ );
   }
 
   void free( ptr_t idx ) { t_free.push_back(idx); }
 
+  /** make sure at least n slots are backed by storage */
+  void reserve( size_t n ) {
+    while ( capacity() < n ) {
+      grow();
+    }
+    t_free.reserve(n);
+  }
+
+  /** release every object and shrink back to max(reserved, high water mark) */
   void clear() {
-    t_allocated.clear();
-    t_allocated.reserve(SIZE);
+    size_t keep = used > reserved ? used : reserved;
+    size_t keep_chunks = (keep + mask) >> shift;
+    if ( chunks.size() > keep_chunks ) {
+      chunks.resize(keep_chunks);
+    }
+    used = 0;
     t_free.clear();
-    t_free.reserve(SIZE);
   }
+
+  size_t capacity() const { return chunks.size() << shift; }
+  size_t chunkSize() const { return mask + 1; }
+  size_t highWater() const { return used; }
+  size_t size() const { return used - t_free.size(); }
+  /** storage held, in use or not */
+  size_t bytes() const { return capacity() * sizeof(T) + t_free.capacity() * sizeof(ptr_t); }
+
+private:
+  /** destroys a chunk's objects and hands its storage back */
+  struct ChunkFree {
+    size_t n;
+    MemConfig mem;
+    void operator()( T *p ) const {
+      for ( size_t i = 0; i < n; ++i ) {
+        p[i].~T();
+      }
+      Placement::release( p, n * sizeof(T), mem );
+    }
+  };
+  using chunk_t = std::unique_ptr<T[], ChunkFree>;
+
+  void grow() {
+    size_t n = mask + 1;
+    T *p = static_cast<T*>( Placement::allocate( n * sizeof(T), mem ) );
+    for ( size_t i = 0; i < n; ++i ) {
+      new (&p[i]) T();
+    }
+    chunks.emplace_back( p, ChunkFree{n, mem} );
+  }
+
+  size_t shift;
+  size_t mask;
+  size_t reserved;
+  size_t max_size;
+  size_t used; // slots handed out since the last clear, ie the high water mark
+  MemConfig mem;
+  vector<chunk_t> chunks;
+  vector<ptr_t> t_free;
 };
 
 #endif
@@ -0,0 +1,108 @@
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "cwfq.h"
+#include "output.h"
+#include "placement.h"
+
+/** Text output written on its own thread
+
+    without a Publisher the matcher writes every line to cout itself
+    and a slow stdout holds up matching.  with one the matcher only
+    pushes OutputRecords into a RingFifo and the publisher thread turns
+    them into the same text with drain().
+
+    acks, rejects and trades are never dropped.  the matcher never
+    allocates for them: whatever doesn't fit waits in a backlog of a
+    fixed number of records, sized when the publisher is made and only
+    touched by the matcher, and goes into the ring ahead of anything
+    newer as soon as there's room.  only once the backlog is full as
+    well does the matcher wait for the publisher thread to make room, a
+    last resort counted in getStalls(), so size the backlog for the
+    longest stall the reader should ride out without holding up
+    matching.  TOB is state rather than news, so while the ring is
+    congested ( past HIGH_WATER or with a backlog ) each book
+    holds its latest TOB per side instead of publishing it, one update
+    overwriting the last, and publishes it once the congestion clears.
+    the updates overwritten are counted in BookStats::tob_conflated.  a
+    reader sees every ack and trade, in order, and a TOB that may skip
+    intermediate states but always ends up at the book's.
+
+    the output ring isn't affected, it never blocks.  neither is the
+    event log, which does block matching for a write at each block
+    boundary ( see EventLog::Writer ).
+*/
+class Publisher {
+public:
+  using ring_t = CWFQ::RingFifo<OutputRecord, 4095>;
+  static const size_t HIGH_WATER = ring_t::Capacity / 2;
+  static const size_t BACKLOG = 16 * ring_t::Capacity;
+
+  /** mem places the ring, on the publisher thread's node */
+  explicit Publisher( size_t backlog_size=BACKLOG, const MemConfig& mem=MemConfig() )
+    : mem(mem), ring( Placement::create<ring_t>(mem) ), backlog(backlog_size), head(0), waiting(0)
+    , backlogged(0), stalls(0) {}
+  ~Publisher() { Placement::destroy(ring, mem); }
+  Publisher(const Publisher&) = delete;
+  Publisher& operator=(const Publisher&) = delete;
+
+  /** matcher side: r is published, now or once there's room.  with
+      the backlog full this waits on the publisher thread */
+  void push( const OutputRecord& r ) {
+    if ( flush() && ring->push(r) ) {
+      return;
+    }
+    if ( waiting == backlog.size() ) {
+      ++stalls;
+      do {
+        std::this_thread::yield();
+      } while ( flush() == false && waiting == backlog.size() );
+    }
+    backlog[ (head + waiting) % backlog.size() ] = r;
+    ++waiting;
+    ++backlogged;
+  }
+  /** move what the backlog can into the ring, true if it's empty */
+  bool flush() {
+    while ( waiting > 0 && ring->push( backlog[head] ) ) {
+      head = ( head + 1 ) % backlog.size();
+      --waiting;
+    }
+    return waiting == 0;
+  }
+  /** TOB should be held back rather than pushed */
+  bool congested() const { return waiting > 0 || ring->wasSize() >= HIGH_WATER; }
+
+  /** publisher side: write up to max records to out, returns how many */
+  size_t drain( std::ostream& out, size_t max=SIZE_MAX ) {
+    OutputRecord r;
+    size_t n = 0;
+    while ( n < max && ring->pop(r) ) {
+      formatRecord( out, r );
+      ++n;
+    }
+    return n;
+  }
+
+  /** records that had to wait in the backlog */
+  uint64_t getBacklogged() const { return backlogged; }
+  /** pushes that found the backlog full and waited for the ring */
+  uint64_t getStalls() const { return stalls; }
+  const RingStats& getRingStats() const { return ring->getStats(); }
+
+private:
+  MemConfig mem;
+  ring_t *ring;
+  std::vector<OutputRecord> backlog; // a circular buffer, waiting records from head
+  size_t head;
+  size_t waiting;
+  uint64_t backlogged;
+  uint64_t stalls;
+};
+
+#endif
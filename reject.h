@@ -0,0 +1,68 @@
+#ifndef REJECT_H
+#define REJECT_H
+
+#include "risk.h"
+
+/** Why a message was refused
+
+    every refusal is published like an ack, as an R line naming the
+    message's user and order id and the reason, and is pushed to the
+    output ring, the event log and the publisher like any other output.
+    a refused message is never acked, book_full aside.  the manager
+    counts refusals per reason in ManagerStats::reject_reasons.
+
+    the risk gate's reasons keep their RiskReason values, the rest
+    follow on from them:
+
+      unknown_order  a cancel, reduce or replace naming no live order
+      duplicate_id   a new order reusing the id of one of the user's
+                     live orders
+      no_liquidity   a market order with nothing on the other side to
+                     trade against, outside an auction.  for a stop
+                     that's when it triggers, and for a replace to a
+                     market order when it's applied, after the ack, and
+                     the order is gone
+      qty_up         a reduce to the order's qty or more, use a replace
+      min_qty        an order whose minimum qty ( all of it for
+                     fill-or-kill ) couldn't be filled straight away.
+                     it comes after the order's ack and the order is
+                     gone without having traded
+      no_auction     an uncross of a symbol that isn't in an auction
+      malformed      a line the parser couldn't make a message of, see
+                     OrderParser::parse, or a gateway record that
+                     wasn't accepted, see Gateway::poll
+      book_full      an order, or the remainder of one that traded,
+                     needing a new price level in a book already at
+                     its max_levels or fixed depth ( see BookConfig ).
+                     it comes after the order's ack and any trades, and
+                     the order is gone.  for a replace the order it
+                     replaced is gone as well
+*/
+enum RejectReason {
+  eREJECT_NONE = eRISK_OK,
+  eREJECT_UNKNOWN_ORDER = eRISK_REASONS,
+  eREJECT_DUPLICATE_ID,
+  eREJECT_NO_LIQUIDITY,
+  eREJECT_QTY_UP,
+  eREJECT_MIN_QTY,
+  eREJECT_NO_AUCTION,
+  eREJECT_MALFORMED,
+  eREJECT_BOOK_FULL,
+  eREJECT_REASONS
+};
+
+inline const char* rejectReasonName( int r ) {
+  switch ( r ) {
+    case eREJECT_UNKNOWN_ORDER: return "unknown_order";
+    case eREJECT_DUPLICATE_ID:  return "duplicate_id";
+    case eREJECT_NO_LIQUIDITY:  return "no_liquidity";
+    case eREJECT_QTY_UP:        return "qty_up";
+    case eREJECT_MIN_QTY:       return "min_qty";
+    case eREJECT_NO_AUCTION:    return "no_auction";
+    case eREJECT_MALFORMED:     return "malformed";
+    case eREJECT_BOOK_FULL:     return "book_full";
+    default:                    return riskReasonName( RiskReason(r) );
+  }
+}
+
+#endif
@@ -0,0 +1,114 @@
+/* Market by order feed replay benchmark
+
+   loads an itch.h feed file ( eg ./gen --format itch > feed.itch )
+   into memory and pushes it through the Decoder into a FeedHandler,
+   timing decode and book update together the way a feed handler sees
+   them at the open when the events arrive back to back.
+
+   usage: ./replay [--reps n] [--cpu n] [--huge-pages] feed.itch
+
+   each repetition starts from empty books, the best one is reported
+   along with the top of every book it left behind so two runs over
+   the same feed can be compared.
+*/
+
+//system headers
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+//my headers
+#include "feedhandler.h"
+#include "itch.h"
+#include "placement.h"
+
+using std::string;
+using std::vector;
+
+namespace {
+
+struct Options {
+  int reps = 3;
+  int cpu = -1;
+  MemConfig mem;
+  string file;
+};
+
+bool parseArgs( int argc, char **argv, Options& opt ) {
+  for ( int i = 1; i < argc; ++i ) {
+    string key = argv[i];
+    if ( key == "--reps" && i + 1 < argc ) {
+      opt.reps = std::atoi(argv[++i]);
+    } else if ( key == "--cpu" && i + 1 < argc ) {
+      opt.cpu = std::atoi(argv[++i]);
+    } else if ( key == "--huge-pages" ) {
+      opt.mem.huge_pages = true;
+    } else if ( key[0] == '-' || !opt.file.empty() ) {
+      return false;
+    } else {
+      opt.file = key;
+    }
+  }
+  return !opt.file.empty() && opt.reps > 0;
+}
+
+}
+
+int main( int argc, char **argv ) {
+  Options opt;
+  if ( !parseArgs(argc, argv, opt) ) {
+    std::cerr << "usage: replay [--reps n] [--cpu n] [--huge-pages] feed.itch" << std::endl;
+    return 1;
+  }
+  std::ifstream in( opt.file, std::ios::binary );
+  if ( !in ) {
+    std::cerr << "can't open " << opt.file << std::endl;
+    return 1;
+  }
+  string feed( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+  if ( opt.cpu >= 0 && !Placement::pinThread(opt.cpu) ) {
+    std::cerr << "couldn't pin to cpu " << opt.cpu << ", running unpinned" << std::endl;
+  }
+
+  double best = 0;
+  uint64_t events = 0;
+  std::unique_ptr<FeedHandler> fh;
+  for ( int r = 0; r < opt.reps; ++r ) {
+    fh.reset( new FeedHandler(opt.mem) );
+    Itch::Decoder dec;
+    auto t0 = std::chrono::steady_clock::now();
+    size_t used = dec.decode( feed.data(), feed.size(), *fh );
+    auto t1 = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    if ( r == 0 || ns < best ) {
+      best = ns;
+    }
+    events = dec.getMessages();
+    if ( used != feed.size() || dec.getSkipped() ) {
+      std::cerr << "warning: " << feed.size() - used << " trailing bytes, "
+                << dec.getSkipped() << " messages skipped" << std::endl;
+    }
+  }
+
+  const FeedStats& s = fh->getStats();
+  std::cout << "events " << events << " bytes " << feed.size()
+            << " ns/event " << ( events ? best / events : 0 )
+            << " Mevents/s " << ( best > 0 ? events * 1000.0 / best : 0 ) << std::endl;
+  std::cout << "adds " << s.adds.get() << " executions " << s.executions.get()
+            << " cancels " << s.cancels.get() << " deletes " << s.deletes.get()
+            << " replaces " << s.replaces.get() << " bad_refs " << s.bad_refs.get()
+            << " live " << s.live_orders.get() << std::endl;
+  std::map<string, OrderBook*> books( fh->getBooks().begin(), fh->getBooks().end() );
+  for ( auto it : books ) {
+    OrderBook *b = it.second;
+    std::cout << b->getSymbol() << " " << b->getBestBidQty() << "@" << b->getBestBidPrice()
+              << " " << b->getBestOfferQty() << "@" << b->getBestOfferPrice() << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,389 @@
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "cwfq.h"
+#include "order.h"
+#include "ordermanager.h"
+#include "shm.h"
+
+using std::string;
+
+/** Hot standby fed the primary's sequenced input
+
+    the primary numbers every message it handles and forwards it, before
+    handling it, through a Replica::Channel in shared memory ( see shm.h )
+    to a standby that handles the same messages in the same order with
+    its own OrderManager, its output thrown away.  matching is
+    deterministic so the two stay in lockstep.
+
+    every CHECK_INTERVAL messages the primary sends the checksum of its
+    books ( OrderManager::checksum ) as of that sequence, and the
+    standby compares it with its own and acks the sequence with its own
+    checksum, so both ends find out about a divergence.  acks otherwise
+    carry how far the standby has got, the primary's getAcked().
+
+    both ends beat a heartbeat in the channel.  the primary's is beaten
+    by the matching thread itself, from handleBatch and poll, so a
+    matcher wedged in a message stops beating.  an idle primary has to
+    keep calling poll to not be taken for dead.  a standby that sees no
+    beat for its timeout takes over after the primary's sequence number
+    of the last message it applied ( getLastSeq ), which is never before
+    the last it acked.  a primary that finishes normally says so
+    instead.
+
+    replication is synchronous in the sense that a primary whose channel
+    is full waits for the standby.  a standby that stops beating for
+    DEAD_NS while the primary waits is dropped and the primary goes on
+    alone.  a standby has to be attached before the first message, one
+    that finds it missed any refuses to follow.
+
+    a Record carries SYMBOL_LEN bytes of symbol, so a message naming a
+    longer one would reach the standby as a different symbol.  the
+    primary refuses it instead, turning it into a malformed message
+    ( see reject.h ) that both ends reject alike, counted in
+    getRefused().
+
+    the two ends need the same build, the checksum hashes symbols with
+    std::hash.
+*/
+namespace Replica {
+
+const uint64_t CHECK_INTERVAL = 1024;
+const uint64_t BEAT_NS = 1000000;      // 1ms, how often an idle primary should poll
+const uint64_t DEAD_NS = 20000000;     // 20ms without a beat
+
+inline uint64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/** one input message, or the primary's checksum after a sequence */
+struct Record {
+  static const size_t SYMBOL_LEN = 16;
+
+  uint64_t seq;
+  uint64_t checksum; // 'K' only
+  char kind;         // 'M' message or 'K' checksum
+  int8_t type;       // Order::OrderType
+  bool buy;
+  char symbol[SYMBOL_LEN];
+  int32_t uoid;
+  int32_t user;
+  int32_t price;
+  int32_t qty;
+  int32_t min_qty;
+  int32_t stop_price;
+
+  /** o's symbol has to fit, see fits */
+  static Record message( uint64_t seq, const Order& o ) {
+    Record r = make( 'M', seq );
+    string symbol = o.getSymbol();
+    assert( fits(o) );
+    r.type = int8_t( o.getType() );
+    r.buy = o.getIsBuy();
+    memcpy( r.symbol, symbol.data(), symbol.size() < SYMBOL_LEN ? symbol.size() : SYMBOL_LEN );
+    r.uoid = o.getUserOrderId();
+    r.user = o.getUser();
+    r.price = o.getPrice();
+    r.qty = o.getQty();
+    r.min_qty = o.getMinQty();
+    r.stop_price = o.getStopPrice();
+    return r;
+  }
+
+  static bool fits( const Order& o ) { return o.getSymbol().size() <= SYMBOL_LEN; }
+
+  static Record check( uint64_t seq, uint64_t checksum ) {
+    Record r = make( 'K', seq );
+    r.checksum = checksum;
+    return r;
+  }
+
+  Order* toOrder() const {
+    Order *o = new Order( Order::OrderType(type), uoid, user, price, qty, buy,
+                          string( symbol, strnlen(symbol, SYMBOL_LEN) ) );
+    o->setMinQty(min_qty);
+    o->setStopPrice(stop_price);
+    return o;
+  }
+
+private:
+  static Record make( char kind, uint64_t seq ) {
+    Record r;
+    memset( &r, 0, sizeof(r) );
+    r.kind = kind;
+    r.seq = seq;
+    return r;
+  }
+};
+
+/** the standby has applied everything up to seq, when checked seq is
+    a check and checksum is the standby's own there */
+struct Ack {
+  uint64_t seq;
+  uint64_t checksum;
+  bool checked;
+};
+
+/** what the shared memory segment holds */
+struct Channel {
+  Channel() : primary_beat(0), standby_beat(0), primary_done(false) {}
+
+  CWFQ::RingFifo<Record, 65535> input;
+  CWFQ::RingFifo<Ack, 1023> acks;
+  std::atomic<uint64_t> primary_beat; // nowNs of the last beat
+  std::atomic<uint64_t> standby_beat;
+  std::atomic<bool> primary_done;     // stopped on purpose
+};
+
+class Primary {
+public:
+  /** creates the channel, replacing any old one */
+  explicit Primary( const string& name, uint64_t check_interval=CHECK_INTERVAL );
+  ~Primary();
+
+  bool isOpen() const { return chan != NULL; }
+
+  /** forward msgs[0..n) then have mgr handle them, in batches split so
+      the checksum is taken exactly at every check */
+  void handleBatch( OrderManager& mgr, Order **msgs, size_t n );
+  /** beat and take in the standby's acks, call it when idle as well */
+  void poll();
+
+  uint64_t getSeq() const { return seq; }
+  uint64_t getAcked() const { return acked; }
+  uint64_t getDiverged() const { return diverged; }
+  /** messages refused for a symbol a Record can't carry */
+  uint64_t getRefused() const { return refused; }
+  /** still replicating, false once the standby was dropped */
+  bool hasStandby() const { return !dropped; }
+
+private:
+  void send( const Record& r );
+  void beat() { chan->primary_beat.store( nowNs(), std::memory_order_release ); }
+
+  string name;
+  Channel *chan;
+  uint64_t interval;
+  uint64_t seq;
+  uint64_t acked;
+  uint64_t diverged;
+  uint64_t refused;
+  bool dropped;
+  // checksums sent and not yet acked, oldest first
+  std::deque<Ack> checks;
+};
+
+class Standby {
+public:
+  /** maps the primary's channel, isOpen() is false until it exists */
+  explicit Standby( const string& name );
+  ~Standby() { Shm::unmap(chan); }
+
+  bool isOpen() const { return chan != NULL; }
+
+  /** apply whatever the primary has forwarded to mgr, returns how many
+      messages.  stops following at the first gap */
+  size_t poll( OrderManager& mgr );
+
+  /** no beat from the primary for timeout ns */
+  bool primaryLost( uint64_t timeout=DEAD_NS ) const {
+    uint64_t beat = chan->primary_beat.load( std::memory_order_acquire );
+    uint64_t now = nowNs();
+    return now > beat && now - beat > timeout;
+  }
+  /** the primary finished normally and everything it sent is applied */
+  bool primaryDone() const { return chan->primary_done.load( std::memory_order_acquire ) && chan->input.wasEmpty(); }
+
+  uint64_t getApplied() const { return applied; }
+  /** the primary's sequence number of the last message applied, the
+      input resumes after it on a takeover */
+  uint64_t getLastSeq() const { return last_seq; }
+  uint64_t getDiverged() const { return diverged; }
+  bool isFollowing() const { return following; }
+
+private:
+  void apply( OrderManager& mgr );
+  void ack( uint64_t s, uint64_t checksum, bool checked );
+
+  Channel *chan;
+  uint64_t applied;
+  uint64_t last_seq;
+  uint64_t pending_seq; // the last of the pending messages
+  uint64_t diverged;
+  bool following;
+  Order *batch[64];
+  size_t pending;
+};
+
+inline Primary::Primary( const string& name, uint64_t check_interval )
+  : name(name)
+  , chan( Shm::create<Channel>(name) )
+  , interval( check_interval ? check_interval : CHECK_INTERVAL )
+  , seq(0)
+  , acked(0)
+  , diverged(0)
+  , refused(0)
+  , dropped(false)
+{
+  if ( chan == NULL ) {
+    std::cerr << "Couldn't create the replica channel " << name << std::endl;
+    return;
+  }
+  beat();
+}
+
+inline Primary::~Primary() {
+  if ( chan == NULL ) {
+    return;
+  }
+  chan->primary_done.store( true, std::memory_order_release );
+  Shm::unmap(chan);
+  Shm::unlink(name);
+}
+
+inline void Primary::handleBatch( OrderManager& mgr, Order **msgs, size_t n ) {
+  if ( chan == NULL || dropped ) {
+    mgr.handleBatch(msgs, n);
+    return;
+  }
+  beat();
+  size_t i = 0;
+  while ( i < n ) {
+    size_t k = std::min( n - i, size_t( interval - seq % interval ) );
+    for ( size_t j = i; j < i + k; ++j ) {
+      if ( !Record::fits(*msgs[j]) ) {
+        ++refused;
+        *msgs[j] = Order( Order::eINVALID, msgs[j]->getUserOrderId(), msgs[j]->getUser() );
+      }
+      send( Record::message( ++seq, *msgs[j] ) );
+    }
+    mgr.handleBatch( msgs + i, k );
+    i += k;
+    if ( seq % interval == 0 && !dropped ) {
+      uint64_t sum = mgr.checksum();
+      checks.push_back( Ack{ seq, sum, true } );
+      send( Record::check(seq, sum) );
+    }
+  }
+  poll();
+}
+
+inline void Primary::send( const Record& r ) {
+  while ( !dropped && !chan->input.push(r) ) {
+    poll();
+    uint64_t beat = chan->standby_beat.load( std::memory_order_acquire );
+    uint64_t now = nowNs();
+    if ( now > beat && now - beat > DEAD_NS ) {
+      dropped = true;
+      std::cerr << "Standby stopped following at " << acked << ", going on without it" << std::endl;
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+inline void Primary::poll() {
+  if ( chan == NULL ) {
+    return;
+  }
+  beat();
+  Ack a;
+  while ( chan->acks.pop(a) ) {
+    acked = std::max( acked, a.seq );
+    if ( !a.checked ) {
+      continue;
+    }
+    while ( !checks.empty() && checks.front().seq < a.seq ) {
+      checks.pop_front();
+    }
+    if ( !checks.empty() && checks.front().seq == a.seq ) {
+      if ( checks.front().checksum != a.checksum ) {
+        ++diverged;
+        std::cerr << "Standby diverged by " << a.seq << std::endl;
+      }
+      checks.pop_front();
+    }
+  }
+}
+
+inline Standby::Standby( const string& name )
+  : chan( Shm::open<Channel>(name, true) )
+  , applied(0)
+  , last_seq(0)
+  , pending_seq(0)
+  , diverged(0)
+  , following(true)
+  , pending(0)
+{
+  if ( chan ) {
+    chan->standby_beat.store( nowNs(), std::memory_order_release );
+  }
+}
+
+inline size_t Standby::poll( OrderManager& mgr ) {
+  chan->standby_beat.store( nowNs(), std::memory_order_release );
+  if ( !following ) {
+    return 0;
+  }
+  uint64_t before = applied;
+  Record r;
+  while ( following && chan->input.pop(r) ) {
+    if ( r.kind == 'K' ) {
+      apply(mgr);
+      uint64_t sum = mgr.checksum();
+      if ( r.seq != applied || sum != r.checksum ) {
+        ++diverged;
+        std::cerr << "Diverged from the primary by " << r.seq << std::endl;
+      }
+      ack( applied, sum, true );
+      continue;
+    }
+    if ( r.seq != applied + pending + 1 ) {
+      apply(mgr);
+      following = false;
+      std::cerr << "Missed the primary's messages " << applied + 1 << " to " << r.seq - 1
+                << ", can't follow" << std::endl;
+      break;
+    }
+    batch[pending++] = r.toOrder();
+    pending_seq = r.seq;
+    if ( pending == 64 ) {
+      apply(mgr);
+    }
+  }
+  apply(mgr);
+  if ( applied != before ) {
+    ack( applied, 0, false );
+  }
+  return size_t( applied - before );
+}
+
+inline void Standby::apply( OrderManager& mgr ) {
+  if ( pending ) {
+    mgr.handleBatch(batch, pending);
+    applied += pending;
+    last_seq = pending_seq;
+    pending = 0;
+  }
+}
+
+/** a full ack ring only delays the primary learning how far we got */
+inline void Standby::ack( uint64_t s, uint64_t checksum, bool checked ) {
+  chan->acks.push( Ack{ s, checksum, checked } );
+}
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef RISK_H
+#define RISK_H
+
+#include <cstdint>
+
+/** Pre-trade risk limits checked inside the engine
+
+    every new order and every replace is checked against its user's
+    limits before it reaches the book, using counters the manager keeps
+    up to date as orders rest, fill and are cancelled rather than
+    anything summed at check time.  each check is a compare against a
+    number already in cache: the user's list for the symbol and the
+    user's totals are the ones the order is about to be linked onto
+    anyway, and the reference price is the end of the book's ladder.
+
+      max_order_qty    qty of the one order
+      max_notional     price * qty of the one order, a market order is
+                       valued at the opposite side's best
+      max_open_orders  the user's live orders over every symbol
+      max_position     the net position in the symbol if every open
+                       order on the order's side filled, ie a buy
+                       checks position + open buys + qty
+      price_band_bps   how far a limit price may reach through the
+                       reference: a buy above the best offer ( or best
+                       bid with no offers ) by more than this many basis
+                       points is refused, likewise a sell below the best
+                       bid.  an empty book has no reference
+
+    a limit of 0 is no limit.  a flush starts every counter over,
+    positions included, as a new session.
+
+    reduces and cancels only ever take risk off so they are never
+    refused.  a refused order is never acked or entered, the manager
+    publishes a reject naming the reason instead.
+*/
+struct RiskLimits {
+  int64_t max_order_qty;
+  int64_t max_notional;
+  int max_open_orders;
+  int64_t max_position;
+  int price_band_bps;
+
+  RiskLimits( int64_t max_order_qty=0, int64_t max_notional=0, int max_open_orders=0,
+              int64_t max_position=0, int price_band_bps=0 )
+    : max_order_qty(max_order_qty)
+    , max_notional(max_notional)
+    , max_open_orders(max_open_orders)
+    , max_position(max_position)
+    , price_band_bps(price_band_bps)
+    {}
+};
+
+enum RiskReason {
+  eRISK_OK = 0,
+  eRISK_ORDER_QTY,
+  eRISK_NOTIONAL,
+  eRISK_OPEN_ORDERS,
+  eRISK_POSITION,
+  eRISK_PRICE_BAND,
+  eRISK_REASONS
+};
+
+inline const char* riskReasonName( RiskReason r ) {
+  switch ( r ) {
+    case eRISK_ORDER_QTY:   return "max_qty";
+    case eRISK_NOTIONAL:    return "max_notional";
+    case eRISK_OPEN_ORDERS: return "max_open_orders";
+    case eRISK_POSITION:    return "max_position";
+    case eRISK_PRICE_BAND:  return "price_band";
+    default:                return "ok";
+  }
+}
+
+/** one user's counters over every symbol, the per symbol ones live on
+    the user's UserOrderList for that symbol */
+struct UserRisk {
+  RiskLimits limits;
+  bool custom;      // limits set for this user rather than the default
+  int open_orders;
+  uint32_t epoch;   // counters from an older epoch are zero
+
+  UserRisk() : custom(false), open_orders(0), epoch(0) {}
+};
+
+/** the first limit the order would break, eRISK_OK if none
+
+    position and open_side are the user's in the symbol with this order
+    not counted, ref the reference price for the band and opp_best the
+    opposite side's best for valuing a market order, 0 if none */
+inline RiskReason checkRisk( const RiskLimits& lim, int open_orders, int64_t position, int64_t open_side,
+                             bool buy, int price, int qty, int ref, int opp_best ) {
+  if ( lim.max_order_qty && qty > lim.max_order_qty ) {
+    return eRISK_ORDER_QTY;
+  }
+  if ( lim.max_notional && int64_t( price ? price : opp_best ) * qty > lim.max_notional ) {
+    return eRISK_NOTIONAL;
+  }
+  if ( lim.max_open_orders && open_orders >= lim.max_open_orders ) {
+    return eRISK_OPEN_ORDERS;
+  }
+  if ( lim.max_position && ( buy ? position : -position ) + open_side + qty > lim.max_position ) {
+    return eRISK_POSITION;
+  }
+  if ( lim.price_band_bps && price && ref ) {
+    int64_t band = int64_t(ref) * lim.price_band_bps;
+    if ( buy ? int64_t(price) * 10000 > int64_t(ref) * 10000 + band
+             : int64_t(price) * 10000 < int64_t(ref) * 10000 - band ) {
+      return eRISK_PRICE_BAND;
+    }
+  }
+  return eRISK_OK;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <utility>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+
+/** Named shared memory segments in /dev/shm
+
+    a segment holds exactly one T behind a small header.  the creator
+    sizes the file, constructs T in place and only then stamps the
+    header's magic with a release store, so a process that opens the
+    segment either finds it whole or refuses it.  the header also
+    records sizeof(T) so a reader built against a different layout
+    refuses it instead of misreading it.
+
+    T has to be something that can live at a different address in
+    every process mapping it: no pointers, no virtuals, nothing that
+    owns heap memory.  the rings in cwfq.h are.
+
+    names are shm_open names, "/engine.out" lands in /dev/shm/engine.out.
+    a segment outlives its processes until it's unlinked.
+*/
+namespace Shm {
+
+const uint64_t MAGIC = 0x6f62736d31ULL; // "obsm1"
+
+template <class T>
+struct Segment {
+  std::atomic<uint64_t> magic;
+  uint64_t size;
+  T t;
+};
+
+template <class T>
+size_t segmentSize() {
+  return ( sizeof(Segment<T>) + 4095 ) / 4096 * 4096;
+}
+
+/** a fresh segment, replacing any old one of the same name, T built
+    from args.  NULL on failure */
+template <class T, class... Args>
+T* create( const string& name, Args&&... args ) {
+#ifdef __linux__
+  shm_unlink( name.c_str() );
+  int fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644 );
+  if ( fd < 0 ) {
+    return NULL;
+  }
+  size_t len = segmentSize<T>();
+  if ( ftruncate( fd, off_t(len) ) != 0 ) {
+    close(fd);
+    shm_unlink( name.c_str() );
+    return NULL;
+  }
+  void *p = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+  close(fd);
+  if ( p == MAP_FAILED ) {
+    shm_unlink( name.c_str() );
+    return NULL;
+  }
+  Segment<T> *seg = static_cast<Segment<T>*>(p);
+  seg->size = sizeof(T);
+  new (&seg->t) T( std::forward<Args>(args)... );
+  seg->magic.store( MAGIC, std::memory_order_release );
+  return &seg->t;
+#else
+  (void)name;
+  return NULL;
+#endif
+}
+
+/** map an existing segment, read only unless writable.  NULL if it
+    doesn't exist, isn't finished being created or holds something else */
+template <class T>
+T* open( const string& name, bool writable=false ) {
+#ifdef __linux__
+  int fd = shm_open( name.c_str(), writable ? O_RDWR : O_RDONLY, 0 );
+  if ( fd < 0 ) {
+    return NULL;
+  }
+  struct stat st;
+  size_t len = segmentSize<T>();
+  if ( fstat( fd, &st ) != 0 || size_t(st.st_size) != len ) {
+    close(fd);
+    return NULL;
+  }
+  void *p = mmap( NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+  close(fd);
+  if ( p == MAP_FAILED ) {
+    return NULL;
+  }
+  Segment<T> *seg = static_cast<Segment<T>*>(p);
+  if ( seg->magic.load( std::memory_order_acquire ) != MAGIC || seg->size != sizeof(T) ) {
+    munmap( p, len );
+    return NULL;
+  }
+  return &seg->t;
+#else
+  (void)name;
+  (void)writable;
+  return NULL;
+#endif
+}
+
+/** unmap t, the segment itself stays until unlink */
+template <class T>
+void unmap( const T *t ) {
+#ifdef __linux__
+  if ( t ) {
+    const char *base = reinterpret_cast<const char*>(t) - offsetof(Segment<T>, t);
+    munmap( const_cast<char*>(base), segmentSize<T>() );
+  }
+#else
+  (void)t;
+#endif
+}
+
+inline void unlink( const string& name ) {
+#ifdef __linux__
+  shm_unlink( name.c_str() );
+#else
+  (void)name;
+#endif
+}
+
+}
+
+#endif
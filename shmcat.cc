@@ -0,0 +1,82 @@
+/* Follows an engine output ring in shared memory
+
+   usage: ./shmcat [--oldest] [--once] name
+
+   prints every record in the same csv as the engine's own output with
+   the symbol added to trades and TOB lines
+
+     A,user,oid
+     R,user,oid,reason
+     T,symbol,buy_user,buy_oid,sell_user,sell_oid,price,qty
+     B,symbol,side,price,qty        ( - for an empty side )
+
+   starting with what is pushed from now on, or --oldest with the
+   oldest record still in the ring.  --once exits when it has caught
+   up instead of following.  records overwritten before this reader
+   got to them are reported on stderr.  any number of shmcat and other
+   readers can follow the same ring, the mapping is read only.
+*/
+
+//system headers
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+//my headers
+#include "output.h"
+#include "shm.h"
+
+using std::string;
+
+int main( int argc, char **argv ) {
+  bool oldest = false;
+  bool once = false;
+  string name;
+  for ( int i = 1; i < argc; ++i ) {
+    string arg = argv[i];
+    if ( arg == "--oldest" ) {
+      oldest = true;
+    } else if ( arg == "--once" ) {
+      once = true;
+    } else if ( arg[0] != '-' && name.empty() ) {
+      name = arg;
+    } else {
+      name.clear();
+      break;
+    }
+  }
+  if ( name.empty() ) {
+    std::cerr << "usage: shmcat [--oldest] [--once] name" << std::endl;
+    return 1;
+  }
+  const OutputRing *ring = Shm::open<OutputRing>(name);
+  if ( ring == NULL ) {
+    std::cerr << "can't open output ring " << name << std::endl;
+    return 1;
+  }
+
+  OutputRing::Cursor c = oldest ? ring->oldest() : ring->latest();
+  uint64_t reported = 0;
+  for ( ; ; ) {
+    const OutputRecord *r = ring->peek(c);
+    if ( r == NULL ) {
+      std::cout.flush();
+      if ( once ) {
+        break;
+      }
+      std::this_thread::sleep_for( std::chrono::microseconds(100) );
+      continue;
+    }
+    OutputRecord copy = *r;
+    if ( ring->release(c) ) {
+      formatRecord(std::cout, copy, true);
+    }
+    if ( c.lost != reported ) {
+      std::cerr << "overwritten, lost " << c.lost - reported << " records" << std::endl;
+      reported = c.lost;
+    }
+  }
+  Shm::unmap(ring);
+  return 0;
+}
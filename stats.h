@@ -0,0 +1,198 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "reject.h"
+#include "util.h"
+
+using std::string;
+using std::vector;
+
+/** Hot path statistics
+
+    every counter has exactly one writer, the matching thread ( or the
+    ring's producer or consumer for the ring counters ), so an update is
+    a relaxed load and store with no locked instruction.  any other
+    thread may read a counter at any time and sees a whole value.
+
+    to read several counters as one consistent snapshot the writer
+    brackets each message with a SeqLock and readers retry until they
+    copied everything without a write in between.  the writer never
+    waits for a reader.
+*/
+
+/** single writer counter or gauge */
+class Counter {
+public:
+  Counter() : v(0) {}
+
+  void add( uint64_t n=1 ) { v.store( v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed ); }
+  void sub( uint64_t n=1 ) { v.store( v.load(std::memory_order_relaxed) - n, std::memory_order_relaxed ); }
+  void set( uint64_t n ) { v.store( n, std::memory_order_relaxed ); }
+  void max( uint64_t n ) {
+    if ( n > v.load(std::memory_order_relaxed) ) {
+      v.store( n, std::memory_order_relaxed );
+    }
+  }
+  uint64_t get() const { return v.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> v;
+};
+
+/** sequence lock for one writer and any number of readers */
+class SeqLock {
+public:
+  SeqLock() : seq(0) {}
+
+  void writeBegin() {
+    seq.store( seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed );
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+  void writeEnd() {
+    seq.store( seq.load(std::memory_order_relaxed) + 1, std::memory_order_release );
+  }
+
+  /** copy the protected counters inside f, retried until it saw no write */
+  template <class F>
+  uint64_t read( F f ) const {
+    for ( ; ; ) {
+      uint64_t s0 = seq.load(std::memory_order_acquire);
+      if ( s0 & 1 ) {
+        continue;
+      }
+      f();
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if ( seq.load(std::memory_order_relaxed) == s0 ) {
+        return s0 / 2;
+      }
+    }
+  }
+
+private:
+  std::atomic<uint64_t> seq;
+};
+
+/** per book counters, see OrderBook::getStats */
+struct BookStats {
+  Counter orders_added;     // new orders into the book, marketable or not
+  Counter orders_cancelled; // cancels and mass cancels
+  Counter trades;           // fills against resting orders
+  Counter levels_created;
+  Counter levels_destroyed;
+  Counter level_shifts;     // ladder slots moved to open or close a level
+  Counter cancel_scans;     // level queue entries visited finding cancelled orders
+  Counter sweeps;           // aggressive orders that reached the opposite side
+  Counter sweep_levels;     // levels taken from, summed over all sweeps
+  Counter sweep_max_levels; // most levels a single sweep took from
+  Counter stops_triggered;  // stop orders handed back to enter the book
+  Counter uncrosses;        // call auctions ended
+  Counter tob_conflated;    // TOB updates overwritten unpublished, see publisher.h
+  Counter orders_refused;   // orders with no level left to rest on, see BookConfig
+
+  // gauges
+  Counter live_orders;
+  Counter live_levels;
+  Counter live_stops;       // stop orders waiting on a trigger
+  Counter level_bytes;      // level storage reserved, in use or not
+};
+
+/** per manager counters, see OrderManager::getStats */
+struct ManagerStats {
+  Counter messages;
+  Counter rejects;          // messages refused, see reject.h
+  Counter reject_reasons[eREJECT_REASONS]; // by RejectReason, eREJECT_NONE unused
+
+  // gauges, refreshed after every message
+  Counter live_orders;
+  Counter books;
+  Counter order_bytes;      // order pool storage reserved
+  Counter index_bytes;      // order index table
+};
+
+/** per feed handler counters, see FeedHandler::getStats */
+struct FeedStats {
+  Counter adds;
+  Counter executions;
+  Counter cancels;          // partial cancels
+  Counter deletes;
+  Counter replaces;
+  Counter bad_refs;         // events naming an order we don't have, or adding one we do
+
+  // gauges
+  Counter live_orders;
+  Counter books;
+};
+
+/** counters kept by a RingFifo */
+struct RingStats {
+  alignas(CACHE_LINE) Counter push_full; // pushes refused because the ring was full, ie producer spins
+  alignas(CACHE_LINE) Counter pop_empty; // times the consumer found the ring empty, once per wait
+};
+
+/** plain copies of the above for a reader to keep */
+struct BookSnapshot {
+  string symbol;
+  uint64_t orders_added;
+  uint64_t orders_cancelled;
+  uint64_t trades;
+  uint64_t levels_created;
+  uint64_t levels_destroyed;
+  uint64_t level_shifts;
+  uint64_t cancel_scans;
+  uint64_t sweeps;
+  uint64_t sweep_levels;
+  uint64_t sweep_max_levels;
+  uint64_t stops_triggered;
+  uint64_t uncrosses;
+  uint64_t tob_conflated;
+  uint64_t orders_refused;
+  uint64_t live_orders;
+  uint64_t live_levels;
+  uint64_t live_stops;
+  uint64_t level_bytes;
+
+  void copy( const string& sym, const BookStats& s ) {
+    symbol = sym;
+    orders_added = s.orders_added.get();
+    orders_cancelled = s.orders_cancelled.get();
+    trades = s.trades.get();
+    levels_created = s.levels_created.get();
+    levels_destroyed = s.levels_destroyed.get();
+    level_shifts = s.level_shifts.get();
+    cancel_scans = s.cancel_scans.get();
+    sweeps = s.sweeps.get();
+    sweep_levels = s.sweep_levels.get();
+    sweep_max_levels = s.sweep_max_levels.get();
+    stops_triggered = s.stops_triggered.get();
+    uncrosses = s.uncrosses.get();
+    tob_conflated = s.tob_conflated.get();
+    orders_refused = s.orders_refused.get();
+    live_orders = s.live_orders.get();
+    live_levels = s.live_levels.get();
+    live_stops = s.live_stops.get();
+    level_bytes = s.level_bytes.get();
+  }
+};
+
+struct StatsSnapshot {
+  uint64_t version;         // messages completed when the snapshot was taken
+  uint64_t messages;
+  uint64_t rejects;
+  uint64_t reject_reasons[eREJECT_REASONS];
+  uint64_t live_orders;
+  uint64_t num_books;
+  uint64_t order_bytes;
+  uint64_t index_bytes;
+  uint64_t book_bytes;      // level storage summed over all books
+  vector<BookSnapshot> books;
+
+  /** everything the engine has reserved that we know of */
+  uint64_t totalBytes() const { return order_bytes + index_bytes + book_bytes; }
+};
+
+#endif
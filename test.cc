@@ -1,10 +1,38 @@
 #include "order.h"
 #include "orderparser.h"
+#include "ordermanager.h"
+#include "pool.h"
+#include "orderindex.h"
+#include "cwfq.h"
+#include "feedhandler.h"
+#include "output.h"
+#include "shm.h"
+#include "gateway.h"
+#include "eventlog.h"
+#include "publisher.h"
+#include "replica.h"
+
+#include <sstream>
 
 #define BOOST_TEST_MODULE MyTest
 
 #include <boost/test/included/unit_test.hpp>
 
+/** the tests capture cout so keep the framework's own log on cerr */
+struct LogToCerr {
+  LogToCerr() { boost::unit_test::unit_test_log.set_stream(std::cerr); }
+  ~LogToCerr() { boost::unit_test::unit_test_log.set_stream(std::cout); }
+};
+BOOST_TEST_GLOBAL_FIXTURE( LogToCerr );
+
+/** swallow and capture everything written to cout for the lifetime of the object */
+struct CoutCapture {
+  std::stringstream out;
+  std::streambuf *old;
+  CoutCapture() : old(std::cout.rdbuf(out.rdbuf())) {}
+  ~CoutCapture() { std::cout.rdbuf(old); }
+};
+
 BOOST_AUTO_TEST_CASE( my_test )
 {
   Order myOrder1('N', 1, 2, 3, 4, true, "IBM");
@@ -45,3 +73,1279 @@ BOOST_AUTO_TEST_CASE( order_parser_test )
   delete b;
   delete c;
 }
+
+BOOST_AUTO_TEST_CASE( intrusive_queue_test )
+{
+  Order a('N', 1, 1, 10, 5, true, "IBM"), b('N', 2, 1, 10, 5, true, "IBM"), c('N', 3, 1, 10, 5, true, "IBM");
+  Level lvl(10);
+  lvl.addOrder(&a);
+  lvl.addOrder(&b);
+
+  BOOST_CHECK( lvl.cancelOrder(&b) == 1 && lvl.getQty() == 5 );
+  // neither a removed order nor one never queued here is found
+  BOOST_CHECK( lvl.cancelOrder(&b) == 0 );
+  BOOST_CHECK( lvl.cancelOrder(&c) == 0 && lvl.getQty() == 5 );
+  BOOST_CHECK( lvl.getNumOrders() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( histogram_test )
+{
+  Latency::Histogram h;
+  BOOST_CHECK( h.quantile(0.5) == 0 );
+  // below 128 every value has its own bucket
+  for ( uint64_t v = 1; v <= 100; ++v ) {
+    h.record(v);
+  }
+  BOOST_CHECK( h.count() == 100 && h.max() == 100 );
+  BOOST_CHECK( h.quantile(0.5) == 51 );
+  BOOST_CHECK( h.quantile(0.99) == 100 );
+  BOOST_CHECK( h.quantile(1.0) == 100 );
+
+  // past that buckets widen with the power of two, 1000 to 1003 share one
+  h.reset();
+  for ( uint64_t v : { 1000, 1001, 1003, 1004 } ) {
+    h.record(v);
+  }
+  BOOST_CHECK( h.quantile(0.0) == 1003 && h.quantile(0.5) == 1003 );
+  BOOST_CHECK( h.quantile(0.75) == 1004 ); // capped at the max
+  h.record(1000000007);
+  uint64_t top = h.quantile(0.9);
+  BOOST_CHECK( top >= 1000000007 && h.max() == 1000000007 );
+  h.record(2000000000);
+  top = h.quantile(0.8);
+  BOOST_CHECK( top >= 1000000007 && top < 1010000000 );
+}
+
+BOOST_AUTO_TEST_CASE( pool_growth_test )
+{
+  pool<Level, level_id_t> p(4, 100);
+  BOOST_CHECK( p.capacity() == 4 );
+
+  level_id_t first = p.alloc();
+  Level *first_addr = p.get(first);
+  first_addr->setPrice(42);
+
+  // grow well past the initial chunk, earlier handles and addresses must survive
+  vector<level_id_t> ids;
+  for ( int i = 0; i < 40; ++i ) {
+    ids.push_back(p.alloc());
+  }
+  BOOST_CHECK( p.capacity() >= 41 );
+  BOOST_CHECK( p.get(first) == first_addr );
+  BOOST_CHECK( p[first].getPrice() == 42 );
+  BOOST_CHECK( p.size() == 41 );
+
+  // freed slots are reused before growing
+  p.free(ids.back());
+  BOOST_CHECK( p.alloc() == ids.back() );
+
+  // clear keeps storage for the session high water mark, the next clear shrinks back
+  p.clear();
+  BOOST_CHECK( p.capacity() >= 41 );
+  BOOST_CHECK( p.size() == 0 );
+  p.alloc();
+  p.clear();
+  BOOST_CHECK( p.capacity() == 4 );
+
+  // hard ceiling
+  for ( int i = 0; i < 100; ++i ) {
+    p.alloc();
+  }
+  BOOST_CHECK_THROW( p.alloc(), std::bad_alloc );
+}
+
+BOOST_AUTO_TEST_CASE( book_level_capacity_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.configureBook("TINY", BookConfig(2, 8));
+
+  // well past the old fixed limit of 32 levels
+  for ( int i = 1; i <= 100; ++i ) {
+    mgr.addOrder(Order::buildOrder('N', i, 1, i, 10, true, "DEEP"));
+  }
+  OrderBook *deep = mgr.getBook("DEEP");
+  BOOST_REQUIRE( deep != NULL );
+  BOOST_CHECK( deep->getNumLevels() == 100 );
+  BOOST_CHECK( deep->getBestBidPrice() == 100 );
+
+  for ( int i = 1; i <= 8; ++i ) {
+    mgr.addOrder(Order::buildOrder('N', 1000 + i, 1, i, 10, true, "TINY"));
+  }
+  OrderBook *tiny = mgr.getBook("TINY");
+  BOOST_CHECK( tiny->getLevelCapacity() == 8 );
+
+  // a ninth price is refused and leaves nothing of itself behind
+  cap.out.str("");
+  size_t lists = mgr.getNumUserLists();
+  mgr.handle(Order::buildOrder('N', 2000, 1, 50, 10, true, "TINY"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,1,2000\nR,1,2000,book_full\n" );
+  BOOST_CHECK( mgr.getNumOrders() == 108 && tiny->getNumLevels() == 8 );
+  BOOST_CHECK( mgr.getNumUserLists() == lists );
+  BOOST_CHECK( tiny->getStats().orders_refused.get() == 1 );
+
+  // as is the remainder of one that traded, after its trades: a sweep
+  // frees levels on the other side, a fixed depth ladder can still be full
+  mgr.configureBook("ES", BookConfig(16, 0, 0, BookConfig::eTIGHT_BOOK));
+  for ( int i = 1; i <= 16; ++i ) {
+    mgr.addOrder(Order::buildOrder('N', 3000 + i, 4, 100 + i, 10, false, "ES"));
+  }
+  mgr.addOrder(Order::buildOrder('N', 3000, 5, 100, 10, true, "ES"));
+  size_t orders = mgr.getNumOrders();
+  cap.out.str("");
+  mgr.handle(Order::buildOrder('N', 3100, 6, 99, 15, false, "ES"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,6,3100\n"
+                     "T,5,3000,6,3100,100,10\n"
+                     "R,6,3100,book_full\n"
+                     "B,B,-,-\n" );
+  BOOST_CHECK( mgr.getNumOrders() == orders - 1 );
+  BOOST_CHECK( mgr.getPosition(6, "ES") == -10 );
+}
+
+BOOST_AUTO_TEST_CASE( ladder_policy_test )
+{
+  // both policies keep best last and must agree on every search
+  VectorLadder<int, std::greater<int>> vbids;
+  ArrayLadder<int, std::greater<int>, 8> abids;
+  VectorLadder<int, std::less<int>> vasks;
+  ArrayLadder<int, std::less<int>, 8> aasks;
+
+  int prices[] = { 10, 7, 12, 9, 11 };
+  for ( int p : prices ) {
+    vbids.insertAt( vbids.search(p), PriceLevel<int>(p, level_id_t(p)) );
+    abids.insertAt( abids.search(p), PriceLevel<int>(p, level_id_t(p)) );
+    vasks.insertAt( vasks.search(p), PriceLevel<int>(p, level_id_t(p)) );
+    aasks.insertAt( aasks.search(p), PriceLevel<int>(p, level_id_t(p)) );
+  }
+  BOOST_CHECK( vbids.best().l_price == 12 && abids.best().l_price == 12 );
+  BOOST_CHECK( vasks.best().l_price == 7 && aasks.best().l_price == 7 );
+  BOOST_CHECK( vbids.depth(1).l_price == 11 && abids.depth(1).l_price == 11 );
+  BOOST_CHECK( vasks.depth(1).l_price == 9 && aasks.depth(1).l_price == 9 );
+  for ( int p = 5; p < 15; ++p ) {
+    BOOST_CHECK( vbids.search(p) == abids.search(p) );
+    BOOST_CHECK( vasks.search(p) == aasks.search(p) );
+  }
+  BOOST_CHECK( abids.find(9) != NULL && abids.find(8) == NULL );
+  BOOST_CHECK( aasks.erase(7) && aasks.best().l_price == 9 );
+
+  // fixed ladders refuse to grow past their depth
+  for ( int p = 20; p < 23; ++p ) {
+    abids.insertAt( abids.search(p), PriceLevel<int>(p, level_id_t(p)) );
+  }
+  BOOST_CHECK_THROW( abids.insertAt( 0, PriceLevel<int>(1, level_id_t(1)) ), std::bad_alloc );
+}
+
+BOOST_AUTO_TEST_CASE( book_specialization_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.configureBook("ES", BookConfig(0, 0, 0, BookConfig::eTIGHT_BOOK));
+  mgr.configureBook("BTC", BookConfig(64, 0, 0, BookConfig::eDEEP_BOOK));
+
+  for ( int i = 1; i <= 16; ++i ) {
+    mgr.addOrder(Order::buildOrder('N', i, 1, 100 + i, 10, false, "ES"));
+  }
+  OrderBook *es = mgr.getBook("ES");
+  BOOST_CHECK( dynamic_cast<TightOrderBook*>(es) != NULL );
+  BOOST_CHECK( es->getBestOfferPrice() == 101 );
+  mgr.addOrder(Order::buildOrder('N', 17, 1, 200, 10, false, "ES"));
+  BOOST_CHECK( es->getNumLevels() == 16 && mgr.getNumOrders() == 16 );
+  BOOST_CHECK( es->getStats().orders_refused.get() == 1 );
+
+  // level aggregates are wide enough to go past what one order carries
+  mgr.addOrder(Order::buildOrder('N', 100, 1, 5, 2000000000, true, "BTC"));
+  mgr.addOrder(Order::buildOrder('N', 101, 1, 5, 2000000000, true, "BTC"));
+  OrderBook *btc = mgr.getBook("BTC");
+  BOOST_CHECK( dynamic_cast<DeepOrderBook*>(btc) != NULL );
+  BOOST_CHECK( btc->getBestBidQty() == 4000000000LL );
+}
+
+BOOST_AUTO_TEST_CASE( sweep_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.addOrder(Order::buildOrder('N', 1, 1, 10, 50, false, "IBM"));
+  mgr.addOrder(Order::buildOrder('N', 2, 1, 10, 50, false, "IBM"));
+  mgr.addOrder(Order::buildOrder('N', 3, 1, 11, 100, false, "IBM"));
+  mgr.addOrder(Order::buildOrder('N', 4, 1, 12, 100, false, "IBM"));
+  cap.out.str("");
+
+  // takes all of 10, part of 11 and never looks at 12; rests nothing
+  mgr.addOrder(Order::buildOrder('N', 5, 2, 11, 130, true, "IBM"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "T,2,5,1,1,10,50\n"
+                     "T,2,5,1,2,10,50\n"
+                     "T,2,5,1,3,11,30\n"
+                     "B,S,11,70\n" );
+  OrderBook *book = mgr.getBook("IBM");
+  BOOST_CHECK( book->getBestOfferPrice() == 11 && book->getBestOfferQty() == 70 );
+  BOOST_CHECK( book->getBestBidPrice() == 0 );
+
+  // limit remainder rests at its own price after sweeping through 11
+  cap.out.str("");
+  mgr.addOrder(Order::buildOrder('N', 6, 2, 11, 100, true, "IBM"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "T,2,6,1,3,11,70\n"
+                     "B,B,11,30\n"
+                     "B,S,12,100\n" );
+
+  // market sell with more than the book holds is killed after the sweep
+  cap.out.str("");
+  mgr.addOrder(Order::buildOrder('N', 7, 3, 0, 500, false, "IBM"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "T,2,6,3,7,11,30\n"
+                     "B,B,-,-\n" );
+  BOOST_CHECK( book->getNumLevels() == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( depth_index_test )
+{
+  // asks, best ( lowest ) last; check every query against a brute force walk
+  DepthIndex<int, int64_t, std::less<int>> idx;
+  vector<int> px;
+  vector<int64_t> qty;
+  srand(7);
+  for ( int step = 0; step < 2000; ++step ) {
+    int r = rand() % 3;
+    if ( r == 0 || px.empty() ) {
+      int p = 100 + rand() % 60;
+      size_t i = 0;
+      while ( i < px.size() && px[i] > p ) ++i;
+      if ( i < px.size() && px[i] == p ) continue;
+      px.insert(px.begin() + i, p);
+      qty.insert(qty.begin() + i, 0);
+      idx.insertSlot(i, p);
+    } else if ( r == 1 ) {
+      size_t i = rand() % px.size();
+      int64_t dq = 1 + rand() % 100;
+      qty[i] += dq;
+      idx.add(i, dq);
+    } else {
+      size_t i = rand() % px.size();
+      px.erase(px.begin() + i);
+      qty.erase(qty.begin() + i);
+      idx.eraseSlot(i);
+    }
+
+    int p = 100 + rand() % 60;
+    int64_t depth = 0;
+    for ( size_t i = 0; i < px.size(); ++i ) {
+      if ( px[i] <= p ) depth += qty[i];
+    }
+    BOOST_REQUIRE_EQUAL( idx.depthTo(p), depth );
+
+    int64_t want = 1 + rand() % 500;
+    int64_t left = want, cost = 0;
+    for ( size_t i = px.size(); i-- > 0 && left > 0; ) {
+      int64_t take = std::min(left, qty[i]);
+      cost += take * px[i];
+      left -= take;
+    }
+    int64_t got = 0;
+    BOOST_REQUIRE_EQUAL( idx.costToFill(want, got), left == 0 );
+    if ( left == 0 ) {
+      BOOST_REQUIRE_EQUAL( got, cost );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( fill_or_kill_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.addOrder(Order::buildOrder('N', 1, 1, 10, 50, false, "IBM"));
+  mgr.addOrder(Order::buildOrder('N', 2, 1, 11, 50, false, "IBM"));
+  mgr.addOrder(Order::buildOrder('N', 3, 1, 12, 50, false, "IBM"));
+  OrderBook *book = mgr.getBook("IBM");
+
+  BOOST_CHECK( book->getDepthToPrice(true, 11) == 100 );
+  BOOST_CHECK( book->getDepthToPrice(true, 0) == 150 );
+  BOOST_CHECK( book->getCostToFill(true, 75) == 50 * 10 + 25 * 11 );
+  BOOST_CHECK( book->getCostToFill(true, 151) == -1 );
+  BOOST_CHECK_CLOSE( book->getVwapToQty(true, 100), 10.5, 0.0001 );
+
+  // fill-or-kill that can't be met at its limit leaves the book
+  // untouched, its user is told it's gone
+  cap.out.str("");
+  Order *fok = Order::buildOrder('N', 4, 2, 11, 120, true, "IBM");
+  fok->setMinQty(120);
+  mgr.addOrder(fok);
+  BOOST_CHECK_EQUAL( cap.out.str(), "R,2,4,min_qty\n" );
+  BOOST_CHECK( book->getDepthToPrice(true, 0) == 150 );
+  BOOST_CHECK( mgr.getNumOrders() == 3 );
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,2,IBM,12,200,B,6,200"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,2,6\nR,2,6,min_qty\n" );
+
+  // minimum qty met: executes and the remainder rests
+  Order *mq = Order::buildOrder('N', 5, 2, 11, 120, true, "IBM");
+  mq->setMinQty(100);
+  mgr.addOrder(mq);
+  BOOST_CHECK( book->getBestBidPrice() == 11 && book->getBestBidQty() == 20 );
+  BOOST_CHECK( book->getDepthToPrice(true, 0) == 50 );
+  BOOST_CHECK( book->getDepthToPrice(false, 11) == 20 );
+
+  mgr.cancelOrder(Order::buildOrder('C', 5, 2));
+  BOOST_CHECK( book->getDepthToPrice(false, 0) == 0 );
+
+  Order *parsed = OrderParser::parse("N,1,IBM,10,100,B,9,100");
+  BOOST_CHECK( parsed->getMinQty() == 100 );
+  delete parsed;
+}
+
+BOOST_AUTO_TEST_CASE( amend_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+  mgr.handle(OrderParser::parse("N,2,IBM,10,100,B,2"));
+  mgr.handle(OrderParser::parse("N,3,IBM,12,100,S,3"));
+  OrderBook *book = mgr.getBook("IBM");
+
+  // qty down in place: keeps priority, TOB qty follows
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("D,1,1,40"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,1,1\nB,B,10,140\n" );
+  BOOST_CHECK( book->getDepthToPrice(false, 0) == 140 );
+
+  // cancel-replace to a new price goes to the back of the new level and
+  // a marketable replace trades, each TOB change is published once
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("R,3,3,10,60"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,3,3\n"
+                     "T,1,1,3,3,10,40\n"
+                     "T,2,2,3,3,10,20\n"
+                     "B,B,10,80\n"
+                     "B,S,-,-\n" );
+
+  // order 1 is gone, 2 still kept its place ahead of anything new
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,4,IBM,10,10,B,4"));
+  mgr.handle(OrderParser::parse("R,2,2,11,80"));
+  mgr.handle(OrderParser::parse("N,5,IBM,0,85,S,5"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,4,4\n"
+                     "B,B,10,90\n"
+                     "A,2,2\n"
+                     "B,B,11,80\n"
+                     "A,5,5\n"
+                     "T,2,2,5,5,11,80\n"
+                     "T,4,4,5,5,10,5\n"
+                     "B,B,10,5\n" );
+}
+
+BOOST_AUTO_TEST_CASE( mass_cancel_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+  mgr.handle(OrderParser::parse("N,1,IBM,11,100,B,2"));
+  mgr.handle(OrderParser::parse("N,2,IBM,11,50,B,1")); // same uoid, different user
+  mgr.handle(OrderParser::parse("N,1,IBM,13,100,S,3"));
+  mgr.handle(OrderParser::parse("N,1,AAPL,20,100,B,4"));
+  OrderBook *ibm = mgr.getBook("IBM");
+  OrderBook *aapl = mgr.getBook("AAPL");
+
+  // scoped to one symbol, acked in the order the orders came in and
+  // TOB published once per side that changed
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("X,1,IBM"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,1,1\nA,1,2\nA,1,3\n"
+                     "B,B,11,50\n"
+                     "B,S,-,-\n" );
+  BOOST_CHECK( ibm->getBestBidQty() == 50 && ibm->getNumLevels() == 1 );
+  BOOST_CHECK( aapl->getBestBidQty() == 100 );
+
+  // user 2's order 1 was untouched and can still be cancelled by its own key
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("C,2,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,2,1\nB,B,-,-\n" );
+
+  // user wide, and orders filled out of the book no longer show up
+  mgr.handle(OrderParser::parse("N,1,AAPL,21,10,B,5"));
+  mgr.handle(OrderParser::parse("N,3,AAPL,21,10,S,6"));
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("X,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,1,4\nB,B,-,-\n" );
+  BOOST_CHECK( aapl->getNumLevels() == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( order_index_test )
+{
+  OrderIndex idx(4);
+  std::unordered_map<uint64_t, Order*> ref;
+  Order dummy[64];
+  srand(11);
+  for ( int step = 0; step < 20000; ++step ) {
+    uint64_t key = rand() % 300;
+    int r = rand() % 3;
+    if ( r == 0 ) {
+      Order *o = &dummy[rand() % 64];
+      idx.insert(key, o);
+      ref[key] = o;
+    } else if ( r == 1 ) {
+      BOOST_REQUIRE_EQUAL( idx.erase(key), ref.erase(key) == 1 );
+    } else {
+      auto it = ref.find(key);
+      BOOST_REQUIRE( idx.find(key) == ( it == ref.end() ? NULL : it->second ) );
+    }
+    BOOST_REQUIRE_EQUAL( idx.size(), ref.size() );
+    if ( step % 5000 == 4999 ) {
+      idx.clear();
+      ref.clear();
+      BOOST_REQUIRE( idx.find(key) == NULL );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( epoch_flush_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  for ( int i = 1; i <= 1000; ++i ) {
+    mgr.handle(Order::buildOrder('N', i, i % 7, ( i % 2 ? 100 : 200 ) + i % 50, 10, i % 2, "IBM"));
+  }
+  BOOST_CHECK( mgr.getNumOrders() == 1000 );
+  BOOST_CHECK( mgr.getNumUserLists() == 7 );
+  mgr.setRiskLimits(3, RiskLimits(5));
+
+  mgr.handle(OrderParser::parse("F"));
+  OrderBook *book = mgr.getBook("IBM");
+  BOOST_CHECK( mgr.getNumOrders() == 0 );
+  // the users' lists go with their orders, limits of their own stay
+  BOOST_CHECK( mgr.getNumUserLists() == 0 );
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,3,IBM,120,10,B,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "R,3,1,max_qty\n" );
+  BOOST_CHECK( book->getNumLevels() == 0 );
+  BOOST_CHECK( book->getBestBidPrice() == 0 && book->getDepthToPrice(true, 0) == 0 );
+
+  // nothing from before the flush can be reached any more
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("X,1"));
+  mgr.handle(OrderParser::parse("C,1,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "R,1,1,unknown_order\n" );
+
+  // and reused levels and order slots start clean
+  mgr.handle(OrderParser::parse("N,1,IBM,120,10,B,1"));
+  mgr.handle(OrderParser::parse("N,1,IBM,120,15,B,2"));
+  BOOST_CHECK( book->getBestBidQty() == 25 );
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("X,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,1,1\nA,1,2\nB,B,-,-\n" );
+}
+
+BOOST_AUTO_TEST_CASE( stats_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  const char *msgs[] = {
+    "N,1,IBM,10,100,B,1",
+    "N,1,IBM,11,100,B,2",
+    "N,1,IBM,9,100,B,3",   // opens a level under two others
+    "N,2,IBM,10,150,S,1",  // takes 11 and half of 10
+    "C,1,3",
+    "C,9,9",               // no such order
+  };
+  for ( const char *m : msgs ) {
+    mgr.handle(OrderParser::parse(m));
+  }
+
+  StatsSnapshot snap;
+  mgr.getStats(snap);
+  BOOST_CHECK_EQUAL( snap.version, 6 );
+  BOOST_CHECK_EQUAL( snap.messages, 6 );
+  BOOST_CHECK_EQUAL( snap.rejects, 1 );
+  BOOST_CHECK_EQUAL( snap.live_orders, 1 );
+  BOOST_CHECK_EQUAL( snap.num_books, 1 );
+  BOOST_CHECK( snap.order_bytes >= 4096 * sizeof(Order) );
+  BOOST_CHECK( snap.totalBytes() > snap.order_bytes + snap.index_bytes );
+
+  BOOST_REQUIRE_EQUAL( snap.books.size(), 1 );
+  const BookSnapshot& b = snap.books[0];
+  BOOST_CHECK_EQUAL( b.symbol, "IBM" );
+  BOOST_CHECK_EQUAL( b.orders_added, 4 );
+  BOOST_CHECK_EQUAL( b.orders_cancelled, 1 );
+  BOOST_CHECK_EQUAL( b.trades, 2 );
+  BOOST_CHECK_EQUAL( b.levels_created, 3 );
+  BOOST_CHECK_EQUAL( b.levels_destroyed, 2 );
+  BOOST_CHECK_EQUAL( b.level_shifts, 3 );
+  BOOST_CHECK_EQUAL( b.cancel_scans, 1 );
+  BOOST_CHECK_EQUAL( b.sweeps, 1 );
+  BOOST_CHECK_EQUAL( b.sweep_levels, 2 );
+  BOOST_CHECK_EQUAL( b.sweep_max_levels, 2 );
+  BOOST_CHECK_EQUAL( b.live_orders, 1 );
+  BOOST_CHECK_EQUAL( b.live_levels, 1 );
+
+  CWFQ::RingFifo<int, 2> ring;
+  int x = 0;
+  BOOST_CHECK( !ring.pop(x) );
+  BOOST_CHECK( !ring.pop(x) );
+  while ( ring.push(x) ) {}
+  BOOST_CHECK_EQUAL( ring.getStats().push_full.get(), 1 );
+  // one wait however many times it polled, the next wait counts again
+  BOOST_CHECK_EQUAL( ring.getStats().pop_empty.get(), 1 );
+  while ( ring.pop(x) ) {}
+  BOOST_CHECK_EQUAL( ring.getStats().pop_empty.get(), 2 );
+  BOOST_CHECK( reinterpret_cast<uintptr_t>( &ring.getStats().pop_empty ) % CACHE_LINE == 0 );
+}
+
+BOOST_AUTO_TEST_CASE( placement_test )
+{
+  // huge pages round a chunk up to a whole page, and fall back quietly
+  // to transparent huge pages or normal ones when none are reserved
+  MemConfig mem(true, true, Placement::cpuNode(0));
+  pool<Level, level_id_t> p(16, pool<Level, level_id_t>::UNLIMITED, 0, mem);
+  BOOST_CHECK( p.chunkSize() * sizeof(Level) >= Placement::HUGE_PAGE );
+  vector<level_id_t> ids;
+  for ( size_t i = 0; i < p.chunkSize() + 1; ++i ) {
+    ids.push_back( p.alloc() );
+    p[ids.back()].setPrice( int(i) );
+  }
+  BOOST_CHECK( p.capacity() == 2 * p.chunkSize() );
+  BOOST_CHECK( p[ids.back()].getPrice() == int(p.chunkSize()) );
+
+  using ring_t = CWFQ::RingFifo<Order, 8>;
+  ring_t *ring = Placement::create<ring_t>(mem);
+  Order in('N', 3, 1, 10, 100, true, "IBM");
+  Order out;
+  BOOST_CHECK( ring->push(in) && ring->pop(out) && out == in );
+  Placement::destroy(ring, mem);
+
+  CoutCapture cap;
+  OrderManager mgr(mem);
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+  BOOST_CHECK( mgr.getBook("IBM")->getBestBidQty() == 100 );
+}
+
+BOOST_AUTO_TEST_CASE( handle_batch_test )
+{
+  // a random mix where later messages often hit orders earlier ones in
+  // the same batch filled, amended or cancelled
+  srand(5);
+  vector<string> lines;
+  for ( int i = 1; i <= 3000; ++i ) {
+    int user = rand() % 4;
+    int r = rand() % 10;
+    std::ostringstream m;
+    if ( r < 5 ) {
+      bool buy = rand() % 2;
+      m << "N," << user << ",IBM," << ( buy ? 100 - rand() % 6 : 98 + rand() % 6 ) << ","
+        << 10 * ( 1 + rand() % 5 ) << "," << ( buy ? "B," : "S," ) << i;
+    } else if ( r < 8 ) {
+      m << "C," << user << "," << 1 + rand() % i;
+    } else if ( r < 9 ) {
+      m << "D," << user << "," << 1 + rand() % i << ",5";
+    } else {
+      m << "R," << user << "," << 1 + rand() % i << "," << 97 + rand() % 6 << ",20";
+    }
+    lines.push_back(m.str());
+  }
+
+  // plenty of these name orders that are already gone, their rejects are compared too
+  string one_by_one;
+  {
+    CoutCapture cap;
+    OrderManager mgr;
+    for ( const string& l : lines ) {
+      mgr.handle(OrderParser::parse(l));
+    }
+    one_by_one = cap.out.str();
+  }
+
+  CoutCapture cap;
+  OrderManager mgr;
+  vector<Order*> msgs;
+  for ( const string& l : lines ) {
+    msgs.push_back(OrderParser::parse(l));
+  }
+  for ( size_t i = 0; i < msgs.size(); i += 37 ) {
+    mgr.handleBatch( &msgs[i], std::min<size_t>(37, msgs.size() - i) );
+  }
+  BOOST_CHECK( cap.out.str() == one_by_one );
+}
+
+BOOST_AUTO_TEST_CASE( feed_handler_test )
+{
+  string feed;
+  Itch::Writer w(feed);
+  w.addOrder( 7, 1000, 1, true, 100, "IBM", 99 );
+  w.addOrder( 7, 1001, 2, true, 50, "IBM", 100 );
+  w.addOrder( 7, 1002, 3, false, 70, "IBM", 101 );
+  w.addOrder( 7, 1003, 4, false, 30, "IBM", 101 );
+  w.orderExecuted( 7, 1004, 2, 20, 1 );       // partial, keeps priority
+  w.orderCancel( 7, 1005, 3, 30 );            // 70 -> 40
+  w.orderReplace( 7, 1006, 4, 5, 60, 102 );   // 101 -> 102, new ref
+  w.orderExecuted( 7, 1007, 1, 100, 2 );      // all of it
+  w.orderDelete( 7, 1008, 42 );               // never seen
+  w.addOrder( 8, 1009, 6, false, 10, "MSFT", 200 );
+
+  // offered a byte at a time the decoder only ever consumes whole frames
+  CoutCapture cap;
+  FeedHandler fh;
+  Itch::Decoder dec;
+  size_t done = 0;
+  for ( size_t end = 1; end <= feed.size(); ++end ) {
+    done += dec.decode( feed.data() + done, end - done, fh );
+  }
+  BOOST_CHECK( done == feed.size() );
+  BOOST_CHECK( dec.getMessages() == 10 && dec.getSkipped() == 0 );
+  BOOST_CHECK( cap.out.str().empty() ); // no acks, trades or TOB
+
+  OrderBook *ibm = fh.getBook("IBM");
+  BOOST_REQUIRE( ibm != NULL );
+  BOOST_CHECK( ibm->getBestBidPrice() == 100 && ibm->getBestBidQty() == 30 );
+  BOOST_CHECK( ibm->getBestOfferPrice() == 101 && ibm->getBestOfferQty() == 40 );
+  BOOST_CHECK( ibm->getDepthToPrice(true, 0) == 100 );
+  BOOST_CHECK( fh.getBook("MSFT")->getBestOfferQty() == 10 );
+  BOOST_CHECK( fh.getNumOrders() == 4 );
+  BOOST_CHECK( fh.getStats().bad_refs.get() == 1 );
+  BOOST_CHECK( fh.getStats().executions.get() == 2 );
+
+  // a crossing add just rests, the exchange does the matching
+  fh.addOrder( 9, "IBM", true, 105, 10 );
+  BOOST_CHECK( ibm->getBestBidPrice() == 105 && ibm->getBestOfferPrice() == 101 );
+  fh.deleteOrder(9);
+  fh.cancelOrder( 5, 60 );
+  BOOST_CHECK( ibm->getDepthToPrice(true, 0) == 40 );
+
+  fh.flushOrders();
+  BOOST_CHECK( fh.getNumOrders() == 0 && ibm->getBestBidPrice() == 0 );
+  BOOST_CHECK( cap.out.str().empty() );
+}
+
+BOOST_AUTO_TEST_CASE( broadcast_ring_test )
+{
+  using ring_t = CWFQ::BroadcastRing<int, 8>;
+  std::unique_ptr<ring_t> ring(new ring_t);
+  ring_t::Cursor a = ring->latest();
+  for ( int i = 0; i < 5; ++i ) {
+    ring->push(i);
+  }
+  ring_t::Cursor b = ring->oldest();
+  int v;
+  for ( int i = 0; i < 5; ++i ) {
+    BOOST_CHECK( ring->pop(a, v) && v == i );
+  }
+  BOOST_CHECK( !ring->pop(a, v) && ring->lag(b) == 5 );
+
+  // b falls more than a ring behind, it's told and picks up the oldest left
+  for ( int i = 5; i < 30; ++i ) {
+    ring->push(i);
+  }
+  BOOST_CHECK( ring->pop(b, v) && v == 23 && b.lost == 23 );
+  for ( int i = 24; i < 30; ++i ) {
+    BOOST_CHECK( ring->pop(b, v) && v == i );
+  }
+
+  // overwritten while a zero copy reader was still looking
+  ring_t::Cursor c = ring->latest();
+  ring->push(30);
+  const int *p = ring->peek(c);
+  BOOST_REQUIRE( p && *p == 30 );
+  for ( int i = 31; i < 40; ++i ) {
+    ring->push(i);
+  }
+  BOOST_CHECK( !ring->release(c) && c.lost == 1 );
+}
+
+BOOST_AUTO_TEST_CASE( shm_output_ring_test )
+{
+  string name = "/ob_test_out." + std::to_string(getpid());
+  OutputRing *ring = Shm::create<OutputRing>(name);
+  BOOST_REQUIRE( ring != NULL );
+  const OutputRing *reader = Shm::open<OutputRing>(name);
+  BOOST_REQUIRE( reader != NULL && reader != ring );
+  OutputRing::Cursor c = reader->latest();
+
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.setOutputRing(ring);
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+  mgr.handle(OrderParser::parse("N,2,IBM,10,40,S,2"));
+
+  // A, B, A, T, B in the order the text went out
+  const char expect[] = { 'A', 'B', 'A', 'T', 'B' };
+  OutputRecord r;
+  for ( char t : expect ) {
+    BOOST_REQUIRE( reader->pop(c, r) );
+    BOOST_CHECK( r.type == t );
+  }
+  BOOST_CHECK( r.getSymbol() == "IBM" && r.side == 'B' && r.price == 10 && r.qty == 60 );
+  BOOST_CHECK( !reader->pop(c, r) && c.lost == 0 );
+  string text = cap.out.str();
+  BOOST_CHECK( std::count( text.begin(), text.end(), '\n' ) == 5 );
+
+  Shm::unmap(reader);
+  Shm::unmap(ring);
+  Shm::unlink(name);
+  BOOST_CHECK( Shm::open<OutputRing>(name) == NULL );
+}
+
+BOOST_AUTO_TEST_CASE( gateway_test )
+{
+  string prefix = "/ob_test_gw." + std::to_string(getpid());
+  Gateway gw( prefix, 2, 7 );
+  BOOST_REQUIRE( gw.isOpen() );
+  GatewayClient busy, quiet;
+  BOOST_REQUIRE( busy.open(prefix, 0) && quiet.open(prefix, 1) );
+  BOOST_CHECK( gw.getUser(0) == 7 && gw.getUser(1) == 8 );
+
+  for ( int i = 1; i <= 20; ++i ) {
+    BOOST_CHECK( busy.send( OrderRecord::newOrder("IBM", true, 100 - i, 10, i) ) );
+  }
+  OrderRecord flush = OrderRecord::massCancel();
+  flush.type = 'F';
+  BOOST_CHECK( quiet.send(flush) );
+  BOOST_CHECK( quiet.send( OrderRecord::newOrder("IBM", false, 101, 5, 1, 5) ) );
+
+  // the busy client gets a burst, then the quiet one is heard.  the
+  // flush comes through as an eINVALID for the manager to reject
+  vector<Order> seen;
+  auto sink = [&]( Order& o ) { seen.push_back(o); };
+  BOOST_CHECK( gw.poll(sink) == size_t(Gateway::BURST) + 2 );
+  BOOST_REQUIRE( seen.size() == size_t(Gateway::BURST) + 2 );
+  BOOST_CHECK( gw.getRefused() == 1 );
+  const Order& bad = seen[Gateway::BURST];
+  BOOST_CHECK( bad.getType() == Order::eINVALID && bad.getUser() == 8 && bad.getUserOrderId() == 0 );
+  const Order& last = seen.back();
+  BOOST_CHECK( last.getType() == Order::eNEW && last.getUser() == 8 && last.getSymbol() == "IBM"
+               && !last.getIsBuy() && last.getPrice() == 101 && last.getMinQty() == 5 );
+  BOOST_CHECK( seen[0].getUser() == 7 && seen[0].getUserOrderId() == 1 && seen[0].getPrice() == 99 );
+
+  while ( gw.poll(sink) ) {}
+  BOOST_CHECK( seen.size() == 22 && gw.getAccepted() == 21 );
+
+  // the segment is all ring, a client that writes the busy client's
+  // user over everything it sends still trades as itself
+  BOOST_CHECK( sizeof(ClientChannel) == sizeof(ClientChannel::ring_t) );
+  OrderRecord forged = OrderRecord::newOrder("IBM", true, 0, 0, 0);
+  int32_t *words = reinterpret_cast<int32_t*>(&forged.uoid);
+  for ( size_t i = 0; i < (sizeof(forged) - offsetof(OrderRecord, uoid)) / sizeof(int32_t); ++i ) {
+    words[i] = 7;
+  }
+  BOOST_CHECK( quiet.send(forged) );
+  seen.clear();
+  while ( gw.poll(sink) ) {}
+  BOOST_REQUIRE( seen.size() == 1 );
+  BOOST_CHECK( seen[0].getType() == Order::eNEW && seen[0].getUser() == 8 && seen[0].getUserOrderId() == 7 );
+
+  // a client scribbling over its ring's indices gets garbage refused,
+  // never a read outside the ring.  the tail is the ring's first word,
+  // the engine has read the busy client's 20 records
+  ClientChannel *raw = Shm::open<ClientChannel>( Gateway::channelName(prefix, 0), true );
+  BOOST_REQUIRE( raw != NULL );
+  memset( static_cast<void*>(raw), 0xff, sizeof(ClientChannel) );
+  *reinterpret_cast<size_t*>(raw) = 23;
+  seen.clear();
+  while ( gw.poll(sink) ) {}
+  BOOST_REQUIRE( seen.size() == 3 );
+  BOOST_CHECK( seen[2].getType() == Order::eINVALID && seen[2].getUser() == 7 );
+  BOOST_CHECK( gw.getClosed() == 0 );
+
+  // a tail that isn't an index closes the channel, the others go on
+  std::ostringstream closed;
+  std::streambuf *old_cerr = std::cerr.rdbuf(closed.rdbuf());
+  *reinterpret_cast<size_t*>(raw) = size_t(-1) / 3;
+  seen.clear();
+  BOOST_CHECK( gw.poll(sink) == 0 );
+  std::cerr.rdbuf(old_cerr);
+  BOOST_CHECK( gw.getClosed() == 1 );
+  BOOST_CHECK_EQUAL( closed.str(), "Closed gateway channel " + prefix + ".0, its ring is corrupt\n" );
+  BOOST_CHECK( quiet.send( OrderRecord::cancel(1) ) );
+  while ( gw.poll(sink) ) {}
+  BOOST_REQUIRE( seen.size() == 1 );
+  BOOST_CHECK( seen[0].getType() == Order::eCANCEL && seen[0].getUser() == 8 );
+  Shm::unmap(raw);
+}
+
+BOOST_AUTO_TEST_CASE( risk_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  // qty 100, notional 5000, 2 open orders, position 150, 5% band
+  mgr.setRiskLimits(1, RiskLimits(100, 5000, 2, 150, 500));
+  mgr.handle(OrderParser::parse("N,2,IBM,10,100,S,1"));
+
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,1,IBM,10,200,B,1"));
+  mgr.handle(OrderParser::parse("N,1,IBM,60,90,B,2"));
+  mgr.handle(OrderParser::parse("N,1,IBM,10,60,B,3"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "R,1,1,max_qty\n"
+                     "R,1,2,max_notional\n"
+                     "A,1,3\n"
+                     "T,1,3,2,1,10,60\n"
+                     "B,S,10,40\n" );
+  BOOST_CHECK_EQUAL( mgr.getPosition(1, "IBM"), 60 );
+  BOOST_CHECK_EQUAL( mgr.getPosition(2, "IBM"), -60 );
+
+  // open buys count towards the position, a cancel gives the slot back
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,1,IBM,9,50,B,4"));
+  mgr.handle(OrderParser::parse("N,1,IBM,9,50,B,5"));
+  mgr.handle(OrderParser::parse("N,1,IBM,9,40,B,6"));
+  mgr.handle(OrderParser::parse("N,1,IBM,10,5,S,7"));
+  mgr.handle(OrderParser::parse("C,1,6"));
+  mgr.handle(OrderParser::parse("N,1,IBM,8,5,S,7"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,1,4\n"
+                     "B,B,9,50\n"
+                     "R,1,5,max_position\n"
+                     "A,1,6\n"
+                     "B,B,9,90\n"
+                     "R,1,7,max_open_orders\n"
+                     "A,1,6\n"
+                     "B,B,9,50\n"
+                     "R,1,7,price_band\n" );
+
+  // a replace is checked as the order it becomes, a qty down never is
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("R,1,4,9,100"));
+  mgr.handle(OrderParser::parse("R,1,4,9,30"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "R,1,4,max_position\nA,1,4\nB,B,9,30\n" );
+
+  // user 2 has no limits of its own, the default applies
+  mgr.setDefaultRiskLimits(RiskLimits(50));
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,2,IBM,9,80,S,2"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "R,2,2,max_qty\n" );
+
+  StatsSnapshot snap;
+  mgr.getStats(snap);
+  BOOST_CHECK_EQUAL( snap.rejects, 7 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eRISK_ORDER_QTY], 2 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eRISK_POSITION], 2 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eRISK_PRICE_BAND], 1 );
+}
+
+BOOST_AUTO_TEST_CASE( reject_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+  cap.out.str("");
+
+  const char *msgs[] = {
+    "C,1,2",              // never entered
+    "D,1,2,50",
+    "R,1,2,11,50",
+    "D,1,1,100",          // not a reduce
+    "N,1,IBM,11,10,B,1",  // id 1 is still live
+    "N,2,IBM,0,10,B,1",   // no offers to buy from
+    "U,IBM",              // not in an auction
+    "Z,3,1",
+    "N,3,IBM,10,x,B,4",
+    "C,3",
+    "N,4,IBM,0,60,S,1",   // bids to sell to, trades
+  };
+  for ( const char *m : msgs ) {
+    Order *o = OrderParser::parse(m);
+    BOOST_REQUIRE( o != NULL );
+    mgr.handle(o);
+  }
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "R,1,2,unknown_order\n"
+                     "R,1,2,unknown_order\n"
+                     "R,1,2,unknown_order\n"
+                     "R,1,1,qty_up\n"
+                     "R,1,1,duplicate_id\n"
+                     "R,2,1,no_liquidity\n"
+                     "R,0,0,no_auction\n"
+                     "R,3,0,malformed\n"
+                     "R,3,4,malformed\n"
+                     "R,0,0,malformed\n"
+                     "A,4,1\n"
+                     "T,1,1,4,1,10,60\n"
+                     "B,B,10,40\n" );
+
+  // a rejected message changed nothing
+  BOOST_CHECK( mgr.getNumOrders() == 1 );
+  BOOST_CHECK( mgr.getBook("IBM")->getBestBidQty() == 40 );
+
+  StatsSnapshot snap;
+  mgr.getStats(snap);
+  BOOST_CHECK_EQUAL( snap.rejects, 10 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_UNKNOWN_ORDER], 3 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_QTY_UP], 1 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_DUPLICATE_ID], 1 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_NO_LIQUIDITY], 1 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_NO_AUCTION], 1 );
+  BOOST_CHECK_EQUAL( snap.reject_reasons[eREJECT_MALFORMED], 3 );
+}
+
+BOOST_AUTO_TEST_CASE( stop_order_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,S,1"));
+  mgr.handle(OrderParser::parse("N,1,IBM,11,100,S,2"));
+  mgr.handle(OrderParser::parse("N,1,IBM,12,100,S,3"));
+  OrderBook *book = mgr.getBook("IBM");
+
+  // waiting stops are acked but stay off the book
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,2,IBM,0,50,B,1,0,11"));
+  mgr.handle(OrderParser::parse("N,3,IBM,12,100,B,1,0,10"));
+  mgr.handle(OrderParser::parse("N,4,IBM,0,50,S,1,0,9"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,2,1\nA,3,1\nA,4,1\n" );
+  BOOST_CHECK_EQUAL( book->getNumStops(), 3 );
+
+  // a trade at 10 sets off the stop-limit, its trade at 11 the stop,
+  // all before the next message
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,5,IBM,10,100,B,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,5,1\n"
+                     "T,5,1,1,1,10,100\n"
+                     "B,S,11,100\n"
+                     "T,3,1,1,2,11,100\n"
+                     "B,S,12,100\n"
+                     "T,2,1,1,3,12,50\n"
+                     "B,S,12,50\n" );
+  BOOST_CHECK_EQUAL( book->getLastTradePrice(), 12 );
+  BOOST_CHECK_EQUAL( book->getNumStops(), 1 );
+  BOOST_CHECK_EQUAL( book->getStats().stops_triggered.get(), 2 );
+
+  // one the last trade already reached enters straight away
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,6,IBM,12,10,B,1,0,11"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,6,1\nT,6,1,1,3,12,10\nB,S,12,40\n" );
+
+  // waiting stops cancel, amend and flush without touching the book
+  mgr.handle(OrderParser::parse("R,4,1,0,70"));
+  BOOST_CHECK_EQUAL( book->getNumStops(), 1 );
+  mgr.handle(OrderParser::parse("C,4,1"));
+  BOOST_CHECK_EQUAL( book->getNumStops(), 0 );
+  BOOST_CHECK_EQUAL( mgr.getNumOrders(), 1 );
+  mgr.handle(OrderParser::parse("N,4,IBM,0,50,S,2,0,9"));
+  mgr.handle(OrderParser::parse("F"));
+  BOOST_CHECK_EQUAL( book->getNumStops(), 0 );
+  BOOST_CHECK_EQUAL( book->getLastTradePrice(), 0 );
+
+  // a stop that triggers into an empty other side is rejected, not
+  // dropped without a word
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,7,IBM,10,10,S,1"));
+  mgr.handle(OrderParser::parse("N,8,IBM,0,20,B,1,0,10"));
+  mgr.handle(OrderParser::parse("N,9,IBM,10,10,B,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "A,7,1\n"
+                     "B,S,10,10\n"
+                     "A,8,1\n"
+                     "A,9,1\n"
+                     "T,9,1,7,1,10,10\n"
+                     "B,S,-,-\n"
+                     "R,8,1,no_liquidity\n" );
+  BOOST_CHECK_EQUAL( mgr.getNumOrders(), 0 );
+}
+
+BOOST_AUTO_TEST_CASE( auction_test )
+{
+  CoutCapture cap;
+  OrderManager mgr;
+  mgr.handle(OrderParser::parse("Q,IBM"));
+  OrderBook *book = mgr.getBook("IBM");
+  BOOST_CHECK( book->inAuction() );
+
+  // crossing orders rest without trading or moving the TOB
+  mgr.handle(OrderParser::parse("N,1,IBM,11,100,B,1"));
+  mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,2"));
+  mgr.handle(OrderParser::parse("N,2,IBM,9,150,S,1"));
+  mgr.handle(OrderParser::parse("N,2,IBM,10,100,S,2"));
+  mgr.handle(OrderParser::parse("N,3,IBM,0,20,B,1"));
+  mgr.handle(OrderParser::parse("N,3,IBM,0,10,S,2"));
+  mgr.handle(OrderParser::parse("C,3,2"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,1,1\nA,1,2\nA,2,1\nA,2,2\nA,3,1\nA,3,2\nA,3,2\n" );
+
+  // 220 trades at 10 against 150 at 9 and 120 at 11
+  int price = 0;
+  BOOST_CHECK_EQUAL( book->indicativeUncross(price), 220 );
+  BOOST_CHECK_EQUAL( price, 10 );
+
+  // market orders go first, then price and time, then one TOB update
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("U,IBM"));
+  BOOST_CHECK_EQUAL( cap.out.str(),
+                     "T,3,1,2,1,10,20\n"
+                     "T,1,1,2,1,10,100\n"
+                     "T,1,2,2,1,10,30\n"
+                     "T,1,2,2,2,10,70\n"
+                     "B,S,10,30\n" );
+  BOOST_CHECK( !book->inAuction() );
+  BOOST_CHECK_EQUAL( book->getLastTradePrice(), 10 );
+  BOOST_CHECK_EQUAL( mgr.getNumOrders(), 1 );
+  BOOST_CHECK_EQUAL( book->getStats().uncrosses.get(), 1 );
+
+  // back to continuous trading
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,4,IBM,10,10,B,1"));
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,4,1\nT,4,1,2,2,10,10\nB,S,10,20\n" );
+
+  // an interval uncrosses by itself, an unmatched market order dies
+  mgr.handle(OrderParser::parse("Q,IBM,2"));
+  mgr.handle(OrderParser::parse("N,5,IBM,0,5,S,1"));
+  BOOST_CHECK( book->inAuction() );
+  cap.out.str("");
+  mgr.handle(OrderParser::parse("N,5,IBM,12,5,S,2"));
+  BOOST_CHECK( !book->inAuction() );
+  BOOST_CHECK_EQUAL( cap.out.str(), "A,5,2\n" );
+  BOOST_CHECK_EQUAL( mgr.getNumOrders(), 2 );
+}
+
+BOOST_AUTO_TEST_CASE( event_log_test )
+{
+  string path = "/tmp/ob_test_events." + std::to_string(getpid());
+  std::stringstream text;
+  {
+    CoutCapture cap;
+    EventLog::Writer log;
+    BOOST_CHECK( log.open(path) );
+    OrderManager mgr;
+    mgr.setEventLog(&log);
+    mgr.setRiskLimits( 3, RiskLimits(50) );
+    mgr.handle(OrderParser::parse("N,1,IBM,10,100,B,1"));
+    mgr.handle(OrderParser::parse("N,2,IBM,10,60,S,7"));
+    mgr.handle(OrderParser::parse("N,2,MSFT,0,60,S,8"));
+    mgr.handle(OrderParser::parse("N,3,IBM,10,60,S,1"));
+    mgr.handle(OrderParser::parse("N,1,IBM,9,40,S,2"));
+    log.close();
+    text << cap.out.str();
+  }
+
+  // decodes to exactly what went to cout
+  EventLog::Reader reader;
+  BOOST_CHECK( reader.open(path) );
+  BOOST_CHECK( !reader.isTruncated() );
+  std::stringstream decoded;
+  auto print = [&]( uint64_t, const OutputRecord& r ) { formatRecord(decoded, r); };
+  BOOST_CHECK( reader.decode( 0, UINT64_MAX, print ) );
+  BOOST_CHECK_EQUAL( decoded.str(), text.str() );
+
+  // enough events for several blocks, a time range reads only its own
+  {
+    EventLog::Writer log;
+    log.open(path);
+    for ( int i = 0; i < 100000; ++i ) {
+      log.trade( 1000 + i * 10ULL, i % 2 ? "IBM" : "MSFT", 1, i, 2, i + 1, 100 + i % 7, 10 );
+    }
+  }
+  BOOST_CHECK( reader.open(path) );
+  BOOST_CHECK( reader.getIndex().size() > 2 );
+  std::vector<uint64_t> seen;
+  int checked = 0;
+  auto check = [&]( uint64_t ts, const OutputRecord& r ) {
+    int i = int( ( ts - 1000 ) / 10 );
+    seen.push_back(ts);
+    checked += r.oid == i && r.sell_oid == i + 1 && r.price == 100 + i % 7
+               && r.getSymbol() == ( i % 2 ? "IBM" : "MSFT" );
+  };
+  BOOST_CHECK( reader.decode( 1000 + 50000 * 10, 1000 + 50009 * 10, check ) );
+  BOOST_CHECK_EQUAL( seen.size(), 10 );
+  BOOST_CHECK_EQUAL( checked, 10 );
+
+  // a log whose writer died keeps every whole block
+  std::ifstream in( path, std::ios::binary );
+  string bytes( (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>() );
+  size_t keep = size_t( reader.getIndex()[1].offset ) + 100;
+  std::ofstream( path, std::ios::binary | std::ios::trunc ).write( bytes.data(), std::streamsize(keep) );
+  BOOST_CHECK( reader.open(path) );
+  BOOST_CHECK( reader.isTruncated() );
+  BOOST_CHECK_EQUAL( reader.getIndex().size(), 1 );
+  std::remove( path.c_str() );
+}
+
+BOOST_AUTO_TEST_CASE( publisher_conflation_test )
+{
+  vector<string> flow;
+  for ( int i = 1; i <= 3000; ++i ) {
+    flow.push_back( "N,1,IBM," + std::to_string(100 + i % 7) + ",10,B," + std::to_string(i) );
+    flow.push_back( "N,2,IBM," + std::to_string(200 - i % 5) + ",10,S," + std::to_string(i) );
+    flow.push_back( "C,1," + std::to_string(i) );
+  }
+  flow.push_back( "N,3,IBM,300,15,B,1" );
+
+  // what the matcher prints itself
+  string direct;
+  {
+    CoutCapture cap;
+    OrderManager mgr;
+    for ( const string& m : flow ) {
+      mgr.handle(OrderParser::parse(m));
+    }
+    direct = cap.out.str();
+  }
+
+  // nobody drains until the end, far more than the ring holds
+  std::stringstream out;
+  Publisher publisher;
+  OrderManager mgr;
+  mgr.setPublisher(&publisher);
+  {
+    CoutCapture cap;
+    for ( const string& m : flow ) {
+      mgr.handle(OrderParser::parse(m));
+    }
+    BOOST_CHECK_EQUAL( cap.out.str(), "" );
+  }
+  BOOST_CHECK( publisher.getBacklogged() > 0 && publisher.getStalls() == 0 );
+  for ( bool more = true; more; ) {
+    more = !mgr.flushOutput();
+    more |= publisher.drain(out) > 0;
+  }
+  uint64_t conflated = mgr.getBook("IBM")->getStats().tob_conflated.get();
+  BOOST_CHECK( conflated > 0 );
+
+  // every ack and trade in order, TOB short by what was conflated but
+  // ending where the book is
+  auto lines = []( const string& text, char type ) {
+    vector<string> v;
+    std::istringstream in(text);
+    string l;
+    while ( std::getline(in, l) ) {
+      if ( l[0] == type || ( type == 'X' && l[0] != 'B' ) ) {
+        v.push_back(l);
+      }
+    }
+    return v;
+  };
+  BOOST_CHECK( lines(out.str(), 'X') == lines(direct, 'X') );
+  vector<string> tob = lines(out.str(), 'B');
+  vector<string> direct_tob = lines(direct, 'B');
+  BOOST_CHECK_EQUAL( tob.size() + conflated, direct_tob.size() );
+  auto last = []( const vector<string>& v, const string& side ) {
+    for ( size_t i = v.size(); i-- > 0; ) {
+      if ( v[i].compare(0, side.size(), side) == 0 ) {
+        return v[i];
+      }
+    }
+    return string();
+  };
+  BOOST_CHECK_EQUAL( last(tob, "B,B"), last(direct_tob, "B,B") );
+  BOOST_CHECK_EQUAL( last(tob, "B,S"), "B,S,196,5985" );
+  BOOST_CHECK_EQUAL( last(direct_tob, "B,S"), "B,S,196,5985" );
+
+  // past a full backlog the matcher waits for the publisher thread,
+  // nothing is dropped
+  Publisher tiny(2);
+  size_t pushed = Publisher::ring_t::Capacity + 10;
+  std::stringstream kept;
+  std::atomic<bool> done(false);
+  std::thread drainer( [&]() {
+    std::this_thread::sleep_for( std::chrono::milliseconds(50) );
+    while ( tiny.drain(kept) || !done.load() ) {
+      std::this_thread::yield();
+    }
+  });
+  for ( size_t i = 1; i <= pushed; ++i ) {
+    tiny.push( OutputRecord::ack(1, int(i)) );
+  }
+  while ( !tiny.flush() ) {
+    std::this_thread::yield();
+  }
+  done.store(true);
+  drainer.join();
+  BOOST_CHECK( tiny.getBacklogged() > 0 && tiny.getStalls() > 0 );
+  std::stringstream expected;
+  for ( size_t i = 1; i <= pushed; ++i ) {
+    expected << "A,1," << i << "\n";
+  }
+  BOOST_CHECK( kept.str() == expected.str() );
+}
+
+BOOST_AUTO_TEST_CASE( replica_test )
+{
+  CoutCapture cap;
+  std::ostringstream err;
+  std::streambuf *old_cerr = std::cerr.rdbuf(err.rdbuf());
+  string name = "/ob_test_replica." + std::to_string(getpid());
+  OrderManager primary_mgr;
+  OrderManager standby_mgr;
+  std::unique_ptr<Replica::Primary> primary( new Replica::Primary(name, 8) );
+  BOOST_REQUIRE( primary->isOpen() );
+  Replica::Standby standby(name);
+  BOOST_REQUIRE( standby.isOpen() );
+
+  auto send = [&]( const vector<string>& msgs ) {
+    vector<Order*> batch;
+    for ( const string& m : msgs ) {
+      batch.push_back( OrderParser::parse(m) );
+    }
+    primary->handleBatch( primary_mgr, batch.data(), batch.size() );
+  };
+  vector<string> flow;
+  for ( int i = 1; i <= 20; ++i ) {
+    flow.push_back( "N,1,IBM," + std::to_string(100 + i % 3) + ",10,B," + std::to_string(i) );
+    flow.push_back( "N,2,IBM," + std::to_string(101 + i % 4) + ",7,S," + std::to_string(i) );
+  }
+  flow.push_back( "C,1,5" );
+  send(flow);
+  while ( standby.poll(standby_mgr) ) {
+  }
+  primary->poll();
+
+  // in lockstep, every check agreed on both ends
+  BOOST_CHECK_EQUAL( standby.getApplied(), 41 );
+  BOOST_CHECK_EQUAL( standby.getLastSeq(), 41 );
+  BOOST_CHECK_EQUAL( primary->getAcked(), 41 );
+  BOOST_CHECK_EQUAL( standby_mgr.checksum(), primary_mgr.checksum() );
+  BOOST_CHECK_EQUAL( standby.getDiverged(), 0 );
+  BOOST_CHECK_EQUAL( primary->getDiverged(), 0 );
+
+  // a message only the standby saw shows up at the next check, on both ends
+  standby_mgr.handle(OrderParser::parse("N,9,IBM,50,1,B,1"));
+  send( vector<string>( 7, "N,3,MSFT,10,1,B,1" ) );
+  standby.poll(standby_mgr);
+  primary->poll();
+  BOOST_CHECK_EQUAL( standby.getDiverged(), 1 );
+  BOOST_CHECK_EQUAL( primary->getDiverged(), 1 );
+  BOOST_CHECK_EQUAL( err.str(), "Diverged from the primary by 48\nStandby diverged by 48\n" );
+
+  // the same levels with the orders queued differently don't match
+  OrderManager a, b;
+  a.handle(OrderParser::parse("N,1,IBM,10,5,B,1"));
+  a.handle(OrderParser::parse("N,2,IBM,10,5,B,2"));
+  b.handle(OrderParser::parse("N,2,IBM,10,5,B,2"));
+  b.handle(OrderParser::parse("N,1,IBM,10,5,B,1"));
+  BOOST_CHECK( a.checksum() != b.checksum() );
+
+  // symbols sharing a record's worth of prefix would land in one book on
+  // the standby only, the primary refuses them on both ends
+  {
+    string name2 = name + ".long";
+    OrderManager p_mgr, s_mgr;
+    Replica::Primary p(name2, 8);
+    Replica::Standby s(name2);
+    BOOST_REQUIRE( p.isOpen() && s.isOpen() );
+    string prefix( Replica::Record::SYMBOL_LEN, 'X' );
+    vector<Order*> batch = { OrderParser::parse("N,4," + prefix + "1,10,5,B,1"),
+                             OrderParser::parse("N,5," + prefix + "2,10,5,S,1"),
+                             OrderParser::parse("N,4," + prefix + ",10,5,B,2") };
+    cap.out.str("");
+    p.handleBatch( p_mgr, batch.data(), batch.size() );
+    while ( s.poll(s_mgr) ) {
+    }
+    BOOST_CHECK_EQUAL( p.getRefused(), 2 );
+    BOOST_CHECK_EQUAL( cap.out.str(), "R,4,1,malformed\nR,5,1,malformed\nA,4,2\nB,B,10,5\n"
+                                      "R,4,1,malformed\nR,5,1,malformed\nA,4,2\nB,B,10,5\n" );
+    BOOST_CHECK_EQUAL( s.getApplied(), 3 );
+    BOOST_CHECK_EQUAL( s_mgr.checksum(), p_mgr.checksum() );
+  }
+
+  // the beat comes from the matching thread, an idle primary that
+  // stops polling is lost until it polls again
+  BOOST_CHECK( !standby.primaryLost() );
+  std::this_thread::sleep_for( std::chrono::milliseconds(30) );
+  BOOST_CHECK( standby.primaryLost( 10000000 ) );
+  primary->poll();
+  BOOST_CHECK( !standby.primaryLost( 10000000 ) );
+
+  // one that stopped normally is done
+  BOOST_CHECK( !standby.primaryDone() );
+  primary.reset();
+  BOOST_CHECK( standby.primaryDone() );
+  std::cerr.rdbuf(old_cerr);
+}
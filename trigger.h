@@ -0,0 +1,82 @@
+#ifndef TRIGGER_H
+#define TRIGGER_H
+
+#include <algorithm>
+#include <vector>
+
+#include "order.h"
+
+using std::vector;
+
+/** Stop orders waiting on one side of a book for their trigger price
+
+    kept sorted the way the ladders are, the next stop to trigger in
+    the last slot.  Later is the side's comparator on stop prices:
+
+      buy stops   std::greater, a trade at or above the stop sets it
+                  off so the lowest stop goes first
+      sell stops  std::less, a trade at or below the stop sets it off
+                  so the highest stop goes first
+
+    stops with the same trigger price go in arrival order.  since
+    everything still waiting hasn't been reached by any trade since it
+    arrived, whatever a new trade sets off is a run at the end and
+    finding it costs nothing beyond popping what triggered.  insert
+    and erase binary search for their slot, O(log n) plus moving the
+    stops nearer the market than the one being placed, which is what
+    the sorted vector pays for keeping the hot end contiguous.
+*/
+template <class Later>
+class TriggerIndex {
+public:
+  TriggerIndex() { entries.reserve(16); }
+
+  bool empty() const { return entries.empty(); }
+  size_t size() const { return entries.size(); }
+  void clear() { entries.clear(); }
+
+  /** o by its stop price, behind any stop already waiting on the same price */
+  void insert( Order *o ) {
+    entries.insert( lowerBound( o->getStopPrice() ), Entry{ o->getStopPrice(), o } );
+  }
+
+  /** false if o isn't waiting here */
+  bool erase( Order *o ) {
+    for ( auto it = lowerBound( o->getStopPrice() );
+          it != entries.end() && it->stop == o->getStopPrice(); ++it ) {
+      if ( it->o == o ) {
+        entries.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /** would a trade at price set off the next stop */
+  bool triggers( int price ) const {
+    return !entries.empty() && !later( entries.back().stop, price );
+  }
+
+  Order* popNext() {
+    Order *o = entries.back().o;
+    entries.pop_back();
+    return o;
+  }
+
+private:
+  struct Entry {
+    int stop;
+    Order *o;
+  };
+
+  /** first slot that triggers no later than stop */
+  typename vector<Entry>::iterator lowerBound( int stop ) {
+    return std::lower_bound( entries.begin(), entries.end(), stop,
+                             [this]( const Entry& e, int s ) { return later(e.stop, s); } );
+  }
+
+  vector<Entry> entries; // worst first, the next to trigger last
+  Later later;
+};
+
+#endif
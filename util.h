@@ -1,8 +1,21 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <cstddef>
 #include <cstdint>
 
 enum class level_id_t : uint32_t {};
+enum class order_id_t : uint32_t {};
+
+const size_t CACHE_LINE = 64;
+
+/** fold v into the running hash h, a splitmix64 finalizer so every
+    input bit reaches every output bit.  not cryptographic */
+inline uint64_t hashMix( uint64_t h, uint64_t v ) {
+  uint64_t x = h ^ ( v + 0x9e3779b97f4a7c15ULL + ( h << 6 ) + ( h >> 2 ) );
+  x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+  x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+  return x ^ ( x >> 31 );
+}
 
 #endif